@@ -3,48 +3,434 @@
 #include <string.h>
 #include <ctype.h>
 #include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <unistd.h>
+#include <sched.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#ifdef __SSSE3__
+#include <tmmintrin.h>
+#endif
+#ifdef __SSE4_2__
+#include <nmmintrin.h>
+#endif
+#ifdef __AVX2__
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
 
 // Maximum length for an IP address string
 #define MAX_IP_LEN 16
-// Number of routers defined
-#define NUM_ROUTERS 4
-// Max number of networks per router
+// Maximum length for a network prefix string (e.g., 255.255.255.255/32)
+#define MAX_PREFIX_LEN 19
+// Routers in the built-in topology (used when no --topology file is given)
+#define DEFAULT_NUM_ROUTERS 4
+// Max number of networks per router accepted at the interactive prompt
 #define MAX_NETWORKS_PER_ROUTER 4
-// Max number of stored routes (SourceIP*DestIP)
-#define MAX_ROUTE_HISTORY 20
+// Default capacity of the route cache (source/destination router pairs, or
+// address pairs with --ecmp), see --cache-size
+#define MAX_ROUTE_HISTORY 4096
 
-// Structure to hold network IPs connected to a router
+// Networks joined to the routers, in the order they were configured, as
+// parallel arrays: a scan over the prefixes touches only prefix memory
+// (16 per cache line) and maps directly onto vector compares.
 struct RouterConfig {
-    char ip[MAX_NETWORKS_PER_ROUTER][MAX_IP_LEN];
+    uint32_t *prefixes;
+    uint8_t *prefix_lens;
+    uint32_t *routers;  // Owner of each network (1-based router ID)
+    size_t count;
+    size_t capacity;
 };
 
 // Global storage for router configurations
-struct RouterConfig router_configs[NUM_ROUTERS];
+struct RouterConfig router_configs;
+
+// Configuration files given on the command line (--topology, --networks)
+const char *topology_path = NULL;
+const char *networks_path = NULL;
+// Query file for the non-interactive mode (--batch FILE, "-" for stdin)
+const char *batch_path = NULL;
+// Compiled network image to write (--compile FILE) or to map at startup (--image FILE)
+const char *compile_path = NULL;
+const char *image_path = NULL;
+// Learned routes kept across runs (--route-cache FILE), also saved every
+// --cache-save-interval seconds if that is set
+const char *route_cache_path = NULL;
+double cache_save_interval = 0;
+// Flow file for the packet simulation (--simulate FILE), with the bandwidth
+// (--link-bandwidth MBPS) and drop-tail queue size (--queue-bytes N) of every link
+const char *simulate_path = NULL;
+uint32_t sim_link_mbps = 1000;
+uint64_t sim_queue_bytes = 256 * 1024;
+
+// Marks an empty child slot in the forwarding table
+#define FIB_NIL 0xFFFFFFFFu
+
+// One node of the path-compressed binary trie (Patricia trie).
+// Children are indices into the node pool so the table can be grown
+// with realloc and later copied or saved without pointer fix-ups.
+struct FibNode {
+    uint32_t prefix;    // Network address, host bits cleared
+    uint32_t child[2];  // Next node for bit 0 / bit 1 after 'len' bits
+    int32_t router;     // 1-based router owning this prefix, 0 = none
+    uint8_t len;        // Prefix length in bits (0-32)
+};
+
+// Bits resolved by the direct-pointing array in front of the trie
+#define FIB_DIRECT_BITS 16
+
+// Direct-pointing entry: best match among prefixes shorter than 16 bits for
+// one 16-bit address slice, plus the trie node where the walk continues.
+struct FibDirectEntry {
+    uint32_t node;
+    int32_t router;
+};
+
+// DIR-24-8 entry: router (low 25 bits) and the length of the prefix it comes
+// from (next 6 bits), or DIR24_CHUNK plus the index of a 256-entry chunk
+// that resolves the last 8 address bits
+#define DIR24_CHUNK 0x80000000u
+#define DIR24_LEN_SHIFT 25
+#define DIR24_MAX_ROUTER ((1u << DIR24_LEN_SHIFT) - 1)
+
+// DIR-24-8 forwarding table: the first 24 address bits index tbl24 directly,
+// so prefixes up to /24 resolve in one memory access and longer ones in two.
+// Kept in sync with the trie by fib_insert/fib_remove.
+struct FibDir24 {
+    uint32_t *tbl24;      // 1 << 24 entries (64 MB)
+    uint32_t *tbl8;       // 256 entries per chunk
+    uint32_t num_chunks;  // Chunks handed out (free ones included)
+    uint32_t chunk_capacity;
+    uint32_t free_chunk;  // Free list threaded through entry 0, FIB_NIL if empty
+    int huge_pages;       // 2 = hugetlbfs pages, 1 = transparent huge pages advised, 0 = none
+};
+
+// Tables with at most this many prefixes are searched by a vector scan
+// instead of the trie (see run_small_fib_benchmark); a multiple of 16
+#define FIB_SMALL_MAX 16
+
+// Forwarding table: longest-prefix-match from an IPv4 address to a router.
+struct Fib {
+    struct FibNode *nodes; // nodes[0] is always the /0 root
+    uint32_t count;
+    uint32_t capacity;
+    uint32_t num_prefixes;
+    struct FibDirectEntry *direct; // NULL or stale until fib_build_index
+    bool direct_valid;
+    struct FibDir24 *dir24;        // NULL unless enabled by fib_enable_dir24
+    // Small tables: all prefixes, longest first, so the first match is the
+    // longest one. Unused slots never match. Valid with the direct index.
+    uint32_t small_count; // 0 if the table is too large
+    uint32_t small_prefix[FIB_SMALL_MAX];
+    uint32_t small_mask[FIB_SMALL_MAX];
+    int32_t small_router[FIB_SMALL_MAX];
+};
+
+// Global forwarding table built from the router configurations
+struct Fib router_fib;
+// Answer lookups from a DIR-24-8 table (--fib dir24), optionally on huge pages (--huge-pages)
+bool fib_dir24_mode = false;
+bool huge_pages_mode = false;
+
+// Key of a stored route: source and destination router (see route_key_for)
+struct RouteKey {
+    uint32_t src;
+    uint32_t dst;
+};
+
+// Hops stored inline in a PathBuilder before it spills to the heap
+#define PATH_INLINE_HOPS 8
+
+// Growable list of router IDs with inline storage for short paths.
+// Appending a hop is an amortized constant-time store.
+struct PathBuilder {
+    uint32_t *hops;   // Points at inline_hops until the path outgrows it
+    uint32_t length;
+    uint32_t capacity;
+    uint32_t inline_hops[PATH_INLINE_HOPS];
+};
+
+// Location of one interned path inside the pool's hop arena
+struct PathRecord {
+    uint64_t offset;
+    uint32_t length;
+    uint32_t hash;
+};
+
+// Shared, deduplicated store of immutable paths. Identical hop sequences get
+// the same path ID, so every route using a path shares one copy. ID 0 = none.
+struct PathPool {
+    uint32_t *hops;          // Arena holding every path's router IDs back to back
+    uint64_t hops_used;
+    uint64_t hops_capacity;
+    struct PathRecord *paths; // Indexed by path ID
+    uint32_t count;           // Path IDs in use, including the reserved ID 0
+    uint32_t capacity;
+    uint32_t *index;          // Open-addressing hash of path IDs (0 = empty)
+    uint32_t index_mask;
+};
+
+// Global pool of learned paths
+struct PathPool path_pool;
+
+// Marks an empty slot in the route cache. The all-ones pair
+// (255.255.255.255 -> 255.255.255.255) is never a routable flow.
+#define ROUTE_CACHE_EMPTY UINT64_MAX
+
+// Stored in place of a path cost too large for a route cache entry; readers
+// recompute such costs from the path (see graph_path_cost)
+#define ROUTE_COST_MAX 0x7FFFFFFFu
+
+// What the route cache stores for one key: the learned path and its cost
+struct RouteCacheValue {
+    uint32_t path;           // Path ID in the path pool, including source and destination
+    uint32_t cost : 31;      // Sum of the link costs along the path (hops on unit-cost graphs)
+    uint32_t referenced : 1; // CLOCK reference bit, set on every hit
+};
+
+// Open-addressing (linear probing) hash table of learned routes, with keys
+// and values in separate arrays: probes read only keys (8 per cache line,
+// twice as many as with interleaved entries), and a value is touched only on
+// a hit. Unbounded caches grow by doubling; bounded ones evict with CLOCK.
+struct RouteCache {
+    uint64_t *keys;                 // Packed (src, dst) pairs, ROUTE_CACHE_EMPTY = free slot
+    struct RouteCacheValue *values;
+    uint64_t mask;      // Slot count - 1 (slot count is a power of two)
+    size_t count;
+    size_t max_entries; // 0 = unbounded
+    uint64_t hand;      // CLOCK hand (slot index)
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t evictions;
+};
 
 // Global storage for route history
-char route_history[MAX_ROUTE_HISTORY][MAX_IP_LEN * 2 + 1];
-// Global storage for intermediate router history (long long to store concatenated ints)
-long long intermediate_history[MAX_ROUTE_HISTORY];
-int history_count = 0;
+struct RouteCache route_cache;
+// Capacity of the interactive route cache
+size_t route_cache_capacity = MAX_ROUTE_HISTORY;
+
+// Directed link between two 0-based routers, used to build a Graph
+struct Edge {
+    uint32_t from;
+    uint32_t to;
+    uint32_t weight;
+};
+
+// Router topology in compressed sparse row form, so memory scales with the
+// number of links. Routers are 1-based in the prompts and 0-based here: the
+// links of router r (0-based) are neighbors[offsets[r] .. offsets[r + 1]),
+// sorted by neighbor. Dense graphs also get a bitset adjacency matrix for
+// O(1) link tests.
+struct Graph {
+    uint32_t num_routers;
+    uint64_t num_links;   // Directed links (an undirected link counts twice)
+    uint64_t *offsets;    // num_routers + 1 entries
+    uint32_t *neighbors;
+    uint32_t *weights;    // Cost per link, NULL = every hop costs 1
+    uint64_t *link_bits;  // Row-major adjacency bits, NULL for sparse graphs
+    uint64_t bits_words;  // 64-bit words per link_bits row
+};
+
+// Default topology: DEFAULT_NUM_ROUTERS routers, undirected links (1-based router IDs).
+// R1 - R2, R1 - R4, R2 - R3, R3 - R4
+static const uint32_t default_links[][2] = { {1, 2}, {1, 4}, {2, 3}, {3, 4} };
+
+// Children per node of the Dijkstra heap. The four children are adjacent
+// (64 bytes), so a 4-ary heap is half as deep as a binary one while each
+// level still touches only one or two cache lines.
+#define HEAP_ARITY 4
+
+// Pending entry of the Dijkstra priority queue
+struct HeapItem {
+    uint64_t dist;
+    uint32_t node;
+};
+
+// Scratch state reused across shortest-path queries on one graph. 'stamp'
+// marks which dist/parent entries belong to the current query, so a query
+// never has to clear O(routers) memory.
+struct SearchWorkspace {
+    uint32_t num_routers;
+    uint64_t *dist;
+    uint32_t *parent;
+    uint32_t *stamp;
+    uint32_t generation;
+    uint32_t *queue;        // BFS frontier
+    struct HeapItem *heap;  // Dijkstra 4-ary heap
+    uint64_t heap_size;
+    uint64_t heap_capacity;
+};
+
+// Global topology (built-in or loaded from --topology), and its query workspace
+struct Graph router_graph;
+struct SearchWorkspace router_search;
+// Compute routes automatically instead of prompting (--auto)
+bool auto_route_mode = false;
+
+// Marks "no next hop" (unreachable, or the router itself) in a NextHopTable
+#define NEXT_HOP_NONE 0xFFFF
+
+// Precomputed next hop for every (source, destination) router pair. Each entry
+// is an index into the source's CSR link list: one byte when every router has
+// fewer than 255 links, two bytes otherwise. Rows are padded to a multiple of
+// 64 entries so builder threads working on different columns never share a
+// cache line.
+struct NextHopTable {
+    uint32_t num_routers;
+    uint64_t row_stride; // Entries per row
+    uint8_t entry_bytes;
+    uint8_t *entries;    // Row = source router (0-based), column = destination
+};
+
+// All-pairs next hops for the interactive session (--precompute)
+struct NextHopTable router_next_hops;
+bool precompute_mode = false;
+// Fill that table by simulating a RIP-style distance-vector protocol
+// (--distance-vector), with an optional metric limit (--dv-infinity N) and
+// split horizon with poisoned reverse (off with --no-split-horizon)
+bool distance_vector_mode = false;
+uint32_t dv_infinity = 0;
+bool dv_split_horizon = true;
+// Or with a simulated OSPF-style link-state protocol (--link-state), whose
+// SPF runs are throttled (--spf-throttle START,HOLD,MAX in milliseconds)
+bool link_state_mode = false;
+uint32_t spf_throttle_ms[3] = { 50, 200, 5000 };
+// Spread flows over all equal-cost paths (--ecmp) instead of one per router pair
+bool ecmp_mode = false;
+// Key cached routes by address pair instead of router pair (set by --ecmp)
+bool route_cache_per_flow = false;
+// Worker threads for parallel builds and batch queries (--threads, default: online CPUs)
+int num_worker_threads = 0;
+
+// Kinds of runtime network changes (see network_apply_change)
+enum { CHANGE_LINK_UP, CHANGE_LINK_DOWN, CHANGE_PREFIX_ADD, CHANGE_PREFIX_DEL };
+
+// One applied change. Each snapshot points to the change that produced it,
+// which points to the one before, so workers can replay what they missed.
+struct NetworkChange {
+    int kind;
+    uint32_t a, b;        // Link endpoints (1-based)
+    uint32_t cost;        // Link cost (CHANGE_LINK_UP)
+    uint32_t router;      // Owner of the prefix (CHANGE_PREFIX_ADD)
+    uint32_t prefix;
+    uint8_t prefix_len;
+    uint64_t version;     // Version of the snapshot this change produced
+    const struct NetworkChange *prev;
+};
+
+// Read-only view of a loaded network. Query threads share one snapshot and
+// never write to it, so lookups need no locks. Updates publish a new
+// snapshot instead of changing this one (see SnapshotDomain).
+struct NetworkSnapshot {
+    const struct Fib *fib;
+    const struct Graph *graph;
+    const struct NextHopTable *next_hops; // NULL without --precompute
+    uint64_t version;                     // 0 for the loaded network, +1 per change
+    const struct NetworkChange *changes;  // Newest change first, NULL for version 0
+    // Parts created by updates, freed with the snapshot that owns them
+    struct Fib *own_fib;
+    struct Graph *own_graph;
+    struct NextHopTable *own_next_hops;
+};
+
+// Most threads that can read snapshots of one domain at the same time
+#define MAX_SNAPSHOT_READERS 256
+
+// Publishes snapshots RCU-style: readers announce the epoch they started in
+// and read the current pointer without locks; an update swaps the pointer,
+// advances the epoch and frees the old snapshot once every reader that could
+// still see it has finished.
+struct SnapshotDomain {
+    _Atomic(struct NetworkSnapshot *) current;
+    atomic_uint_fast64_t epoch;
+    atomic_uint_fast64_t reader_epoch[MAX_SNAPSHOT_READERS]; // 0 = not reading
+    atomic_int num_readers;
+    pthread_mutex_t update_lock;                             // One update at a time
+};
+
+// Snapshot of the globals above, valid once load_network() has run
+struct NetworkSnapshot router_snapshot;
 
 // =======================================================
 // UTILITY FUNCTIONS
 // =======================================================
 
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// Bytes that must be readable at the start of scan_ipv4's input
+#define IPV4_SCAN_PAD (MAX_IP_LEN + 4)
+
 /**
- * @brief Checks if a string contains only digits.
- * @param str The string to validate.
- * @return True if valid, False otherwise.
+ * @brief Parses one dotted-quad address starting at 'p' (e.g., 192.168.1.1).
+ * Single pass and allocation-free: each octet is folded from 1-3 digits with
+ * conditional moves and every check is accumulated into one flag, so the only
+ * branch is the final accept/reject. The digit loads do not depend on each
+ * other, which keeps the per-octet dependency chain short.
+ * @param p Start of the address text; IPV4_SCAN_PAD bytes must be readable.
+ * @param addr Receives the address, first octet in the most significant byte.
+ * @return Pointer just past the address, or NULL if it is malformed.
  */
-bool validate_number(const char *str) {
-    if (!*str) return false;
-    while (*str) {
-        if (!isdigit((unsigned char)*str)) {
-            return false;
-        }
-        str++;
+const char *scan_ipv4(const char *p, uint32_t *addr) {
+    uint32_t value = 0;
+    unsigned ok = 1;
+
+    for (int octet = 0; octet < 4; octet++) {
+        unsigned d0 = (unsigned char)p[0] - '0';
+        unsigned d1 = (unsigned char)p[1] - '0';
+        unsigned d2 = (unsigned char)p[2] - '0';
+        unsigned n0 = d0 <= 9;
+        unsigned n1 = n0 & (d1 <= 9);
+        unsigned n2 = n1 & (d2 <= 9);
+        unsigned len = n0 + n1 + n2;
+
+        unsigned v = d0;
+        v = v * (1 + 9 * n1) + (d1 & -n1);
+        v = v * (1 + 9 * n2) + (d2 & -n2);
+        ok &= n0 & (v <= 255);
+        value = (value << 8) | (v & 0xFF);
+
+        // Octets 1-3 must be followed by a dot; the last one by a non-digit
+        unsigned char next = (unsigned char)p[len];
+        unsigned is_dot = next == '.';
+        unsigned is_digit = (unsigned)(next - '0') <= 9;
+        unsigned inner = octet < 3;
+        ok &= (inner & is_dot) | (!inner & !is_digit);
+        p += len + (inner & is_dot);
     }
-    return true;
+
+    *addr = value;
+    return ok ? p : NULL;
+}
+
+/**
+ * @brief Copies up to MAX_IP_LEN + 3 bytes of 'str' into a zero-padded
+ * buffer so scan_ipv4 can read ahead without running off the string.
+ */
+static void ipv4_pad_copy(char *buf, const char *str, size_t avail) {
+    size_t len = avail < MAX_IP_LEN + 3 ? avail : MAX_IP_LEN + 3;
+    memset(buf, 0, IPV4_SCAN_PAD);
+    memcpy(buf, str, len);
+}
+
+/**
+ * @brief Parses a complete IPv4 address string into a 32-bit address.
+ * @return True if the whole string is a valid address, False otherwise.
+ */
+bool parse_ipv4(const char *ip_str, uint32_t *addr) {
+    if (ip_str == NULL) return false;
+    char buf[IPV4_SCAN_PAD];
+    ipv4_pad_copy(buf, ip_str, strnlen(ip_str, MAX_IP_LEN));
+    const char *end = scan_ipv4(buf, addr);
+    return end != NULL && *end == '\0' && ip_str[end - buf] == '\0';
 }
 
 /**
@@ -53,315 +439,7985 @@ bool validate_number(const char *str) {
  * @return True if valid (4 octets, 0-255), False otherwise.
  */
 bool validate_ip(const char *ip_str) {
-    if (ip_str == NULL || ip_str[0] == '\0') return false;
+    uint32_t addr;
+    return parse_ipv4(ip_str, &addr);
+}
 
-    // We must work on a copy because strtok modifies the string.
-    char temp_ip[MAX_IP_LEN];
-    strncpy(temp_ip, ip_str, MAX_IP_LEN - 1);
-    temp_ip[MAX_IP_LEN - 1] = '\0';
+/**
+ * @brief Formats a 32-bit address as dotted-quad text.
+ * @param buf Output buffer of at least MAX_IP_LEN bytes.
+ */
+void format_ipv4(uint32_t addr, char *buf) {
+    snprintf(buf, MAX_IP_LEN, "%u.%u.%u.%u", addr >> 24, (addr >> 16) & 0xFF, (addr >> 8) & 0xFF, addr & 0xFF);
+}
 
-    char *ptr;
-    int dots = 0;
-    int num;
-    int octet_count = 0;
+#ifdef __SSSE3__
+// pshufb patterns indexed by the four octet lengths (1-3 each, 81 combinations).
+// Each octet's digits are right-aligned into its own 4-byte lane.
+static uint8_t ipv4_shuffle_table[81][16];
 
-    ptr = strtok(temp_ip, ".");
+/**
+ * @brief Parses one address with SSSE3. 'p' must have 16 readable bytes.
+ */
+static const char *scan_ipv4_simd(const char *p, uint32_t *addr) {
+    __m128i in = _mm_loadu_si128((const __m128i *)p);
+    __m128i digits = _mm_sub_epi8(in, _mm_set1_epi8('0'));
+    __m128i is_digit = _mm_cmpeq_epi8(_mm_min_epu8(digits, _mm_set1_epi8(9)), digits);
+    __m128i is_dot = _mm_cmpeq_epi8(in, _mm_set1_epi8('.'));
+    unsigned digit_mask = (unsigned)_mm_movemask_epi8(is_digit);
+    unsigned dot_mask = (unsigned)_mm_movemask_epi8(is_dot);
 
-    while (ptr) {
-        octet_count++;
-        if (!validate_number(ptr)) return false;
+    // The address ends at the first byte that is neither digit nor dot
+    unsigned len = (unsigned)__builtin_ctz(~(digit_mask | dot_mask));
+    if (len > 15) return NULL;
+    dot_mask &= (1u << len) - 1;
+    if (__builtin_popcount(dot_mask) != 3) return NULL;
 
-        num = atoi(ptr);
-        if (num < 0 || num > 255) return false;
+    unsigned dot1 = (unsigned)__builtin_ctz(dot_mask);
+    dot_mask &= dot_mask - 1;
+    unsigned dot2 = (unsigned)__builtin_ctz(dot_mask);
+    dot_mask &= dot_mask - 1;
+    unsigned dot3 = (unsigned)__builtin_ctz(dot_mask);
 
-        ptr = strtok(NULL, ".");
-        if (ptr != NULL) {
-            dots++;
+    // Octet lengths minus one; unsigned wrap rejects empty octets
+    unsigned l1 = dot1 - 1, l2 = dot2 - dot1 - 2, l3 = dot3 - dot2 - 2, l4 = len - dot3 - 2;
+    if ((l1 > 2) | (l2 > 2) | (l3 > 2) | (l4 > 2)) return NULL;
+
+    __m128i lanes = _mm_shuffle_epi8(digits, _mm_loadu_si128((const __m128i *)ipv4_shuffle_table[l1 * 27 + l2 * 9 + l3 * 3 + l4]));
+    __m128i pairs = _mm_maddubs_epi16(lanes, _mm_set1_epi32(0x010A6400)); // 0, 100, 10, 1 per lane
+    __m128i octets = _mm_hadd_epi16(pairs, pairs);
+    if (_mm_movemask_epi8(_mm_cmpgt_epi16(octets, _mm_set1_epi16(255))) & 0xFF) return NULL;
+
+    *addr = __builtin_bswap32((uint32_t)_mm_cvtsi128_si32(_mm_packus_epi16(octets, octets)));
+    return p + len;
+}
+#endif
+
+/**
+ * @brief Prepares the lookup tables for the SIMD parser (no-op without SSSE3).
+ */
+void ipv4_parser_init(void) {
+#ifdef __SSSE3__
+    for (int idx = 0; idx < 81; idx++) {
+        int lens[4] = { idx / 27 + 1, idx / 9 % 3 + 1, idx / 3 % 3 + 1, idx % 3 + 1 };
+        int pos = 0;
+        for (int octet = 0; octet < 4; octet++) {
+            for (int k = 0; k < 4; k++) {
+                int digit = k - (4 - lens[octet]); // Right-align the digits
+                ipv4_shuffle_table[idx][octet * 4 + k] = digit >= 0 ? (uint8_t)(pos + digit) : 0x80;
+            }
+            pos += lens[octet] + 1; // Skip the digits and the dot
         }
     }
+#endif
+}
 
-    // Must have 4 octets and 3 dots
-    if (octet_count != 4 || dots != 3) {
-        return false;
+/**
+ * @brief Parses whitespace-separated addresses from a buffer (need not be NUL-terminated).
+ * Uses the SIMD parser while 16 bytes remain and the scalar parser for the tail.
+ * @param count Receives the number of addresses written to 'out'.
+ * @return Where parsing stopped: 'end', or the first malformed token once
+ *         fewer than 'max_out' addresses were stored.
+ */
+const char *parse_ipv4_list(const char *p, const char *end, uint32_t *out, size_t max_out, size_t *count) {
+    size_t n = 0;
+
+    while (n < max_out) {
+        while (p < end && isspace((unsigned char)*p)) p++;
+        if (p == end) break;
+
+        const char *next;
+#ifdef __SSSE3__
+        if (end - p >= 16) {
+            next = scan_ipv4_simd(p, &out[n]);
+        } else
+#endif
+        {
+            // Copy the tail so the scalar parser can read ahead safely
+            char tail[IPV4_SCAN_PAD];
+            ipv4_pad_copy(tail, p, (size_t)(end - p));
+            next = scan_ipv4(tail, &out[n]);
+            if (next != NULL) next = p + (next - tail);
+        }
+
+        if (next == NULL || (next < end && !isspace((unsigned char)*next))) break;
+        p = next;
+        n++;
     }
-    return true;
+
+    *count = n;
+    return p;
 }
 
 /**
- * @brief Finds the router connected to a given IP address (based on exact match).
- * @param ip The IP address string to search for.
- * @return The router number (1-based), or 0 if not found.
+ * @brief Exits cleanly when a prompt hits end of input instead of re-prompting forever.
+ * @param scanf_result The return value of the scanf call that read the answer.
  */
-int find_router_by_ip(const char *ip, const int *num_networks) {
-    for (int i = 0; i < NUM_ROUTERS; i++) {
-        for (int j = 0; j < num_networks[i]; j++) {
-            if (strcmp(router_configs[i].ip[j], ip) == 0) {
-                // Return 1-based router number
-                return i + 1;
-            }
+void check_input_open(int scanf_result) {
+    if (scanf_result == EOF) {
+        printf("\nInput closed. Exiting.\n");
+        exit(0);
+    }
+}
+
+/**
+ * @brief Discards the rest of the current input line (after a bad answer).
+ */
+void discard_input_line(void) {
+    int ch;
+    while ((ch = getchar()) != '\n') {
+        check_input_open(ch);
+    }
+}
+
+/**
+ * @brief Parses one address from [p, end) with scan_ipv4. Reads straight
+ * from the input when it has IPV4_SCAN_PAD bytes left, else from a padded copy.
+ * @return Pointer just past the address, or NULL if it is malformed.
+ */
+const char *scan_ipv4_bounded(const char *p, const char *end, uint32_t *addr) {
+    const char *q;
+    if (end - p >= IPV4_SCAN_PAD) {
+        q = scan_ipv4(p, addr);
+    } else {
+        char buf[IPV4_SCAN_PAD];
+        ipv4_pad_copy(buf, p, (size_t)(end - p));
+        q = scan_ipv4(buf, addr);
+        if (q != NULL) q = p + (q - buf);
+    }
+    return q == NULL || q > end ? NULL : q;
+}
+
+/**
+ * @brief Parses a network in "a.b.c.d" or "a.b.c.d/len" form from [p, end).
+ * A plain address is treated as a /32 host route. Host bits are cleared.
+ * @return Pointer just past the network, or NULL if it is malformed.
+ */
+const char *scan_prefix(const char *p, const char *end, uint32_t *prefix, uint8_t *len) {
+    uint32_t addr;
+    unsigned bits = 32;
+    const char *q = scan_ipv4_bounded(p, end, &addr);
+    if (q == NULL) return NULL;
+
+    if (q < end && *q == '/') {
+        q++;
+        if (q == end || !isdigit((unsigned char)q[0])) return NULL;
+        bits = (unsigned)(q[0] - '0');
+        q++;
+        if (q < end && isdigit((unsigned char)q[0])) {
+            bits = bits * 10 + (unsigned)(q[0] - '0');
+            q++;
         }
+        if (bits > 32 || (q < end && isdigit((unsigned char)q[0]))) return NULL;
     }
-    return 0; // Not found
+
+    *len = (uint8_t)bits;
+    *prefix = addr & (bits ? 0xFFFFFFFFu << (32 - bits) : 0);
+    return q;
 }
 
 /**
- * @brief Concatenates two integers for history logging (e.g., 1, 2 -> 12).
- * Note: Only safe for small numbers (like router IDs).
+ * @brief Parses a network in "a.b.c.d" or "a.b.c.d/len" form.
+ * A plain address is treated as a /32 host route. Host bits are cleared.
+ * @return True if valid, False otherwise.
  */
-long long concat_router_ids(long long current_val, int new_id) {
-    char s1[32], s2[32];
-    sprintf(s1, "%lld", current_val);
-    sprintf(s2, "%d", new_id);
-    strcat(s1, s2);
-    return atoll(s1);
+bool parse_prefix(const char *str, uint32_t *prefix, uint8_t *len) {
+    const char *end = str + strnlen(str, MAX_PREFIX_LEN);
+    const char *p = scan_prefix(str, end, prefix, len);
+    return p != NULL && *p == '\0';
+}
+
+/**
+ * @brief Parses an unsigned decimal number from [p, end).
+ * @return Pointer just past the digits, or NULL if there are none or the value exceeds 32 bits.
+ */
+const char *scan_uint(const char *p, const char *end, uint32_t *value) {
+    uint64_t v = 0;
+    const char *start = p;
+
+    while (p < end && (unsigned)(*p - '0') <= 9 && p - start < 10) {
+        v = v * 10 + (unsigned)(*p - '0');
+        p++;
+    }
+    if (p == start || v > UINT32_MAX || (p < end && (unsigned)(*p - '0') <= 9)) return NULL;
+    *value = (uint32_t)v;
+    return p;
+}
+
+// Fields of configuration and query files are separated by blanks or commas
+static inline const char *skip_field_separators(const char *p, const char *end) {
+    while (p < end && (*p == ' ' || *p == '\t' || *p == ',' || *p == '\r')) p++;
+    return p;
+}
+
+// Bandwidth-derived link cost, as in OSPF: reference bandwidth / link bandwidth
+#define REFERENCE_BANDWIDTH_MBPS 100000
+
+/**
+ * @brief Parses the metric fields of a link up to 'end': either a plain cost,
+ * or "latency=N" (microseconds) and/or "bandwidth=N" (Mbit/s), which combine
+ * into latency + REFERENCE_BANDWIDTH_MBPS / bandwidth (at least 1, so a
+ * 100 Gbit/s link with 10 us latency costs 11 and a 1 Gbit/s one 110).
+ * @param cost Receives the link cost; unchanged if there are no fields.
+ * @return 'end' on success, or NULL if a field is malformed or a plain cost
+ * is mixed with metrics.
+ */
+const char *scan_link_metrics(const char *p, const char *end, uint32_t *cost) {
+    uint32_t plain = 0, latency = 0, bandwidth = 0;
+    bool have_plain = false, have_metric = false;
+
+    for (p = skip_field_separators(p, end); p < end; p = skip_field_separators(p, end)) {
+        if ((unsigned)(*p - '0') <= 9) {
+            if (have_plain) return NULL;
+            p = scan_uint(p, end, &plain);
+            have_plain = true;
+        } else if (end - p > 8 && memcmp(p, "latency=", 8) == 0) {
+            p = scan_uint(p + 8, end, &latency);
+            have_metric = true;
+        } else if (end - p > 10 && memcmp(p, "bandwidth=", 10) == 0) {
+            p = scan_uint(p + 10, end, &bandwidth);
+            if (bandwidth == 0) return NULL;
+            have_metric = true;
+        } else {
+            return NULL;
+        }
+        if (p == NULL) return NULL;
+    }
+    if (have_plain && have_metric) return NULL;
+    if (have_plain) {
+        *cost = plain;
+    } else if (have_metric) {
+        uint64_t total = (uint64_t)latency + (bandwidth ? REFERENCE_BANDWIDTH_MBPS / bandwidth : 0);
+        *cost = total == 0 ? 1 : total > UINT32_MAX ? UINT32_MAX : (uint32_t)total;
+    }
+    return p;
 }
 
 // =======================================================
-// MAIN ROUTING LOGIC
+// FORWARDING TABLE (LONGEST PREFIX MATCH)
 // =======================================================
 
-void run_routing_simulation() {
-    // Connection Matrix: 1 = Direct Link, 0 = No Direct Link
-    // Router numbering: [0] = R1, [1] = R2, [2] = R3, [3] = R4
-    int connection_matrix[NUM_ROUTERS][NUM_ROUTERS] = {
-        {1, 1, 0, 1}, // R1 connects to R1, R2, R4
-        {1, 1, 1, 0}, // R2 connects to R1, R2, R3
-        {0, 1, 1, 1}, // R3 connects to R2, R3, R4
-        {1, 0, 1, 1}  // R4 connects to R1, R3, R4
-    };
+static inline uint32_t prefix_mask(uint8_t len) {
+    return len ? 0xFFFFFFFFu << (32 - len) : 0;
+}
 
-    int num_networks[NUM_ROUTERS] = {0};
-    int total_networks = 0;
+// Returns bit 'pos' of an address, counting from the most significant bit.
+static inline int addr_bit(uint32_t addr, uint8_t pos) {
+    return (addr >> (31 - pos)) & 1;
+}
 
-    printf("--- Network Router Simulation ---\n");
-    printf("Routers are connected like this (1 = Direct Link):\n");
-    printf("  1 2 3 4\n");
-    for (int i = 0; i < NUM_ROUTERS; i++) {
-        printf("%d ", i + 1);
-        for (int j = 0; j < NUM_ROUTERS; j++) {
-            printf("%d ", connection_matrix[i][j]);
-        }
-        printf("\n");
+static uint32_t fib_new_node(struct Fib *fib, uint32_t prefix, uint8_t len, int router) {
+    if (fib->count == fib->capacity) {
+        uint32_t new_cap = fib->capacity ? fib->capacity * 2 : 64;
+        struct FibNode *grown = realloc(fib->nodes, new_cap * sizeof(struct FibNode));
+        if (grown == NULL) return FIB_NIL;
+        fib->nodes = grown;
+        fib->capacity = new_cap;
     }
+    struct FibNode *n = &fib->nodes[fib->count];
+    n->prefix = prefix;
+    n->len = len;
+    n->router = router;
+    n->child[0] = n->child[1] = FIB_NIL;
+    fib->direct_valid = false;
+    return fib->count++;
+}
 
-    // 1. INPUT NETWORK IPs
-    for (int i = 0; i < NUM_ROUTERS; i++) {
-        do {
-            printf("How many networks are joined to router %d (max %d): ", i + 1, MAX_NETWORKS_PER_ROUTER);
-            if (scanf("%d", &num_networks[i]) != 1) {
-                // Handle non-integer input
-                while (getchar() != '\n');
-                num_networks[i] = -1;
-            }
-        } while (num_networks[i] < 0 || num_networks[i] > MAX_NETWORKS_PER_ROUTER);
-        total_networks += num_networks[i];
+// Size of the DIR-24-8 first-level array
+#define DIR24_TBL24_BYTES (sizeof(uint32_t) << 24)
+
+static inline uint32_t dir24_entry(int router, uint8_t len) {
+    return (uint32_t)len << DIR24_LEN_SHIFT | (uint32_t)router;
+}
+
+static inline uint8_t dir24_entry_len(uint32_t e) {
+    return (uint8_t)(e >> DIR24_LEN_SHIFT & 0x3F);
+}
+
+/**
+ * @brief Maps the 64 MB first-level array, zeroed (no routes). With
+ * 'huge_pages' it asks for hugetlbfs pages and falls back to advising
+ * transparent huge pages, so lookups do not miss the TLB on every access.
+ * @return The array, or NULL if out of memory.
+ */
+static uint32_t *dir24_map_tbl24(bool huge_pages, int *huge) {
+    void *p = MAP_FAILED;
+    *huge = 0;
+#ifdef MAP_HUGETLB
+    if (huge_pages) {
+        p = mmap(NULL, DIR24_TBL24_BYTES, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if (p != MAP_FAILED) *huge = 2;
+    }
+#endif
+    if (p == MAP_FAILED) {
+        p = mmap(NULL, DIR24_TBL24_BYTES, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (p == MAP_FAILED) return NULL;
+#ifdef MADV_HUGEPAGE
+        if (huge_pages && madvise(p, DIR24_TBL24_BYTES, MADV_HUGEPAGE) == 0) *huge = 1;
+#endif
     }
-    printf("Total networks defined: %d\n", total_networks);
+    return p;
+}
 
-    // Input IP addresses
-    char input_ip[MAX_IP_LEN];
-    for (int i = 0; i < NUM_ROUTERS; i++) {
-        for (int j = 0; j < num_networks[i]; j++) {
-            do {
-                printf("Enter router %d Network IP address %d: ", i + 1, j + 1);
-                scanf("%s", input_ip);
-            } while (!validate_ip(input_ip));
-            // Copy validated IP to the configuration structure
-            strcpy(router_configs[i].ip[j], input_ip);
+static void dir24_free(struct FibDir24 *d) {
+    if (d == NULL) return;
+    if (d->tbl24) munmap(d->tbl24, DIR24_TBL24_BYTES);
+    free(d->tbl8);
+    free(d);
+}
+
+/**
+ * @brief Takes a chunk from the free list or grows the chunk array, and fills
+ * it with 'e' (the entry it replaces in tbl24).
+ * @return The chunk index, or FIB_NIL if out of memory.
+ */
+static uint32_t dir24_new_chunk(struct FibDir24 *d, uint32_t e) {
+    uint32_t c = d->free_chunk;
+    if (c != FIB_NIL) {
+        d->free_chunk = d->tbl8[(size_t)c << 8];
+    } else {
+        if (d->num_chunks == d->chunk_capacity) {
+            uint32_t capacity = d->chunk_capacity ? d->chunk_capacity * 2 : 64;
+            if (capacity >= DIR24_CHUNK) return FIB_NIL;
+            uint32_t *grown = realloc(d->tbl8, ((size_t)capacity << 8) * sizeof(uint32_t));
+            if (grown == NULL) return FIB_NIL;
+            d->tbl8 = grown;
+            d->chunk_capacity = capacity;
         }
+        c = d->num_chunks++;
     }
-    printf("\nIP configurations loaded successfully.\n");
-
-    // 2. ROUTING LOOP
-    int continue_flag = 0;
-    while (continue_flag == 0 && history_count < MAX_ROUTE_HISTORY) {
-        char source_ip[MAX_IP_LEN];
-        char destination_ip[MAX_IP_LEN];
-        int source_router = 0;
-        int dest_router = 0;
+    uint32_t *chunk = &d->tbl8[(size_t)c << 8];
+    for (int i = 0; i < 256; i++) chunk[i] = e;
+    return c;
+}
 
-        printf("\n--- Start Routing Query %d ---\n", history_count + 1);
+// Sets entries that came from prefixes of length min_len..len to 'e'
+static inline void dir24_fill(uint32_t *entries, size_t count, uint32_t e, uint8_t min_len, uint8_t len) {
+    for (size_t i = 0; i < count; i++) {
+        uint8_t cur = dir24_entry_len(entries[i]);
+        if (cur <= len && cur >= min_len) entries[i] = e;
+    }
+}
 
-        // --- Get and Validate Source IP ---
-        do {
-            printf("Enter source IP address: ");
-            scanf("%s", source_ip);
-            if (!validate_ip(source_ip)) {
-                printf("Invalid IP format. Please re-enter.\n");
-                source_router = 0;
-                continue;
-            }
-            source_router = find_router_by_ip(source_ip, num_networks);
-            if (source_router == 0) {
-                printf("Error: Source IP not found in any router's network list. Please re-enter.\n");
+/**
+ * @brief Writes 'e' over the part of the table covered by (prefix, len),
+ * except where a longer prefix or one shorter than min_len owns the entry.
+ * Insert passes min_len 0; delete passes the deleted length and the entry of
+ * the covering prefix, so only addresses the deleted prefix owned change.
+ * @return True on success, False if out of memory (table unchanged).
+ */
+static bool dir24_update(struct FibDir24 *d, uint32_t prefix, uint8_t len, uint32_t e, uint8_t min_len) {
+    if (len <= 24) {
+        size_t first = prefix >> 8, count = (size_t)1 << (24 - len);
+        for (size_t i = first; i < first + count; i++) {
+            uint32_t cur = d->tbl24[i];
+            if (cur & DIR24_CHUNK) {
+                dir24_fill(&d->tbl8[(size_t)(cur & ~DIR24_CHUNK) << 8], 256, e, min_len, len);
+            } else {
+                dir24_fill(&d->tbl24[i], 1, e, min_len, len);
             }
-        } while (source_router == 0);
+        }
+        return true;
+    }
 
-        printf("Source router is %d\n", source_router);
+    uint32_t *slot = &d->tbl24[prefix >> 8];
+    if (!(*slot & DIR24_CHUNK)) {
+        if (min_len > 24) return true; // Deleting a prefix that was never spread out
+        uint32_t c = dir24_new_chunk(d, *slot);
+        if (c == FIB_NIL) return false;
+        *slot = DIR24_CHUNK | c;
+    }
+    uint32_t *chunk = &d->tbl8[(size_t)(*slot & ~DIR24_CHUNK) << 8];
+    dir24_fill(chunk + (prefix & 0xFF), (size_t)1 << (32 - len), e, min_len, len);
 
-        // --- Get and Validate Destination IP ---
-        do {
-            printf("Enter Destination IP address: ");
-            scanf("%s", destination_ip);
-            if (!validate_ip(destination_ip)) {
-                printf("Invalid IP format. Please re-enter.\n");
-                dest_router = 0;
-                continue;
-            }
-            dest_router = find_router_by_ip(destination_ip, num_networks);
-            if (dest_router == 0) {
-                printf("Error: Destination IP not found in any router's network list. Please re-enter.\n");
-            }
-        } while (dest_router == 0);
+    // A chunk that no longer differs within its /24 folds back into tbl24
+    int i = 1;
+    while (i < 256 && chunk[i] == chunk[0]) i++;
+    if (i == 256) {
+        uint32_t c = *slot & ~DIR24_CHUNK;
+        *slot = chunk[0];
+        chunk[0] = d->free_chunk;
+        d->free_chunk = c;
+    }
+    return true;
+}
 
-        printf("Destination router is %d\n", dest_router);
+/**
+ * @brief Initializes an empty forwarding table (just the /0 root node).
+ */
+void fib_init(struct Fib *fib) {
+    fib->nodes = NULL;
+    fib->count = fib->capacity = fib->num_prefixes = 0;
+    fib->direct = NULL;
+    fib->direct_valid = false;
+    fib->dir24 = NULL;
+    fib->small_count = 0;
+    fib_new_node(fib, 0, 0, 0);
+}
+
+void fib_free(struct Fib *fib) {
+    free(fib->nodes);
+    free(fib->direct);
+    dir24_free(fib->dir24);
+    fib->nodes = NULL;
+    fib->direct = NULL;
+    fib->dir24 = NULL;
+    fib->direct_valid = false;
+    fib->small_count = 0;
+    fib->count = fib->capacity = fib->num_prefixes = 0;
+}
 
-        // --- Check History ---
-        char current_route_key[MAX_IP_LEN * 2 + 1];
-        sprintf(current_route_key, "%s*%s", source_ip, destination_ip);
+static bool fib_trie_insert(struct Fib *fib, uint32_t prefix, uint8_t len, int router) {
+    uint32_t cur = 0;
 
-        int final_history_index = -1;
-        for (int l2 = 0; l2 < history_count; l2++) {
-            if (strcmp(route_history[l2], current_route_key) == 0) {
-                final_history_index = l2;
-                break;
-            }
+    for (;;) {
+        // Invariant: nodes[cur] is a prefix of (prefix, len)
+        if (fib->nodes[cur].len == len) {
+            if (fib->nodes[cur].router == 0) fib->num_prefixes++;
+            fib->nodes[cur].router = router;
+            fib->direct_valid = false;
+            return true;
         }
 
-        if (final_history_index != -1) {
-            // Route found in history
-            printf("\n--- HISTORY FOUND ---\n");
-            printf("Source IP address: %s \n--> Source Router: %d \n--> Destination Router: %d \n--> Destination IP address: %s\n",
-                   source_ip, source_router, dest_router, destination_ip);
-            printf("Intermediate Routers details (Concatenated IDs): %lld\n", intermediate_history[final_history_index]);
-        } else {
-            // --- Determine New Route ---
-            int current_router = source_router;
-            int direct_connection = connection_matrix[source_router - 1][dest_router - 1];
-            long long route_path = concat_router_ids(0, source_router); // Start path with source router
+        int b = addr_bit(prefix, fib->nodes[cur].len);
+        uint32_t c = fib->nodes[cur].child[b];
+        if (c == FIB_NIL) {
+            uint32_t leaf = fib_new_node(fib, prefix, len, router);
+            if (leaf == FIB_NIL) return false;
+            fib->nodes[cur].child[b] = leaf;
+            fib->num_prefixes++;
+            return true;
+        }
 
-            // If direct link exists, offer short path option
-            if (direct_connection == 1) {
-                int choice;
-                printf("Direct link found between R%d and R%d.\n", source_router, dest_router);
-                printf("Do you want to choose the direct path for routing (1=Yes, 0=No/Custom): ");
-                scanf("%d", &choice);
+        // Length of the common prefix between the new prefix and the child
+        uint32_t diff = prefix ^ fib->nodes[c].prefix;
+        uint8_t common = diff ? (uint8_t)__builtin_clz(diff) : 32;
+        if (common > len) common = len;
+        if (common > fib->nodes[c].len) common = fib->nodes[c].len;
 
-                if (choice == 1) {
-                    route_path = concat_router_ids(route_path, dest_router);
-                    printf("\n--- DIRECT ROUTE SELECTED ---\n");
-                    goto route_complete;
-                }
-            }
+        if (common == fib->nodes[c].len) {
+            cur = c; // Child covers the new prefix: descend
+            continue;
+        }
+
+        if (common == len) {
+            // New prefix sits between cur and the child
+            uint32_t n = fib_new_node(fib, prefix, len, router);
+            if (n == FIB_NIL) return false;
+            fib->nodes[n].child[addr_bit(fib->nodes[c].prefix, len)] = c;
+            fib->nodes[cur].child[b] = n;
+            fib->num_prefixes++;
+            return true;
+        }
+
+        // Prefixes diverge: split with an internal node at the common length
+        uint32_t split = fib_new_node(fib, prefix & prefix_mask(common), common, 0);
+        if (split == FIB_NIL) return false;
+        uint32_t leaf = fib_new_node(fib, prefix, len, router);
+        if (leaf == FIB_NIL) {
+            fib->count--; // Drop the unlinked split node: a failed insert leaves the trie as it was
+            return false;
+        }
+        fib->nodes[split].child[addr_bit(fib->nodes[c].prefix, common)] = c;
+        fib->nodes[split].child[addr_bit(prefix, common)] = leaf;
+        fib->nodes[cur].child[b] = split;
+        fib->num_prefixes++;
+        return true;
+    }
+}
+
+// Trie node holding exactly (prefix, len), possibly a glue node, or FIB_NIL
+static uint32_t fib_trie_find(const struct Fib *fib, uint32_t prefix, uint8_t len) {
+    uint32_t cur = 0;
+    while (cur != FIB_NIL) {
+        const struct FibNode *n = &fib->nodes[cur];
+        if ((prefix & prefix_mask(n->len)) != n->prefix || n->len > len) return FIB_NIL;
+        if (n->len == len) return cur;
+        cur = n->child[addr_bit(prefix, n->len)];
+    }
+    return FIB_NIL;
+}
+
+/**
+ * @brief Adds (or replaces) the owner of a prefix in the forwarding table.
+ * @param prefix Network address; bits beyond 'len' are ignored.
+ * @param len Prefix length (0-32).
+ * @param router 1-based router number (at most DIR24_MAX_ROUTER with DIR-24-8).
+ * @return True on success, False if out of memory.
+ */
+bool fib_insert(struct Fib *fib, uint32_t prefix, uint8_t len, int router) {
+    prefix &= prefix_mask(len);
+    if (fib->dir24 && (uint32_t)router > DIR24_MAX_ROUTER) return false;
+    uint32_t node = fib_trie_find(fib, prefix, len);
+    int previous = node == FIB_NIL ? 0 : fib->nodes[node].router;
+    if (!fib_trie_insert(fib, prefix, len, router)) return false;
+    if (fib->dir24 && !dir24_update(fib->dir24, prefix, len, dir24_entry(router, len), 0)) {
+        // Put the trie back so both structures still agree; the node exists
+        // now, so this allocates nothing
+        node = fib_trie_find(fib, prefix, len);
+        if (previous == 0) fib->num_prefixes--;
+        fib->nodes[node].router = previous;
+        fib->direct_valid = false;
+        return false;
+    }
+    return true;
+}
+
+/**
+ * @brief Removes a prefix. Its trie node stays as a glue node (router 0).
+ * @return True if the prefix was present, False otherwise.
+ */
+bool fib_remove(struct Fib *fib, uint32_t prefix, uint8_t len) {
+    prefix &= prefix_mask(len);
+    uint32_t cur = 0;
+    int covering = 0;       // Longest shorter prefix, which takes over the addresses
+    uint8_t covering_len = 0;
+
+    while (cur != FIB_NIL) {
+        const struct FibNode *n = &fib->nodes[cur];
+        if ((prefix & prefix_mask(n->len)) != n->prefix || n->len > len) return false;
+        if (n->len == len) {
+            if (n->router == 0) return false;
+            // Only shrinks or frees chunks, so it cannot run out of memory
+            if (fib->dir24) dir24_update(fib->dir24, prefix, len, dir24_entry(covering, covering_len), len);
+            fib->nodes[cur].router = 0;
+            fib->num_prefixes--;
+            fib->direct_valid = false;
+            return true;
+        }
+        if (n->router) {
+            covering = n->router;
+            covering_len = n->len;
+        }
+        cur = n->child[addr_bit(prefix, n->len)];
+    }
+    return false;
+}
+
+/**
+ * @brief Adds a DIR-24-8 table holding the current prefixes; from then on
+ * fib_insert/fib_remove keep it up to date and lookups use it.
+ * @param huge_pages Back the 64 MB first-level array with huge pages if possible.
+ * @return True on success, False if out of memory or a router ID is above DIR24_MAX_ROUTER.
+ */
+bool fib_enable_dir24(struct Fib *fib, bool huge_pages) {
+    if (fib->dir24) return true;
+    struct FibDir24 *d = calloc(1, sizeof(*d));
+    if (d == NULL) return false;
+    d->free_chunk = FIB_NIL;
+    d->tbl24 = dir24_map_tbl24(huge_pages, &d->huge_pages);
+    bool ok = d->tbl24 != NULL;
+
+    // Each entry ends up with its longest covering prefix whatever the order
+    for (uint32_t i = 0; i < fib->count && ok; i++) {
+        const struct FibNode *n = &fib->nodes[i];
+        if (n->router == 0) continue;
+        ok = (uint32_t)n->router <= DIR24_MAX_ROUTER &&
+             dir24_update(d, n->prefix, n->len, dir24_entry(n->router, n->len), 0);
+    }
+    if (!ok) {
+        dir24_free(d);
+        return false;
+    }
+    fib->dir24 = d;
+    return true;
+}
+
+/**
+ * @brief Makes 'dst' an independent copy of 'src' (nodes and direct index).
+ * @return True on success, False if out of memory.
+ */
+bool fib_copy(struct Fib *dst, const struct Fib *src) {
+    *dst = *src;
+    dst->nodes = malloc((size_t)src->capacity * sizeof(struct FibNode));
+    dst->direct = src->direct ? malloc(sizeof(struct FibDirectEntry) << FIB_DIRECT_BITS) : NULL;
+    dst->dir24 = NULL;
+    if (dst->nodes == NULL || (src->direct && dst->direct == NULL)) {
+        fib_free(dst);
+        return false;
+    }
+    memcpy(dst->nodes, src->nodes, (size_t)src->count * sizeof(struct FibNode));
+    if (src->direct) memcpy(dst->direct, src->direct, sizeof(struct FibDirectEntry) << FIB_DIRECT_BITS);
+
+    if (src->dir24) {
+        const struct FibDir24 *from = src->dir24;
+        struct FibDir24 *d = calloc(1, sizeof(*d));
+        if (d != NULL) {
+            *d = *from;
+            d->tbl24 = dir24_map_tbl24(from->huge_pages != 0, &d->huge_pages);
+            d->tbl8 = malloc(((size_t)(from->chunk_capacity ? from->chunk_capacity : 1) << 8) * sizeof(uint32_t));
+        }
+        dst->dir24 = d;
+        if (d == NULL || d->tbl24 == NULL || d->tbl8 == NULL) {
+            fib_free(dst);
+            return false;
+        }
+        memcpy(d->tbl24, from->tbl24, DIR24_TBL24_BYTES);
+        memcpy(d->tbl8, from->tbl8, ((size_t)from->num_chunks << 8) * sizeof(uint32_t));
+    }
+    return true;
+}
+
+/**
+ * @brief Inserts a batch of networks, given as parallel arrays. They are
+ * inserted in address order (stable LSD radix sort, two 16-bit passes) so
+ * consecutive inserts walk the same trie nodes while they are still cached;
+ * for equal prefixes the later entry still wins, as with one-by-one inserts.
+ * The sort moves whole records, so the inserts read memory sequentially.
+ * @return True on success, False if out of memory.
+ */
+bool fib_insert_batch(struct Fib *fib, const uint32_t *prefixes, const uint8_t *prefix_lens, const uint32_t *routers,
+                      size_t count) {
+    struct SortRecord {
+        uint32_t prefix;
+        uint32_t router;
+        uint8_t prefix_len;
+    };
+    struct SortRecord *sorted = malloc((count ? count : 1) * sizeof(struct SortRecord));
+    struct SortRecord *scratch = malloc((count ? count : 1) * sizeof(struct SortRecord));
+    size_t *bucket = malloc(((size_t)1 << 16) * sizeof(size_t));
+    bool ok = sorted != NULL && scratch != NULL && bucket != NULL;
+
+    if (ok) {
+        for (size_t i = 0; i < count; i++) sorted[i] = (struct SortRecord){ prefixes[i], routers[i], prefix_lens[i] };
+        struct SortRecord *in = sorted, *out = scratch;
+        for (int shift = 0; shift < 32; shift += 16) {
+            memset(bucket, 0, ((size_t)1 << 16) * sizeof(size_t));
+            for (size_t i = 0; i < count; i++) bucket[(in[i].prefix >> shift) & 0xFFFF]++;
+            size_t sum = 0;
+            for (size_t d = 0; d < ((size_t)1 << 16); d++) {
+                size_t n = bucket[d];
+                bucket[d] = sum;
+                sum += n;
+            }
+            for (size_t i = 0; i < count; i++) out[bucket[(in[i].prefix >> shift) & 0xFFFF]++] = in[i];
+            in = out;
+            out = in == sorted ? scratch : sorted;
+        }
+        for (size_t i = 0; i < count && ok; i++) {
+            ok = fib_insert(fib, in[i].prefix, in[i].prefix_len, (int)in[i].router);
+        }
+    }
+    free(sorted);
+    free(scratch);
+    free(bucket);
+    return ok;
+}
+
+/**
+ * @brief Fills the small-table arrays when the table holds at most
+ * FIB_SMALL_MAX prefixes, sorted longest first (insertion sort, stable).
+ */
+static void fib_build_small(struct Fib *fib) {
+    uint32_t n = 0;
+
+    fib->small_count = 0;
+    if (fib->num_prefixes == 0 || fib->num_prefixes > FIB_SMALL_MAX) return;
+    for (uint32_t i = 0; i < fib->count; i++) {
+        const struct FibNode *node = &fib->nodes[i];
+        if (node->router == 0) continue;
+        uint32_t j = n++;
+        for (; j > 0 && fib->small_mask[j - 1] < prefix_mask(node->len); j--) {
+            fib->small_prefix[j] = fib->small_prefix[j - 1];
+            fib->small_mask[j] = fib->small_mask[j - 1];
+            fib->small_router[j] = fib->small_router[j - 1];
+        }
+        fib->small_prefix[j] = node->prefix;
+        fib->small_mask[j] = prefix_mask(node->len);
+        fib->small_router[j] = node->router;
+    }
+    // addr & 0 is never 1, so the padding read by the last vectors never matches
+    for (uint32_t i = n; i < FIB_SMALL_MAX; i++) {
+        fib->small_prefix[i] = 1;
+        fib->small_mask[i] = 0;
+        fib->small_router[i] = 0;
+    }
+    fib->small_count = n;
+}
+
+/**
+ * @brief Builds the direct-pointing array that skips the first 16 trie levels,
+ * and the vector-scanned copy of small tables.
+ * Call after a batch of inserts; lookups fall back to a full walk while stale.
+ * @return True on success, False if out of memory.
+ */
+bool fib_build_index(struct Fib *fib) {
+    if (fib->direct == NULL) {
+        fib->direct = malloc(sizeof(struct FibDirectEntry) << FIB_DIRECT_BITS);
+        if (fib->direct == NULL) return false;
+    }
+
+    for (uint32_t slice = 0; slice < (1u << FIB_DIRECT_BITS); slice++) {
+        uint32_t addr = slice << (32 - FIB_DIRECT_BITS);
+        uint32_t idx = 0;
+        int best = 0;
+
+        // Walk only the nodes whose child choice is decided by the top 16 bits
+        while (idx != FIB_NIL && fib->nodes[idx].len < FIB_DIRECT_BITS) {
+            const struct FibNode *n = &fib->nodes[idx];
+            if ((addr & prefix_mask(n->len)) != n->prefix) {
+                idx = FIB_NIL;
+                break;
+            }
+            if (n->router) best = n->router;
+            idx = n->child[addr_bit(addr, n->len)];
+        }
+        fib->direct[slice].node = idx;
+        fib->direct[slice].router = best;
+    }
+    fib_build_small(fib);
+    fib->direct_valid = true;
+    return true;
+}
+
+/**
+ * @brief Longest-prefix match over the small-table arrays, 16 prefixes per
+ * step: (addr & mask) == prefix for all of them with two AVX2 or four SSE2
+ * compares, then the lowest set bit of the movemask is the longest match.
+ * Requires a table built by fib_build_index with small_count > 0.
+ */
+static inline int fib_small_lookup(const struct Fib *fib, uint32_t addr) {
+    for (uint32_t i = 0; i < fib->small_count; i += 16) {
+#if defined(__AVX2__)
+        __m256i a = _mm256_set1_epi32((int)addr);
+        __m256i m0 = _mm256_cmpeq_epi32(
+            _mm256_and_si256(a, _mm256_loadu_si256((const __m256i *)&fib->small_mask[i])),
+            _mm256_loadu_si256((const __m256i *)&fib->small_prefix[i]));
+        __m256i m1 = _mm256_cmpeq_epi32(
+            _mm256_and_si256(a, _mm256_loadu_si256((const __m256i *)&fib->small_mask[i + 8])),
+            _mm256_loadu_si256((const __m256i *)&fib->small_prefix[i + 8]));
+        uint32_t bits = (uint32_t)_mm256_movemask_ps(_mm256_castsi256_ps(m0)) |
+                        (uint32_t)_mm256_movemask_ps(_mm256_castsi256_ps(m1)) << 8;
+#elif defined(__SSE2__)
+        __m128i a = _mm_set1_epi32((int)addr);
+        const __m128i *mask = (const __m128i *)&fib->small_mask[i];
+        const __m128i *prefix = (const __m128i *)&fib->small_prefix[i];
+        // Two 8-lane halves packed to bytes, so one movemask covers all 16
+        __m128i lo = _mm_packs_epi32(_mm_cmpeq_epi32(_mm_and_si128(a, _mm_loadu_si128(mask)), _mm_loadu_si128(prefix)),
+                                     _mm_cmpeq_epi32(_mm_and_si128(a, _mm_loadu_si128(mask + 1)),
+                                                     _mm_loadu_si128(prefix + 1)));
+        __m128i hi = _mm_packs_epi32(_mm_cmpeq_epi32(_mm_and_si128(a, _mm_loadu_si128(mask + 2)),
+                                                     _mm_loadu_si128(prefix + 2)),
+                                     _mm_cmpeq_epi32(_mm_and_si128(a, _mm_loadu_si128(mask + 3)),
+                                                     _mm_loadu_si128(prefix + 3)));
+        uint32_t bits = (uint32_t)_mm_movemask_epi8(_mm_packs_epi16(lo, hi));
+#else
+        uint32_t bits = 0;
+        for (int k = 0; k < 16; k++) {
+            bits |= (uint32_t)((addr & fib->small_mask[i + k]) == fib->small_prefix[i + k]) << k;
+        }
+#endif
+        if (bits) return fib->small_router[i + __builtin_ctz(bits)];
+    }
+    return 0;
+}
+
+/**
+ * @brief Longest-prefix match by walking the trie from the direct index.
+ */
+static inline int fib_trie_lookup(const struct Fib *fib, uint32_t addr) {
+    int best = 0;
+    uint32_t idx = 0;
+
+    if (fib->direct_valid) {
+        const struct FibDirectEntry *e = &fib->direct[addr >> (32 - FIB_DIRECT_BITS)];
+        best = e->router;
+        idx = e->node;
+    }
+
+    while (idx != FIB_NIL) {
+        const struct FibNode *n = &fib->nodes[idx];
+        if ((addr & prefix_mask(n->len)) != n->prefix) break;
+        if (n->router) best = n->router;
+        if (n->len == 32) break;
+        idx = n->child[addr_bit(addr, n->len)];
+    }
+    return best;
+}
+
+/**
+ * @brief Longest-prefix match in the DIR-24-8 table: one access for
+ * addresses whose best prefix is /24 or shorter, two otherwise.
+ */
+static inline int fib_dir24_lookup(const struct FibDir24 *d, uint32_t addr) {
+    uint32_t e = d->tbl24[addr >> 8];
+    if (e & DIR24_CHUNK) e = d->tbl8[(size_t)(e & ~DIR24_CHUNK) << 8 | (addr & 0xFF)];
+    return (int)(e & DIR24_MAX_ROUTER);
+}
+
+/**
+ * @brief Longest-prefix-match lookup: the DIR-24-8 table when enabled, else
+ * a vector scan for small tables (see FIB_SMALL_MAX) or the trie.
+ * @param addr The destination address.
+ * @return The router owning the most specific matching prefix, or 0 if none.
+ */
+int fib_lookup(const struct Fib *fib, uint32_t addr) {
+    if (fib->dir24) return fib_dir24_lookup(fib->dir24, addr);
+    if (fib->direct_valid && fib->small_count) return fib_small_lookup(fib, addr);
+    return fib_trie_lookup(fib, addr);
+}
+
+// Most lookups interleaved by fib_lookup_batch
+#define FIB_BATCH_MAX 64
+
+/**
+ * @brief Longest-prefix match for many addresses at once. The trie walks of
+ * up to FIB_BATCH_MAX addresses advance in lockstep rounds (group
+ * prefetching): each round prefetches the next node of every unfinished walk
+ * before reading any of them, so their cache misses overlap instead of
+ * waiting for each other.
+ * @param routers Receives fib_lookup(fib, addrs[i]) for every address.
+ */
+void fib_lookup_batch(const struct Fib *fib, const uint32_t *addrs, int *routers, size_t count) {
+    if (fib->dir24) {
+        for (size_t base = 0; base < count; base += FIB_BATCH_MAX) {
+            size_t n = count - base < FIB_BATCH_MAX ? count - base : FIB_BATCH_MAX;
+            for (size_t i = 0; i < n; i++) __builtin_prefetch(&fib->dir24->tbl24[addrs[base + i] >> 8]);
+            for (size_t i = 0; i < n; i++) routers[base + i] = fib_dir24_lookup(fib->dir24, addrs[base + i]);
+        }
+        return;
+    }
+    if (!fib->direct_valid || fib->small_count) {
+        for (size_t i = 0; i < count; i++) routers[i] = fib_lookup(fib, addrs[i]);
+        return;
+    }
+
+    for (size_t base = 0; base < count; base += FIB_BATCH_MAX) {
+        size_t n = count - base < FIB_BATCH_MAX ? count - base : FIB_BATCH_MAX;
+        const uint32_t *addr = addrs + base;
+        int *best = routers + base;
+        uint32_t idx[FIB_BATCH_MAX];
+        uint8_t live[FIB_BATCH_MAX]; // Walks still in progress
+        size_t num_live = 0;
+
+        for (size_t i = 0; i < n; i++) __builtin_prefetch(&fib->direct[addr[i] >> (32 - FIB_DIRECT_BITS)]);
+        for (size_t i = 0; i < n; i++) {
+            const struct FibDirectEntry *e = &fib->direct[addr[i] >> (32 - FIB_DIRECT_BITS)];
+            best[i] = e->router;
+            idx[i] = e->node;
+            if (idx[i] != FIB_NIL) {
+                __builtin_prefetch(&fib->nodes[idx[i]]);
+                live[num_live++] = (uint8_t)i;
+            }
+        }
+
+        // One trie level per round for every live walk, as in fib_trie_lookup
+        while (num_live) {
+            size_t still = 0;
+            for (size_t k = 0; k < num_live; k++) {
+                size_t i = live[k];
+                const struct FibNode *node = &fib->nodes[idx[i]];
+                if ((addr[i] & prefix_mask(node->len)) != node->prefix) continue;
+                if (node->router) best[i] = node->router;
+                if (node->len == 32) continue;
+                idx[i] = node->child[addr_bit(addr[i], node->len)];
+                if (idx[i] == FIB_NIL) continue;
+                __builtin_prefetch(&fib->nodes[idx[i]]);
+                live[still++] = (uint8_t)i;
+            }
+            num_live = still;
+        }
+    }
+}
+
+/**
+ * @brief Finds the router whose networks contain a given IP address.
+ * @param addr The IP address.
+ * @return The router number (1-based), or 0 if not found.
+ */
+int find_router_by_ip(uint32_t addr) {
+    return fib_lookup(&router_fib, addr);
+}
+
+/**
+ * @brief Batch form of find_router_by_ip (see fib_lookup_batch).
+ * @param routers Receives the router number (1-based, 0 if not found) of each address.
+ */
+void find_routers_by_ip(const uint32_t *addrs, int *routers, size_t count) {
+    fib_lookup_batch(&router_fib, addrs, routers, count);
+}
+
+// =======================================================
+// PATHS
+// =======================================================
+
+void path_builder_init(struct PathBuilder *pb) {
+    pb->hops = pb->inline_hops;
+    pb->length = 0;
+    pb->capacity = PATH_INLINE_HOPS;
+}
+
+void path_builder_free(struct PathBuilder *pb) {
+    if (pb->hops != pb->inline_hops) free(pb->hops);
+    path_builder_init(pb);
+}
+
+/**
+ * @brief Appends a router to the path (amortized O(1)).
+ * @return True on success, False if out of memory.
+ */
+bool path_builder_push(struct PathBuilder *pb, uint32_t router) {
+    if (pb->length == pb->capacity) {
+        uint32_t new_cap = pb->capacity * 2;
+        uint32_t *grown;
+        if (pb->hops == pb->inline_hops) {
+            grown = malloc(new_cap * sizeof(uint32_t));
+            if (grown != NULL) memcpy(grown, pb->inline_hops, sizeof(pb->inline_hops));
+        } else {
+            grown = realloc(pb->hops, new_cap * sizeof(uint32_t));
+        }
+        if (grown == NULL) return false;
+        pb->hops = grown;
+        pb->capacity = new_cap;
+    }
+    pb->hops[pb->length++] = router;
+    return true;
+}
+
+static uint32_t path_hash(const uint32_t *hops, uint32_t length) {
+    uint64_t h = 0x9E3779B97F4A7C15ull ^ length;
+    for (uint32_t i = 0; i < length; i++) {
+        h = (h ^ hops[i]) * 0xFF51AFD7ED558CCDull;
+        h ^= h >> 29;
+    }
+    return (uint32_t)(h >> 32);
+}
+
+bool path_pool_init(struct PathPool *pool) {
+    pool->hops_used = 0;
+    pool->hops_capacity = 1024;
+    pool->count = 1; // ID 0 is reserved for "no path"
+    pool->capacity = 64;
+    pool->index_mask = 127;
+    pool->hops = malloc(pool->hops_capacity * sizeof(uint32_t));
+    pool->paths = malloc(pool->capacity * sizeof(struct PathRecord));
+    pool->index = calloc(pool->index_mask + 1, sizeof(uint32_t));
+    if (pool->hops == NULL || pool->paths == NULL || pool->index == NULL) return false;
+    pool->paths[0].offset = 0;
+    pool->paths[0].length = 0;
+    pool->paths[0].hash = 0;
+    return true;
+}
+
+void path_pool_free(struct PathPool *pool) {
+    free(pool->hops);
+    free(pool->paths);
+    free(pool->index);
+    pool->hops = NULL;
+    pool->paths = NULL;
+    pool->index = NULL;
+    pool->count = pool->capacity = 0;
+}
+
+// Doubles the dedup index and re-inserts every path ID
+static bool path_pool_grow_index(struct PathPool *pool) {
+    uint32_t new_mask = pool->index_mask * 2 + 1;
+    uint32_t *index = calloc((size_t)new_mask + 1, sizeof(uint32_t));
+    if (index == NULL) return false;
+    for (uint32_t id = 1; id < pool->count; id++) {
+        uint32_t i = pool->paths[id].hash & new_mask;
+        while (index[i] != 0) i = (i + 1) & new_mask;
+        index[i] = id;
+    }
+    free(pool->index);
+    pool->index = index;
+    pool->index_mask = new_mask;
+    return true;
+}
+
+/**
+ * @brief Returns the ID of a path, storing it only if no identical path exists.
+ * @return The path ID (never 0), or 0 if out of memory or 'length' is 0.
+ */
+uint32_t path_pool_intern(struct PathPool *pool, const uint32_t *hops, uint32_t length) {
+    if (length == 0) return 0;
+    uint32_t hash = path_hash(hops, length);
+    uint32_t i = hash & pool->index_mask;
+
+    for (; pool->index[i] != 0; i = (i + 1) & pool->index_mask) {
+        const struct PathRecord *r = &pool->paths[pool->index[i]];
+        if (r->hash == hash && r->length == length &&
+            memcmp(&pool->hops[r->offset], hops, length * sizeof(uint32_t)) == 0) {
+            return pool->index[i];
+        }
+    }
+
+    // New path: append the hops to the arena and record it
+    if (pool->hops_used + length > pool->hops_capacity) {
+        uint64_t new_cap = pool->hops_capacity * 2;
+        while (new_cap < pool->hops_used + length) new_cap *= 2;
+        uint32_t *grown = realloc(pool->hops, new_cap * sizeof(uint32_t));
+        if (grown == NULL) return 0;
+        pool->hops = grown;
+        pool->hops_capacity = new_cap;
+    }
+    if (pool->count == pool->capacity) {
+        struct PathRecord *grown = realloc(pool->paths, (size_t)pool->capacity * 2 * sizeof(struct PathRecord));
+        if (grown == NULL) return 0;
+        pool->paths = grown;
+        pool->capacity *= 2;
+    }
+
+    uint32_t id = pool->count++;
+    pool->paths[id].offset = pool->hops_used;
+    pool->paths[id].length = length;
+    pool->paths[id].hash = hash;
+    memcpy(&pool->hops[pool->hops_used], hops, length * sizeof(uint32_t));
+    pool->hops_used += length;
+    pool->index[i] = id;
+
+    // Keep the dedup index under 50% load
+    if ((uint64_t)pool->count * 2 > (uint64_t)pool->index_mask + 1) path_pool_grow_index(pool);
+    return id;
+}
+
+/**
+ * @brief Returns the router IDs of an interned path.
+ * @param length Receives the number of hops (0 for path ID 0).
+ */
+const uint32_t *path_pool_hops(const struct PathPool *pool, uint32_t id, uint32_t *length) {
+    *length = pool->paths[id].length;
+    return &pool->hops[pool->paths[id].offset];
+}
+
+/**
+ * @brief Prints a path as "R1 --> R2 --> R4".
+ */
+void print_path(const uint32_t *hops, uint32_t length) {
+    for (uint32_t i = 0; i < length; i++) {
+        printf(i ? " --> R%u" : "R%u", hops[i]);
+    }
+    printf("\n");
+}
+
+// =======================================================
+// ROUTE CACHE
+// =======================================================
+
+static inline uint64_t route_key_pack(uint32_t src, uint32_t dst) {
+    return ((uint64_t)src << 32) | dst;
+}
+
+// Multiply-shift hash: the high bits of the product are well mixed
+static inline uint64_t route_key_hash(uint64_t key) {
+    return (key * 0x9E3779B97F4A7C15ull) >> 32;
+}
+
+/**
+ * @brief Returns the route cache key of a query. A route depends only on the
+ * two routers, so every host pair behind the same routers shares one entry
+ * (and one path). With --ecmp each flow may take its own equal-cost path,
+ * so the address pair stays the key (route_cache_per_flow).
+ */
+static inline struct RouteKey route_key_for(uint32_t src_ip, uint32_t dst_ip, uint32_t src_router,
+                                            uint32_t dst_router) {
+    if (route_cache_per_flow) return (struct RouteKey){ src_ip, dst_ip };
+    return (struct RouteKey){ src_router, dst_router };
+}
+
+// Allocates 'slots' empty slots (a power of two) and resets the counters
+static bool route_cache_alloc(struct RouteCache *cache, size_t slots, size_t max_entries) {
+    cache->keys = malloc(slots * sizeof(uint64_t));
+    cache->values = malloc(slots * sizeof(struct RouteCacheValue));
+    if (cache->keys == NULL || cache->values == NULL) {
+        free(cache->keys);
+        free(cache->values);
+        cache->keys = NULL;
+        cache->values = NULL;
+        return false;
+    }
+    for (size_t i = 0; i < slots; i++) cache->keys[i] = ROUTE_CACHE_EMPTY;
+    cache->mask = slots - 1;
+    cache->count = 0;
+    cache->max_entries = max_entries;
+    cache->hand = 0;
+    cache->hits = cache->misses = cache->evictions = 0;
+    return true;
+}
+
+/**
+ * @brief Initializes an empty route cache.
+ * @param max_entries Capacity; once full, inserts evict the least recently
+ *        referenced entry (CLOCK). 0 means unbounded (the table grows).
+ * @return True on success, False if out of memory.
+ */
+bool route_cache_init(struct RouteCache *cache, size_t max_entries) {
+    size_t slots = 16;
+    // Bounded caches are sized up front so the load factor stays below 70%
+    while (slots * 7 < max_entries * 10) slots <<= 1;
+    return route_cache_alloc(cache, slots, max_entries);
+}
+
+void route_cache_free(struct RouteCache *cache) {
+    free(cache->keys);
+    free(cache->values);
+    cache->keys = NULL;
+    cache->values = NULL;
+    cache->mask = 0;
+    cache->count = 0;
+}
+
+// Probes for a key: returns its slot, or the empty slot ending the probe sequence
+static inline uint64_t route_cache_probe(const struct RouteCache *cache, uint64_t key) {
+    uint64_t i = route_key_hash(key) & cache->mask;
+    while (cache->keys[i] != key && cache->keys[i] != ROUTE_CACHE_EMPTY) {
+        i = (i + 1) & cache->mask;
+    }
+    return i;
+}
+
+/**
+ * @brief Looks up the learned path for a (source, destination) pair.
+ * A hit sets the entry's CLOCK reference bit (O(1) touch).
+ * @param cost Receives the stored path cost on a hit (ROUTE_COST_MAX if the
+ * cost did not fit and must be recomputed from the path); may be NULL.
+ * @return The stored path ID, or 0 on a miss.
+ */
+uint32_t route_cache_find(struct RouteCache *cache, uint32_t src, uint32_t dst, uint32_t *cost) {
+    uint64_t i = route_cache_probe(cache, route_key_pack(src, dst));
+
+    if (cache->keys[i] == ROUTE_CACHE_EMPTY) {
+        cache->misses++;
+        return 0;
+    }
+    struct RouteCacheValue *v = &cache->values[i];
+    cache->hits++;
+    v->referenced = 1;
+    if (cost) *cost = v->cost;
+    return v->path;
+}
+
+// Empties slot 'i' and shifts later entries of the probe run back into the gap
+static void route_cache_delete_slot(struct RouteCache *cache, uint64_t i) {
+    uint64_t j = i;
+
+    for (;;) {
+        j = (j + 1) & cache->mask;
+        if (cache->keys[j] == ROUTE_CACHE_EMPTY) break;
+
+        // An entry may move back only if its home slot is not in (i, j]
+        uint64_t home = route_key_hash(cache->keys[j]) & cache->mask;
+        bool stays = (i <= j) ? (home > i && home <= j) : (home > i || home <= j);
+        if (!stays) {
+            cache->keys[i] = cache->keys[j];
+            cache->values[i] = cache->values[j];
+            i = j;
+        }
+    }
+    cache->keys[i] = ROUTE_CACHE_EMPTY;
+    cache->count--;
+}
+
+/**
+ * @brief Removes the route for a (source, destination) pair if present.
+ * @return True if an entry was removed.
+ */
+bool route_cache_remove(struct RouteCache *cache, uint32_t src, uint32_t dst) {
+    uint64_t i = route_cache_probe(cache, route_key_pack(src, dst));
+    if (cache->keys[i] == ROUTE_CACHE_EMPTY) return false;
+    route_cache_delete_slot(cache, i);
+    return true;
+}
+
+// CLOCK: sweep the hand, clearing reference bits, and evict the first unreferenced entry
+static void route_cache_evict_one(struct RouteCache *cache) {
+    for (;;) {
+        uint64_t i = cache->hand;
+        if (cache->keys[i] != ROUTE_CACHE_EMPTY) {
+            if (!cache->values[i].referenced) {
+                route_cache_delete_slot(cache, i);
+                cache->evictions++;
+                return;
+            }
+            cache->values[i].referenced = 0;
+        }
+        cache->hand = (cache->hand + 1) & cache->mask;
+    }
+}
+
+// Doubles the table and re-inserts every entry
+static bool route_cache_grow(struct RouteCache *cache) {
+    struct RouteCache bigger;
+    if (!route_cache_alloc(&bigger, (cache->mask + 1) * 2, cache->max_entries)) return false;
+
+    for (uint64_t i = 0; i <= cache->mask; i++) {
+        if (cache->keys[i] == ROUTE_CACHE_EMPTY) continue;
+        uint64_t j = route_cache_probe(&bigger, cache->keys[i]);
+        bigger.keys[j] = cache->keys[i];
+        bigger.values[j] = cache->values[i];
+    }
+    bigger.count = cache->count;
+    bigger.hits = cache->hits;
+    bigger.misses = cache->misses;
+    bigger.evictions = cache->evictions;
+    route_cache_free(cache);
+    *cache = bigger;
+    return true;
+}
+
+/**
+ * @brief Stores (or replaces) the path for a (source, destination) pair.
+ * A full bounded cache evicts one entry first, so inserts always succeed.
+ * @param cost Path cost; costs of ROUTE_COST_MAX or more are stored as
+ * ROUTE_COST_MAX and recomputed from the path by the reader.
+ * @return True on success, False if out of memory or the key is reserved.
+ */
+bool route_cache_insert(struct RouteCache *cache, uint32_t src, uint32_t dst, uint32_t path, uint64_t cost) {
+    uint64_t key = route_key_pack(src, dst);
+    if (key == ROUTE_CACHE_EMPTY) return false;
+
+    uint64_t i = route_cache_probe(cache, key);
+    if (cache->keys[i] == ROUTE_CACHE_EMPTY) {
+        if (cache->max_entries != 0 && cache->count >= cache->max_entries) {
+            route_cache_evict_one(cache);
+            i = route_cache_probe(cache, key); // Eviction may shift the probe run
+        } else if ((cache->count + 1) * 10 > (cache->mask + 1) * 7) {
+            // Keep the load factor below 70% so probe sequences stay short
+            if (!route_cache_grow(cache)) return false;
+            i = route_cache_probe(cache, key);
+        }
+        cache->keys[i] = key;
+        cache->count++;
+    }
+    cache->values[i].path = path;
+    cache->values[i].cost = cost < ROUTE_COST_MAX ? (uint32_t)cost : ROUTE_COST_MAX;
+    cache->values[i].referenced = 1;
+    return true;
+}
+
+/**
+ * @brief Prints the hit/miss/eviction counters of a route cache.
+ */
+void route_cache_print_stats(const struct RouteCache *cache, FILE *out) {
+    uint64_t lookups = cache->hits + cache->misses;
+    fprintf(out, "Route cache: %zu entries", cache->count);
+    if (cache->max_entries) fprintf(out, " (capacity %zu)", cache->max_entries);
+    fprintf(out, ", %llu hits, %llu misses (%.1f%% hit rate), %llu evictions\n",
+           (unsigned long long)cache->hits, (unsigned long long)cache->misses,
+           lookups ? 100.0 * cache->hits / lookups : 0.0, (unsigned long long)cache->evictions);
+}
+
+// =======================================================
+// TOPOLOGY AND SHORTEST PATHS
+// =======================================================
+
+/**
+ * @brief Builds a CSR graph from a list of directed links.
+ * Rows come out sorted by neighbor (two stable counting-sort passes, O(n + m)).
+ * Graphs whose bitset adjacency is no larger than the neighbor array also
+ * get link_bits.
+ * @param edges Links between 0-based routers; add both directions for undirected links.
+ * @param weighted Keep the link weights (Dijkstra) or treat every hop as cost 1 (BFS).
+ * @return True on success, False if out of memory.
+ */
+bool graph_build(struct Graph *g, uint32_t num_routers, const struct Edge *edges, uint64_t num_edges, bool weighted) {
+    memset(g, 0, sizeof(*g));
+    g->num_routers = num_routers;
+    g->num_links = num_edges;
+    g->offsets = calloc((size_t)num_routers + 1, sizeof(uint64_t));
+    g->neighbors = malloc((num_edges ? num_edges : 1) * sizeof(uint32_t));
+    g->weights = weighted ? malloc((num_edges ? num_edges : 1) * sizeof(uint32_t)) : NULL;
+    uint64_t *by_target = malloc((num_edges ? num_edges : 1) * sizeof(uint64_t));
+    uint64_t *fill = calloc((size_t)num_routers + 1, sizeof(uint64_t));
+    if (g->offsets == NULL || g->neighbors == NULL || (weighted && g->weights == NULL) ||
+        by_target == NULL || fill == NULL) {
+        free(by_target);
+        free(fill);
+        return false;
+    }
+
+    // Pass 1: order the links by target router
+    for (uint64_t e = 0; e < num_edges; e++) fill[edges[e].to + 1]++;
+    for (uint32_t r = 0; r < num_routers; r++) fill[r + 1] += fill[r];
+    for (uint64_t e = 0; e < num_edges; e++) by_target[fill[edges[e].to]++] = e;
+
+    // Pass 2: stable placement by source router keeps each row sorted by target
+    for (uint64_t e = 0; e < num_edges; e++) g->offsets[edges[e].from + 1]++;
+    for (uint32_t r = 0; r < num_routers; r++) g->offsets[r + 1] += g->offsets[r];
+    memcpy(fill, g->offsets, (size_t)num_routers * sizeof(uint64_t));
+    for (uint64_t i = 0; i < num_edges; i++) {
+        const struct Edge *e = &edges[by_target[i]];
+        uint64_t slot = fill[e->from]++;
+        g->neighbors[slot] = e->to;
+        if (weighted) g->weights[slot] = e->weight;
+    }
+    free(by_target);
+    free(fill);
+
+    // Dense graphs: a bitset costs no more than the neighbor array
+    uint64_t words = ((uint64_t)num_routers + 63) / 64;
+    if (words * num_routers * sizeof(uint64_t) <= num_edges * sizeof(uint32_t)) {
+        g->link_bits = calloc(words * num_routers, sizeof(uint64_t));
+        if (g->link_bits != NULL) {
+            g->bits_words = words;
+            for (uint32_t r = 0; r < num_routers; r++) {
+                for (uint64_t k = g->offsets[r]; k < g->offsets[r + 1]; k++) {
+                    g->link_bits[r * words + g->neighbors[k] / 64] |= 1ull << (g->neighbors[k] % 64);
+                }
+            }
+        }
+    }
+    return true;
+}
+
+/**
+ * @brief Builds an unweighted graph from undirected links between 1-based routers.
+ * Self links are skipped.
+ */
+bool graph_from_links(struct Graph *g, uint32_t num_routers, const uint32_t (*links)[2], size_t num_links) {
+    struct Edge *edges = malloc((num_links ? num_links : 1) * 2 * sizeof(struct Edge));
+    uint64_t count = 0;
+    if (edges == NULL) return false;
+
+    for (size_t l = 0; l < num_links; l++) {
+        uint32_t a = links[l][0] - 1, b = links[l][1] - 1;
+        if (a == b || a >= num_routers || b >= num_routers) continue;
+        edges[count++] = (struct Edge){ a, b, 1 };
+        edges[count++] = (struct Edge){ b, a, 1 };
+    }
+    bool ok = graph_build(g, num_routers, edges, count, false);
+    free(edges);
+    return ok;
+}
+
+void graph_free(struct Graph *g) {
+    free(g->offsets);
+    free(g->neighbors);
+    free(g->weights);
+    free(g->link_bits);
+    memset(g, 0, sizeof(*g));
+}
+
+/**
+ * @brief Checks for a direct link between two routers (1-based). A router is
+ * always considered linked to itself, as on the diagonal of the old matrix.
+ * Uses the bitset when present, otherwise a binary search of the sorted row.
+ */
+bool graph_has_link(const struct Graph *g, uint32_t from, uint32_t to) {
+    if (from == to) return from >= 1 && from <= g->num_routers;
+    if (from < 1 || from > g->num_routers || to < 1 || to > g->num_routers) return false;
+    uint32_t u = from - 1, v = to - 1;
+
+    if (g->link_bits) return (g->link_bits[u * g->bits_words + v / 64] >> (v % 64)) & 1;
+
+    uint64_t lo = g->offsets[u], hi = g->offsets[u + 1];
+    while (lo < hi) {
+        uint64_t mid = lo + (hi - lo) / 2;
+        if (g->neighbors[mid] < v) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo < g->offsets[u + 1] && g->neighbors[lo] == v;
+}
+
+/**
+ * @brief Returns the cost of the cheapest direct link between two routers
+ * (1-based), or UINT64_MAX if they are not linked.
+ */
+uint64_t graph_link_cost(const struct Graph *g, uint32_t from, uint32_t to) {
+    if (from < 1 || from > g->num_routers || to < 1 || to > g->num_routers) return UINT64_MAX;
+    uint32_t u = from - 1, v = to - 1;
+    uint64_t lo = g->offsets[u], hi = g->offsets[u + 1], best = UINT64_MAX;
+    while (lo < hi) {
+        uint64_t mid = lo + (hi - lo) / 2;
+        if (g->neighbors[mid] < v) lo = mid + 1;
+        else hi = mid;
+    }
+    // Parallel links are adjacent in the sorted row
+    for (; lo < g->offsets[u + 1] && g->neighbors[lo] == v; lo++) {
+        uint64_t cost = g->weights ? g->weights[lo] : 1;
+        if (cost < best) best = cost;
+    }
+    return best;
+}
+
+/**
+ * @brief Returns the cost of a path of 1-based router IDs (the cheapest link
+ * between each pair of consecutive hops), or UINT64_MAX if two consecutive
+ * hops are not linked.
+ */
+uint64_t graph_path_cost(const struct Graph *g, const uint32_t *hops, uint32_t length) {
+    uint64_t cost = 0;
+    for (uint32_t i = 1; i < length; i++) {
+        uint64_t link = graph_link_cost(g, hops[i - 1], hops[i]);
+        if (link == UINT64_MAX) return UINT64_MAX;
+        cost += link;
+    }
+    return cost;
+}
+
+/**
+ * @brief Builds a copy of 'g' where routers a and b (1-based) are joined by a
+ * single undirected link of the given cost ('up') or not joined at all.
+ * The copy is weighted if 'g' is or if the new cost is not 1.
+ * @return True on success, False if out of memory.
+ */
+bool graph_with_link(const struct Graph *g, uint32_t a, uint32_t b, uint32_t cost, bool up, struct Graph *out) {
+    uint32_t u = a - 1, v = b - 1;
+    struct Edge *edges = malloc((g->num_links + 2) * sizeof(struct Edge));
+    uint64_t count = 0;
+    if (edges == NULL) return false;
+
+    for (uint32_t r = 0; r < g->num_routers; r++) {
+        for (uint64_t e = g->offsets[r]; e < g->offsets[r + 1]; e++) {
+            uint32_t n = g->neighbors[e];
+            if ((r == u && n == v) || (r == v && n == u)) continue;
+            edges[count++] = (struct Edge){ r, n, g->weights ? g->weights[e] : 1 };
+        }
+    }
+    if (up && u != v) {
+        edges[count++] = (struct Edge){ u, v, cost };
+        edges[count++] = (struct Edge){ v, u, cost };
+    }
+    bool ok = graph_build(out, g->num_routers, edges, count, g->weights != NULL || (up && cost != 1));
+    if (!ok) graph_free(out);
+    free(edges);
+    return ok;
+}
+
+bool search_workspace_init(struct SearchWorkspace *ws, uint32_t num_routers) {
+    ws->num_routers = num_routers;
+    ws->dist = malloc((size_t)num_routers * sizeof(uint64_t));
+    ws->parent = malloc((size_t)num_routers * sizeof(uint32_t));
+    ws->stamp = calloc(num_routers, sizeof(uint32_t));
+    ws->queue = malloc((size_t)num_routers * sizeof(uint32_t));
+    ws->generation = 0;
+    ws->heap_capacity = 64;
+    ws->heap_size = 0;
+    ws->heap = malloc(ws->heap_capacity * sizeof(struct HeapItem));
+    return ws->dist && ws->parent && ws->stamp && ws->queue && ws->heap;
+}
+
+void search_workspace_free(struct SearchWorkspace *ws) {
+    free(ws->dist);
+    free(ws->parent);
+    free(ws->stamp);
+    free(ws->queue);
+    free(ws->heap);
+    memset(ws, 0, sizeof(*ws));
+}
+
+// Starts a new query: every node becomes unvisited without touching the arrays
+static void search_begin(struct SearchWorkspace *ws) {
+    if (++ws->generation == 0) {
+        memset(ws->stamp, 0, (size_t)ws->num_routers * sizeof(uint32_t));
+        ws->generation = 1;
+    }
+}
+
+static inline bool search_seen(const struct SearchWorkspace *ws, uint32_t node) {
+    return ws->stamp[node] == ws->generation;
+}
+
+static inline void search_visit(struct SearchWorkspace *ws, uint32_t node, uint64_t dist, uint32_t parent) {
+    ws->stamp[node] = ws->generation;
+    ws->dist[node] = dist;
+    ws->parent[node] = parent;
+}
+
+static bool heap_push(struct SearchWorkspace *ws, uint64_t dist, uint32_t node) {
+    if (ws->heap_size == ws->heap_capacity) {
+        struct HeapItem *grown = realloc(ws->heap, ws->heap_capacity * 2 * sizeof(struct HeapItem));
+        if (grown == NULL) return false;
+        ws->heap = grown;
+        ws->heap_capacity *= 2;
+    }
+    uint64_t i = ws->heap_size++;
+    while (i > 0 && ws->heap[(i - 1) / HEAP_ARITY].dist > dist) {
+        ws->heap[i] = ws->heap[(i - 1) / HEAP_ARITY];
+        i = (i - 1) / HEAP_ARITY;
+    }
+    ws->heap[i].dist = dist;
+    ws->heap[i].node = node;
+    return true;
+}
+
+static struct HeapItem heap_pop(struct SearchWorkspace *ws) {
+    struct HeapItem top = ws->heap[0];
+    struct HeapItem last = ws->heap[--ws->heap_size];
+    uint64_t i = 0;
+
+    for (;;) {
+        uint64_t first = HEAP_ARITY * i + 1, child = first;
+        if (first >= ws->heap_size) break;
+        uint64_t end = first + HEAP_ARITY < ws->heap_size ? first + HEAP_ARITY : ws->heap_size;
+        for (uint64_t c = first + 1; c < end; c++) {
+            if (ws->heap[c].dist < ws->heap[child].dist) child = c;
+        }
+        if (ws->heap[child].dist >= last.dist) break;
+        ws->heap[i] = ws->heap[child];
+        i = child;
+    }
+    if (ws->heap_size > 0) ws->heap[i] = last;
+    return top;
+}
+
+// Unit-cost search: BFS that stops as soon as the destination is reached
+static bool search_bfs(const struct Graph *g, struct SearchWorkspace *ws, uint32_t src, uint32_t dst) {
+    uint32_t head = 0, tail = 0;
+    search_visit(ws, src, 0, src);
+    ws->queue[tail++] = src;
+
+    while (head < tail) {
+        uint32_t u = ws->queue[head++];
+        if (u == dst) return true;
+        for (uint64_t e = g->offsets[u]; e < g->offsets[u + 1]; e++) {
+            uint32_t v = g->neighbors[e];
+            if (search_seen(ws, v)) continue;
+            search_visit(ws, v, ws->dist[u] + 1, u);
+            ws->queue[tail++] = v;
+        }
+    }
+    return false;
+}
+
+// Weighted search: Dijkstra with a lazy-deletion 4-ary heap
+static bool search_dijkstra(const struct Graph *g, struct SearchWorkspace *ws, uint32_t src, uint32_t dst) {
+    ws->heap_size = 0;
+    search_visit(ws, src, 0, src);
+    if (!heap_push(ws, 0, src)) return false;
+
+    while (ws->heap_size > 0) {
+        struct HeapItem item = heap_pop(ws);
+        uint32_t u = item.node;
+        if (item.dist > ws->dist[u]) continue; // Stale entry
+        if (u == dst) return true;
+        for (uint64_t e = g->offsets[u]; e < g->offsets[u + 1]; e++) {
+            uint32_t v = g->neighbors[e];
+            uint64_t nd = item.dist + g->weights[e];
+            if (search_seen(ws, v) && ws->dist[v] <= nd) continue;
+            search_visit(ws, v, nd, u);
+            if (!heap_push(ws, nd, v)) return false;
+        }
+    }
+    return false;
+}
+
+/**
+ * @brief Computes the distance from 'src' (1-based) to every router into
+ * dist[0 .. num_routers), UINT64_MAX for unreachable routers.
+ * @return True on success, False if out of memory.
+ */
+bool graph_distances(const struct Graph *g, struct SearchWorkspace *ws, uint32_t src, uint64_t *dist) {
+    search_begin(ws);
+    // No router has this index, so the search runs to completion
+    bool ok = g->weights ? search_dijkstra(g, ws, src - 1, UINT32_MAX) || ws->heap_size == 0
+                         : (search_bfs(g, ws, src - 1, UINT32_MAX), true);
+    for (uint32_t v = 0; v < g->num_routers; v++) dist[v] = search_seen(ws, v) ? ws->dist[v] : UINT64_MAX;
+    return ok;
+}
+
+/**
+ * @brief Computes a shortest path between two routers (BFS for unit-cost
+ * graphs, Dijkstra for weighted ones).
+ * @param src Source router (1-based).
+ * @param dst Destination router (1-based).
+ * @param out Receives the path from src to dst as 1-based router IDs (appended).
+ * @param cost Receives the path cost (hops for unit-cost graphs); may be NULL.
+ * @return True if a path exists, False if dst is unreachable or out of memory.
+ */
+bool graph_shortest_path(const struct Graph *g, struct SearchWorkspace *ws, uint32_t src, uint32_t dst,
+                         struct PathBuilder *out, uint64_t *cost) {
+    uint32_t s = src - 1, d = dst - 1;
+    search_begin(ws);
+    bool found = g->weights ? search_dijkstra(g, ws, s, d) : search_bfs(g, ws, s, d);
+    if (!found) return false;
+
+    // Walk the parent chain back from the destination, then reverse in place
+    uint32_t start = out->length;
+    for (uint32_t v = d;; v = ws->parent[v]) {
+        if (!path_builder_push(out, v + 1)) return false;
+        if (v == s) break;
+    }
+    for (uint32_t i = start, j = out->length - 1; i < j; i++, j--) {
+        uint32_t t = out->hops[i];
+        out->hops[i] = out->hops[j];
+        out->hops[j] = t;
+    }
+    if (cost) *cost = ws->dist[d];
+    return true;
+}
+
+// =======================================================
+// ALL-PAIRS NEXT-HOP TABLE
+// =======================================================
+
+static inline uint32_t next_hop_get(const struct NextHopTable *t, uint32_t src, uint32_t dst) {
+    uint64_t i = (uint64_t)src * t->row_stride + dst;
+    if (t->entry_bytes == 1) return t->entries[i] == 0xFF ? NEXT_HOP_NONE : t->entries[i];
+    return ((const uint16_t *)t->entries)[i];
+}
+
+static inline void next_hop_set(struct NextHopTable *t, uint32_t src, uint32_t dst, uint32_t link) {
+    uint64_t i = (uint64_t)src * t->row_stride + dst;
+    if (t->entry_bytes == 1) t->entries[i] = (uint8_t)link;
+    else ((uint16_t *)t->entries)[i] = (uint16_t)link;
+}
+
+// Shared state of a parallel table build; workers claim units with an atomic counter
+struct ApspJob {
+    const struct Graph *g;
+    struct NextHopTable *table;
+    uint32_t num_units;
+    atomic_uint next_unit;
+    atomic_bool failed;
+};
+
+/*
+ * Unit-cost graphs: bit-parallel multi-source BFS. A unit is a batch of 64
+ * destinations; bit i of a router's mask stands for destination base + i.
+ * Each level pulls along a router's out-links: if a neighbor is on the
+ * frontier for destination i, that link is a shortest first hop towards it.
+ * One pass over the links therefore advances 64 searches at once.
+ */
+static void *apsp_bfs_worker(void *arg) {
+    struct ApspJob *job = arg;
+    const struct Graph *g = job->g;
+    uint32_t n = g->num_routers;
+    uint64_t *seen = malloc((size_t)n * sizeof(uint64_t));
+    uint64_t *frontier = malloc((size_t)n * sizeof(uint64_t));
+    uint64_t *next = malloc((size_t)n * sizeof(uint64_t));
+
+    if (seen == NULL || frontier == NULL || next == NULL) {
+        atomic_store(&job->failed, true);
+    } else {
+        uint32_t unit;
+        while ((unit = atomic_fetch_add(&job->next_unit, 1)) < job->num_units) {
+            uint32_t base = unit * 64;
+            uint32_t width = n - base < 64 ? n - base : 64;
+            uint64_t all = width == 64 ? UINT64_MAX : (1ull << width) - 1;
+
+            memset(seen, 0, (size_t)n * sizeof(uint64_t));
+            memset(frontier, 0, (size_t)n * sizeof(uint64_t));
+            for (uint32_t i = 0; i < width; i++) {
+                seen[base + i] = frontier[base + i] = 1ull << i;
+            }
+
+            for (bool active = true; active;) {
+                active = false;
+                for (uint32_t x = 0; x < n; x++) {
+                    uint64_t unseen = all & ~seen[x];
+                    uint64_t found = 0;
+                    for (uint64_t k = g->offsets[x]; unseen && k < g->offsets[x + 1]; k++) {
+                        uint64_t bits = frontier[g->neighbors[k]] & unseen;
+                        unseen &= ~bits;
+                        found |= bits;
+                        for (; bits; bits &= bits - 1) {
+                            next_hop_set(job->table, x, base + (uint32_t)__builtin_ctzll(bits), (uint32_t)(k - g->offsets[x]));
+                        }
+                    }
+                    seen[x] |= found;
+                    next[x] = found;
+                    active |= found != 0;
+                }
+                uint64_t *swap = frontier;
+                frontier = next;
+                next = swap;
+            }
+        }
+    }
+    free(seen);
+    free(frontier);
+    free(next);
+    return NULL;
+}
+
+/*
+ * Weighted graphs: one full Dijkstra per source (a unit is one source row).
+ * The first hop is inherited from the parent when a router is relaxed, so
+ * the row is filled without walking parent chains.
+ */
+static void *apsp_dijkstra_worker(void *arg) {
+    struct ApspJob *job = arg;
+    const struct Graph *g = job->g;
+    struct SearchWorkspace ws;
+    uint32_t *first = malloc((size_t)g->num_routers * sizeof(uint32_t));
+
+    if (first == NULL || !search_workspace_init(&ws, g->num_routers)) {
+        atomic_store(&job->failed, true);
+        free(first);
+        return NULL;
+    }
+
+    uint32_t s;
+    while ((s = atomic_fetch_add(&job->next_unit, 1)) < job->num_units) {
+        search_begin(&ws);
+        ws.heap_size = 0;
+        search_visit(&ws, s, 0, s);
+        heap_push(&ws, 0, s);
+
+        while (ws.heap_size > 0) {
+            struct HeapItem item = heap_pop(&ws);
+            uint32_t u = item.node;
+            if (item.dist > ws.dist[u]) continue;
+            if (u != s) next_hop_set(job->table, s, u, first[u]);
+            for (uint64_t k = g->offsets[u]; k < g->offsets[u + 1]; k++) {
+                uint32_t v = g->neighbors[k];
+                uint64_t nd = item.dist + g->weights[k];
+                if (search_seen(&ws, v) && ws.dist[v] <= nd) continue;
+                search_visit(&ws, v, nd, u);
+                first[v] = u == s ? (uint32_t)(k - g->offsets[s]) : first[u];
+                if (!heap_push(&ws, nd, v)) atomic_store(&job->failed, true);
+            }
+        }
+    }
+    search_workspace_free(&ws);
+    free(first);
+    return NULL;
+}
+
+// Runs 'worker' on up to num_threads threads (inline when there is one)
+static bool run_workers(void *(*worker)(void *), void *job, int num_threads) {
+    if (num_threads <= 1) {
+        worker(job);
+        return true;
+    }
+    pthread_t *threads = malloc(num_threads * sizeof(pthread_t));
+    if (threads == NULL) return false;
+    int started = 0;
+    for (; started < num_threads; started++) {
+        if (pthread_create(&threads[started], NULL, worker, job) != 0) break;
+    }
+    if (started == 0) worker(job); // Could not start any thread: do the work here
+    for (int i = 0; i < started; i++) pthread_join(threads[i], NULL);
+    free(threads);
+    return true;
+}
+
+int default_thread_count(void) {
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    return cpus > 0 ? (int)cpus : 1;
+}
+
+/**
+ * @brief Allocates a next-hop table for a graph with every pair unreachable.
+ * @return True on success, False if out of memory or a router has too many links.
+ */
+static bool next_hop_table_alloc(struct NextHopTable *t, const struct Graph *g) {
+    uint32_t n = g->num_routers;
+    uint64_t max_degree = 0;
+    for (uint32_t r = 0; r < n; r++) {
+        uint64_t degree = g->offsets[r + 1] - g->offsets[r];
+        if (degree > max_degree) max_degree = degree;
+    }
+    if (max_degree >= NEXT_HOP_NONE) return false;
+
+    t->num_routers = n;
+    t->entry_bytes = max_degree < 0xFF ? 1 : 2;
+    t->row_stride = ((uint64_t)n + 63) & ~63ull;
+    t->entries = malloc(t->row_stride * n * t->entry_bytes);
+    if (t->entries == NULL) return false;
+    memset(t->entries, 0xFF, t->row_stride * n * t->entry_bytes); // Everything unreachable
+    return true;
+}
+
+/**
+ * @brief Precomputes the next hop for every router pair of a graph.
+ * Unit-cost graphs use bit-parallel BFS over batches of 64 destinations,
+ * weighted graphs one Dijkstra per source; both are spread over threads.
+ * @param num_threads Worker threads (<= 0 uses the number of online CPUs).
+ * @return True on success, False if out of memory.
+ */
+bool next_hop_table_build(struct NextHopTable *t, const struct Graph *g, int num_threads) {
+    uint32_t n = g->num_routers;
+    if (!next_hop_table_alloc(t, g)) return false;
+
+    struct ApspJob job;
+    job.g = g;
+    job.table = t;
+    job.num_units = g->weights ? n : (n + 63) / 64;
+    atomic_init(&job.next_unit, 0);
+    atomic_init(&job.failed, false);
+
+    if (num_threads <= 0) num_threads = default_thread_count();
+    if ((uint32_t)num_threads > job.num_units) num_threads = job.num_units ? (int)job.num_units : 1;
+    if (!run_workers(g->weights ? apsp_dijkstra_worker : apsp_bfs_worker, &job, num_threads) ||
+        atomic_load(&job.failed)) {
+        free(t->entries);
+        t->entries = NULL;
+        return false;
+    }
+    return true;
+}
+
+void next_hop_table_free(struct NextHopTable *t) {
+    free(t->entries);
+    t->entries = NULL;
+    t->num_routers = 0;
+}
+
+/**
+ * @brief Follows the precomputed next hops from src to dst.
+ * @param src Source router (1-based).
+ * @param dst Destination router (1-based).
+ * @param out Receives the path as 1-based router IDs (appended).
+ * @return True if dst is reachable, False otherwise.
+ */
+bool next_hop_path(const struct NextHopTable *t, const struct Graph *g, uint32_t src, uint32_t dst,
+                   struct PathBuilder *out) {
+    uint32_t cur = src - 1, d = dst - 1;
+    if (!path_builder_push(out, src)) return false;
+
+    while (cur != d) {
+        uint32_t link = next_hop_get(t, cur, d);
+        if (link == NEXT_HOP_NONE || out->length > t->num_routers) return false;
+        cur = g->neighbors[g->offsets[cur] + link];
+        if (!path_builder_push(out, cur + 1)) return false;
+    }
+    return true;
+}
+
+/**
+ * @brief Makes 'dst' an independent copy of 'src'.
+ * @return True on success, False if out of memory.
+ */
+bool next_hop_table_copy(struct NextHopTable *dst, const struct NextHopTable *src) {
+    size_t bytes = src->row_stride * src->num_routers * src->entry_bytes;
+    *dst = *src;
+    dst->entries = malloc(bytes ? bytes : 1);
+    if (dst->entries == NULL) return false;
+    memcpy(dst->entries, src->entries, bytes);
+    return true;
+}
+
+// Cost of link 'e' (a CSR index)
+static inline uint64_t graph_link_weight(const struct Graph *g, uint64_t e) {
+    return g->weights ? g->weights[e] : 1;
+}
+
+// Index in u's row of the cheapest link from u to v (0-based), or NEXT_HOP_NONE
+static uint32_t graph_link_index(const struct Graph *g, uint32_t u, uint32_t v) {
+    uint64_t lo = g->offsets[u], hi = g->offsets[u + 1], best = UINT64_MAX;
+    uint32_t index = NEXT_HOP_NONE;
+    while (lo < hi) {
+        uint64_t mid = lo + (hi - lo) / 2;
+        if (g->neighbors[mid] < v) lo = mid + 1;
+        else hi = mid;
+    }
+    for (; lo < g->offsets[u + 1] && g->neighbors[lo] == v; lo++) {
+        if (graph_link_weight(g, lo) < best) {
+            best = graph_link_weight(g, lo);
+            index = (uint32_t)(lo - g->offsets[u]);
+        }
+    }
+    return index;
+}
+
+// Cost of the table's route from u to d (0-based), UINT64_MAX if there is none
+static uint64_t next_hop_distance(const struct NextHopTable *t, const struct Graph *g, uint32_t u, uint32_t d) {
+    uint64_t dist = 0;
+    for (uint32_t steps = 0; u != d; steps++) {
+        uint32_t link = next_hop_get(t, u, d);
+        if (link == NEXT_HOP_NONE || steps > t->num_routers) return UINT64_MAX;
+        uint64_t e = g->offsets[u] + link;
+        dist += graph_link_weight(g, e);
+        u = g->neighbors[e];
+    }
+    return dist;
+}
+
+// Shared state of a parallel table repair; destinations are independent columns
+struct RepairJob {
+    struct NextHopTable *table;
+    const struct Graph *g;
+    uint32_t a, b;           // Changed link (0-based)
+    uint64_t cost;           // Its new cost, UINT64_MAX if it is down
+    const uint8_t *broken;   // Per destination: 1 = a's route crossed the link, 2 = b's
+    uint32_t num_units;
+    atomic_uint next_unit;
+    atomic_bool failed;
+};
+
+/**
+ * Column d, after the a-b link went down or changed: x's route to d crossed
+ * it. Recomputes x and every router routing through x (its subtree S) with a
+ * Dijkstra restricted to S, seeded by the best exits to routers outside S,
+ * whose routes did not use the link and are still shortest. The a-b link
+ * itself is ignored here; a new cost is applied afterwards as an improvement.
+ */
+static bool next_hop_repair_subtree(struct RepairJob *job, struct SearchWorkspace *ws, uint32_t x, uint32_t d) {
+    struct NextHopTable *t = job->table;
+    const struct Graph *g = job->g;
+    uint32_t size = 0;
+
+    // S: x, then every neighbour whose next hop toward d is already in S
+    search_begin(ws);
+    search_visit(ws, x, UINT64_MAX, NEXT_HOP_NONE);
+    ws->queue[size++] = x;
+    for (uint32_t i = 0; i < size; i++) {
+        uint32_t u = ws->queue[i];
+        for (uint64_t e = g->offsets[u]; e < g->offsets[u + 1]; e++) {
+            uint32_t y = g->neighbors[e];
+            if (y == d || search_seen(ws, y)) continue;
+            uint32_t link = next_hop_get(t, y, d);
+            if (link != NEXT_HOP_NONE && g->neighbors[g->offsets[y] + link] == u) {
+                search_visit(ws, y, UINT64_MAX, NEXT_HOP_NONE);
+                ws->queue[size++] = y;
+            }
+        }
+    }
+
+    // Seed each member with its cheapest exit out of S
+    ws->heap_size = 0;
+    for (uint32_t i = 0; i < size; i++) {
+        uint32_t u = ws->queue[i];
+        for (uint64_t e = g->offsets[u]; e < g->offsets[u + 1]; e++) {
+            uint32_t y = g->neighbors[e];
+            if (search_seen(ws, y) || (u == job->a && y == job->b) || (u == job->b && y == job->a)) continue;
+            uint64_t dy = next_hop_distance(t, g, y, d);
+            if (dy == UINT64_MAX) continue;
+            uint64_t nd = dy + graph_link_weight(g, e);
+            if (nd < ws->dist[u]) {
+                ws->dist[u] = nd;
+                ws->parent[u] = (uint32_t)(e - g->offsets[u]);
+            }
+        }
+        if (ws->dist[u] != UINT64_MAX && !heap_push(ws, ws->dist[u], u)) return false;
+    }
+
+    // Dijkstra inside S
+    while (ws->heap_size > 0) {
+        struct HeapItem item = heap_pop(ws);
+        uint32_t u = item.node;
+        if (item.dist > ws->dist[u]) continue;
+        for (uint64_t e = g->offsets[u]; e < g->offsets[u + 1]; e++) {
+            uint32_t v = g->neighbors[e];
+            if (!search_seen(ws, v) || (u == job->a && v == job->b) || (u == job->b && v == job->a)) continue;
+            uint32_t link = graph_link_index(g, v, u);
+            uint64_t nd = item.dist + graph_link_weight(g, g->offsets[v] + link);
+            if (nd >= ws->dist[v]) continue;
+            ws->dist[v] = nd;
+            ws->parent[v] = link;
+            if (!heap_push(ws, nd, v)) return false;
+        }
+    }
+
+    for (uint32_t i = 0; i < size; i++) {
+        uint32_t u = ws->queue[i];
+        next_hop_set(t, u, d, ws->dist[u] == UINT64_MAX ? NEXT_HOP_NONE : ws->parent[u]);
+    }
+    return true;
+}
+
+/**
+ * Column d, with the a-b link up at job->cost: if the link shortens the route
+ * of one endpoint, spreads the improvement outward from it like Dijkstra,
+ * re-pointing only the routers whose route gets cheaper.
+ */
+static bool next_hop_improve(struct RepairJob *job, struct SearchWorkspace *ws, uint32_t d) {
+    struct NextHopTable *t = job->table;
+    const struct Graph *g = job->g;
+    uint64_t da = next_hop_distance(t, g, job->a, d);
+    uint64_t db = next_hop_distance(t, g, job->b, d);
+    uint32_t start, via;
+    uint64_t nd;
+
+    if (db != UINT64_MAX && db + job->cost < da) {
+        start = job->a;
+        via = job->b;
+        nd = db + job->cost;
+    } else if (da != UINT64_MAX && da + job->cost < db) {
+        start = job->b;
+        via = job->a;
+        nd = da + job->cost;
+    } else {
+        return true;
+    }
+
+    search_begin(ws);
+    ws->heap_size = 0;
+    search_visit(ws, start, nd, start);
+    next_hop_set(t, start, d, graph_link_index(g, start, via));
+    if (!heap_push(ws, nd, start)) return false;
+
+    while (ws->heap_size > 0) {
+        struct HeapItem item = heap_pop(ws);
+        uint32_t u = item.node;
+        if (item.dist > ws->dist[u]) continue;
+        for (uint64_t e = g->offsets[u]; e < g->offsets[u + 1]; e++) {
+            uint32_t v = g->neighbors[e];
+            if (v == d) continue;
+            uint32_t link = graph_link_index(g, v, u);
+            uint64_t cand = item.dist + graph_link_weight(g, g->offsets[v] + link);
+            if (!search_seen(ws, v)) {
+                // Routers already routing through u improved with it and must spread it too
+                uint32_t hop = next_hop_get(t, v, d);
+                bool via_u = hop != NEXT_HOP_NONE && g->neighbors[g->offsets[v] + hop] == u;
+                if (!via_u && cand >= next_hop_distance(t, g, v, d)) continue;
+            } else if (cand >= ws->dist[v]) {
+                continue;
+            }
+            search_visit(ws, v, cand, u);
+            next_hop_set(t, v, d, link);
+            if (!heap_push(ws, cand, v)) return false;
+        }
+    }
+    return true;
+}
+
+static void *repair_worker(void *arg) {
+    struct RepairJob *job = arg;
+    struct SearchWorkspace ws;
+    if (!search_workspace_init(&ws, job->g->num_routers)) {
+        atomic_store(&job->failed, true);
+        return NULL;
+    }
+
+    uint32_t unit;
+    while ((unit = atomic_fetch_add(&job->next_unit, 1)) < job->num_units) {
+        uint32_t end = (unit + 1) * 64 < job->g->num_routers ? (unit + 1) * 64 : job->g->num_routers;
+        for (uint32_t d = unit * 64; d < end; d++) {
+            bool ok = true;
+            if (job->broken[d] & 1) ok = next_hop_repair_subtree(job, &ws, job->a, d);
+            if (ok && (job->broken[d] & 2)) ok = next_hop_repair_subtree(job, &ws, job->b, d);
+            if (ok && job->cost != UINT64_MAX) ok = next_hop_improve(job, &ws, d);
+            if (!ok) atomic_store(&job->failed, true);
+        }
+    }
+    search_workspace_free(&ws);
+    return NULL;
+}
+
+/**
+ * @brief Repairs a next-hop table in place after the link between routers a
+ * and b (1-based) went down, came up or changed cost, instead of rebuilding
+ * it. Only the rows of a and b are remapped to the new link layout; then,
+ * per destination, routes that crossed the old link are recomputed for the
+ * affected subtree only, and a new or cheaper link is spread outward from
+ * whichever endpoint it improves.
+ * @param old_g Graph the table was built for.
+ * @param new_g Same routers, differing only in the links between a and b.
+ * @return True on success, False if the table has to be rebuilt instead
+ * (wider entries needed, or out of memory; the table is then unusable).
+ */
+bool next_hop_table_update(struct NextHopTable *t, const struct Graph *old_g, const struct Graph *new_g, uint32_t a,
+                           uint32_t b, int num_threads) {
+    uint32_t n = new_g->num_routers, ends[2] = { a - 1, b - 1 };
+    uint32_t limit = t->entry_bytes == 1 ? 0xFF : NEXT_HOP_NONE;
+    for (int k = 0; k < 2; k++) {
+        if (new_g->offsets[ends[k] + 1] - new_g->offsets[ends[k]] >= limit) return false;
+    }
+
+    uint8_t *broken = calloc(n ? n : 1, 1);
+    if (broken == NULL) return false;
+
+    // Remap rows a and b to the new link indexes; routes over the old link break
+    for (int k = 0; k < 2; k++) {
+        uint32_t u = ends[k], other = ends[1 - k];
+        uint64_t degree = old_g->offsets[u + 1] - old_g->offsets[u];
+        uint32_t map[0x100];
+        uint32_t *remap = degree <= 0x100 ? map : malloc(degree * sizeof(uint32_t));
+        if (remap == NULL) {
+            free(broken);
+            return false;
+        }
+        for (uint64_t i = 0; i < degree; i++) {
+            uint32_t v = old_g->neighbors[old_g->offsets[u] + i];
+            remap[i] = v == other ? NEXT_HOP_NONE : graph_link_index(new_g, u, v);
+        }
+        for (uint32_t d = 0; d < n; d++) {
+            uint32_t link = next_hop_get(t, u, d);
+            if (link == NEXT_HOP_NONE) continue;
+            if (remap[link] == NEXT_HOP_NONE) broken[d] |= (uint8_t)(1 << k);
+            next_hop_set(t, u, d, remap[link]);
+        }
+        if (remap != map) free(remap);
+    }
+
+    struct RepairJob job;
+    job.table = t;
+    job.g = new_g;
+    job.a = ends[0];
+    job.b = ends[1];
+    job.cost = UINT64_MAX;
+    uint32_t link = graph_link_index(new_g, ends[0], ends[1]);
+    if (link != NEXT_HOP_NONE) job.cost = graph_link_weight(new_g, new_g->offsets[ends[0]] + link);
+    job.broken = broken;
+    job.num_units = (n + 63) / 64;
+    atomic_init(&job.next_unit, 0);
+    atomic_init(&job.failed, false);
+
+    if (num_threads <= 0) num_threads = default_thread_count();
+    if ((uint32_t)num_threads > job.num_units) num_threads = job.num_units ? (int)job.num_units : 1;
+    bool ok = run_workers(repair_worker, &job, num_threads) && !atomic_load(&job.failed);
+    free(broken);
+    return ok;
+}
+
+// =======================================================
+// DISTANCE-VECTOR ROUTING
+// =======================================================
+
+// Metric at which a RIP route counts as unreachable
+#define DV_RIP_INFINITY 16
+// Largest usable infinity: costs are 16-bit and stay below 2^15 when a link cost is added
+#define DV_MAX_INFINITY 0x3FFF
+// Routers claimed at a time by a round's worker threads
+#define DV_CHUNK 1024
+
+// Distance-vector state of every router for a block of up to 64
+// destinations: the vector each router last advertised (cost and next hop
+// per destination) and the entries that changed in the last round. Routers
+// only ever combine their neighbors' entries for the same destination, so
+// destinations are independent and simulating them 64 at a time takes the
+// same rounds as simulating all of them at once.
+struct DvState {
+    const struct Graph *g;
+    uint32_t num_routers;
+    uint32_t base;          // First destination (0-based)
+    uint32_t width;         // Destinations in the block
+    uint16_t infinity;
+    bool split_horizon;     // With poisoned reverse
+    uint16_t *dist;         // [router * 64 + i]: cost to base + i, 'infinity' if unreachable
+    uint16_t *via;          // Next hop as an index into the router's links (as in a NextHopTable)
+    uint16_t *next_dist;    // Entries computed in the current round
+    uint16_t *next_via;
+    uint16_t *reverse;      // Per CSR link x -> y: index of the link back to x in y's row
+    uint64_t reverse_capacity;
+    uint64_t *changed;      // Per router: entries changed in the last round (its triggered update)
+    uint64_t *next_changed;
+    uint64_t *trigger;      // Per router: entries to recompute in the next round regardless
+};
+
+struct DvStats {
+    uint32_t rounds;        // Rounds until no router changed its vector
+    uint64_t route_changes; // Table entries changed
+    uint64_t entries_sent;  // Entries carried by triggered updates (one per neighbor)
+};
+
+// Shared state of one parallel round; workers claim chunks of routers
+struct DvJob {
+    struct DvState *s;
+    struct NextHopTable *table; // dv_store_worker only
+    uint32_t num_chunks;
+    atomic_uint next_chunk;
+    atomic_uint_fast64_t route_changes;
+    atomic_uint_fast64_t entries_sent;
+};
+
+/**
+ * @brief The cost at which routes become unreachable: --dv-infinity if set,
+ * otherwise RIP's 16 hops' worth of the graph's most expensive link (at most
+ * DV_MAX_INFINITY).
+ */
+uint16_t dv_metric_infinity(const struct Graph *g) {
+    uint64_t max_cost = 1;
+    for (uint64_t e = 0; g->weights && e < g->num_links; e++) {
+        if (g->weights[e] > max_cost) max_cost = g->weights[e];
+    }
+    uint64_t infinity = dv_infinity ? dv_infinity : DV_RIP_INFINITY * max_cost;
+    return infinity < DV_MAX_INFINITY ? (uint16_t)infinity : DV_MAX_INFINITY;
+}
+
+/**
+ * @brief Points the state at a (changed) topology and indexes its reverse
+ * links, which split horizon needs to see whether a neighbor routes back.
+ * @return True on success, False if out of memory or a router has 65,535 links or more.
+ */
+bool dv_set_graph(struct DvState *s, const struct Graph *g) {
+    if (g->num_links > s->reverse_capacity) {
+        uint16_t *grown = realloc(s->reverse, g->num_links * sizeof(uint16_t));
+        if (grown == NULL) return false;
+        s->reverse = grown;
+        s->reverse_capacity = g->num_links;
+    }
+    for (uint32_t x = 0; x < g->num_routers; x++) {
+        if (g->offsets[x + 1] - g->offsets[x] >= NEXT_HOP_NONE) return false;
+        for (uint64_t k = g->offsets[x]; k < g->offsets[x + 1]; k++) {
+            s->reverse[k] = (uint16_t)graph_link_index(g, g->neighbors[k], x);
+        }
+    }
+    s->g = g;
+    return true;
+}
+
+bool dv_state_init(struct DvState *s, const struct Graph *g, uint16_t infinity, bool split_horizon) {
+    memset(s, 0, sizeof(*s));
+    s->num_routers = g->num_routers;
+    s->infinity = infinity;
+    s->split_horizon = split_horizon;
+    size_t entries = (size_t)g->num_routers * 64;
+    s->dist = malloc(entries * sizeof(uint16_t));
+    s->via = malloc(entries * sizeof(uint16_t));
+    s->next_dist = malloc(entries * sizeof(uint16_t));
+    s->next_via = malloc(entries * sizeof(uint16_t));
+    s->changed = calloc(g->num_routers, sizeof(uint64_t));
+    s->next_changed = calloc(g->num_routers, sizeof(uint64_t));
+    s->trigger = calloc(g->num_routers, sizeof(uint64_t));
+    return s->dist && s->via && s->next_dist && s->next_via && s->changed && s->next_changed && s->trigger &&
+           dv_set_graph(s, g);
+}
+
+void dv_state_free(struct DvState *s) {
+    free(s->dist);
+    free(s->via);
+    free(s->next_dist);
+    free(s->next_via);
+    free(s->reverse);
+    free(s->changed);
+    free(s->next_changed);
+    free(s->trigger);
+    memset(s, 0, sizeof(*s));
+}
+
+/**
+ * @brief Cold start for destinations [base, base + width): every router
+ * knows only itself, and the destinations advertise themselves first.
+ */
+void dv_state_reset(struct DvState *s, uint32_t base, uint32_t width) {
+    size_t entries = (size_t)s->num_routers * 64;
+    s->base = base;
+    s->width = width;
+    for (size_t k = 0; k < entries; k++) s->dist[k] = s->infinity;
+    memset(s->via, 0xFF, entries * sizeof(uint16_t));
+    memset(s->changed, 0, s->num_routers * sizeof(uint64_t));
+    memset(s->trigger, 0, s->num_routers * sizeof(uint64_t));
+    for (uint32_t i = 0; i < width; i++) {
+        s->dist[(size_t)(base + i) * 64 + i] = 0;
+        s->changed[base + i] = 1ull << i;
+    }
+}
+
+/**
+ * @brief Starts reconvergence after the link between routers a and b
+ * (0-based) changed: 'g' is the topology with the change applied. Both ends
+ * recompute their whole vector in the next round.
+ * @return True on success, False if out of memory.
+ */
+bool dv_link_changed(struct DvState *s, const struct Graph *g, uint32_t a, uint32_t b) {
+    s->trigger[a] = s->trigger[b] = UINT64_MAX;
+    return dv_set_graph(s, g);
+}
+
+// Bellman-Ford step for router x: the best entry for every destination of
+// the block over what its neighbors advertised in the last round. With split
+// horizon, a neighbor that routes back through x advertises infinity to it
+// (poisoned reverse). On equal cost the current next hop is kept. Costs stay
+// below 2^15, so signed 16-bit compares order them correctly.
+static void dv_best_routes(const struct DvState *s, uint32_t x, uint16_t *best, uint16_t *best_via) {
+    const struct Graph *g = s->g;
+    const uint16_t inf = s->infinity;
+    const uint16_t *cur_via = &s->via[(size_t)x * 64];
+    for (uint32_t i = 0; i < 64; i++) {
+        best[i] = inf;
+        best_via[i] = NEXT_HOP_NONE;
+    }
+    for (uint64_t k = g->offsets[x]; k < g->offsets[x + 1]; k++) {
+        uint32_t y = g->neighbors[k];
+        uint64_t weight = graph_link_weight(g, k);
+        uint16_t w = weight < inf ? (uint16_t)weight : inf;
+        uint16_t link = (uint16_t)(k - g->offsets[x]);
+        uint16_t back = s->split_horizon ? s->reverse[k] : NEXT_HOP_NONE - 1; // Never a via when off
+        const uint16_t *yd = &s->dist[(size_t)y * 64], *yv = &s->via[(size_t)y * 64];
+#if defined(__AVX2__)
+        const __m256i vlink = _mm256_set1_epi16((short)link), vback = _mm256_set1_epi16((short)back);
+        const __m256i vw = _mm256_set1_epi16((short)w), vinf = _mm256_set1_epi16((short)inf);
+        for (uint32_t i = 0; i < 64; i += 16) {
+            __m256i c = _mm256_add_epi16(_mm256_loadu_si256((const __m256i *)(yd + i)), vw);
+            __m256i poisoned = _mm256_cmpeq_epi16(_mm256_loadu_si256((const __m256i *)(yv + i)), vback);
+            c = _mm256_blendv_epi8(c, vinf, poisoned);
+            __m256i b = _mm256_loadu_si256((const __m256i *)(best + i));
+            __m256i keep = _mm256_cmpeq_epi16(_mm256_loadu_si256((const __m256i *)(cur_via + i)), vlink);
+            __m256i better = _mm256_or_si256(_mm256_cmpgt_epi16(b, c), _mm256_and_si256(_mm256_cmpeq_epi16(b, c), keep));
+            _mm256_storeu_si256((__m256i *)(best + i), _mm256_blendv_epi8(b, c, better));
+            __m256i v = _mm256_loadu_si256((const __m256i *)(best_via + i));
+            _mm256_storeu_si256((__m256i *)(best_via + i), _mm256_blendv_epi8(v, vlink, better));
+        }
+#elif defined(__SSE2__)
+        const __m128i vlink = _mm_set1_epi16((short)link), vback = _mm_set1_epi16((short)back);
+        const __m128i vw = _mm_set1_epi16((short)w), vinf = _mm_set1_epi16((short)inf);
+        for (uint32_t i = 0; i < 64; i += 8) {
+            __m128i c = _mm_add_epi16(_mm_loadu_si128((const __m128i *)(yd + i)), vw);
+            __m128i poisoned = _mm_cmpeq_epi16(_mm_loadu_si128((const __m128i *)(yv + i)), vback);
+            c = _mm_or_si128(_mm_andnot_si128(poisoned, c), _mm_and_si128(poisoned, vinf));
+            __m128i b = _mm_loadu_si128((const __m128i *)(best + i));
+            __m128i keep = _mm_cmpeq_epi16(_mm_loadu_si128((const __m128i *)(cur_via + i)), vlink);
+            __m128i better = _mm_or_si128(_mm_cmpgt_epi16(b, c), _mm_and_si128(_mm_cmpeq_epi16(b, c), keep));
+            _mm_storeu_si128((__m128i *)(best + i), _mm_or_si128(_mm_andnot_si128(better, b), _mm_and_si128(better, c)));
+            __m128i v = _mm_loadu_si128((const __m128i *)(best_via + i));
+            _mm_storeu_si128((__m128i *)(best_via + i),
+                             _mm_or_si128(_mm_andnot_si128(better, v), _mm_and_si128(better, vlink)));
+        }
+#else
+        for (uint32_t i = 0; i < 64; i++) {
+            uint16_t c = yv[i] == back ? inf : (uint16_t)(yd[i] + w);
+            bool better = c < best[i] || (c == best[i] && cur_via[i] == link);
+            best[i] = better ? c : best[i];
+            best_via[i] = better ? link : best_via[i];
+        }
+#endif
+    }
+}
+
+/*
+ * First half of a round: every router that heard a triggered update from a
+ * neighbor (or had a link change) recomputes the affected entries into
+ * next_dist / next_via. Only the last round's vectors are read, so routers
+ * are processed in parallel in any order.
+ */
+static void *dv_round_worker(void *arg) {
+    struct DvJob *job = arg;
+    struct DvState *s = job->s;
+    const struct Graph *g = s->g;
+    uint64_t all = s->width == 64 ? UINT64_MAX : (1ull << s->width) - 1;
+    uint64_t changes = 0, sent = 0;
+    uint16_t best[64], best_via[64];
+
+    uint32_t chunk;
+    while ((chunk = atomic_fetch_add(&job->next_chunk, 1)) < job->num_chunks) {
+        uint32_t end = (chunk + 1) * DV_CHUNK < s->num_routers ? (chunk + 1) * DV_CHUNK : s->num_routers;
+        for (uint32_t x = chunk * DV_CHUNK; x < end; x++) {
+            if (s->changed[x]) {
+                sent += (uint64_t)__builtin_popcountll(s->changed[x]) * (g->offsets[x + 1] - g->offsets[x]);
+            }
+            uint64_t pending = s->trigger[x];
+            for (uint64_t k = g->offsets[x]; k < g->offsets[x + 1]; k++) pending |= s->changed[g->neighbors[k]];
+            if (x - s->base < s->width) pending &= ~(1ull << (x - s->base)); // A router's route to itself is fixed
+            pending &= all;
+            s->trigger[x] = 0;
+            s->next_changed[x] = 0;
+            if (pending == 0) continue;
+
+            dv_best_routes(s, x, best, best_via);
+            size_t row = (size_t)x * 64;
+            uint64_t changed = 0;
+            for (uint64_t bits = pending; bits; bits &= bits - 1) {
+                uint32_t i = (uint32_t)__builtin_ctzll(bits);
+                if (best[i] >= s->infinity) {
+                    best[i] = s->infinity;
+                    best_via[i] = NEXT_HOP_NONE;
+                }
+                if (best[i] == s->dist[row + i] && best_via[i] == s->via[row + i]) continue;
+                s->next_dist[row + i] = best[i];
+                s->next_via[row + i] = best_via[i];
+                changed |= 1ull << i;
+            }
+            s->next_changed[x] = changed;
+            changes += (uint64_t)__builtin_popcountll(changed);
+        }
+    }
+    atomic_fetch_add(&job->route_changes, changes);
+    atomic_fetch_add(&job->entries_sent, sent);
+    return NULL;
+}
+
+// Second half of a round: routers adopt their new entries, which become the
+// triggered updates their neighbors read in the next round
+static void *dv_commit_worker(void *arg) {
+    struct DvJob *job = arg;
+    struct DvState *s = job->s;
+    uint32_t chunk;
+    while ((chunk = atomic_fetch_add(&job->next_chunk, 1)) < job->num_chunks) {
+        uint32_t end = (chunk + 1) * DV_CHUNK < s->num_routers ? (chunk + 1) * DV_CHUNK : s->num_routers;
+        for (uint32_t x = chunk * DV_CHUNK; x < end; x++) {
+            uint64_t changed = s->next_changed[x];
+            for (uint64_t bits = changed; bits; bits &= bits - 1) {
+                size_t k = (size_t)x * 64 + (uint32_t)__builtin_ctzll(bits);
+                s->dist[k] = s->next_dist[k];
+                s->via[k] = s->next_via[k];
+            }
+            s->changed[x] = changed;
+        }
+    }
+    return NULL;
+}
+
+// Copies the block's next hops into a next-hop table
+static void *dv_store_worker(void *arg) {
+    struct DvJob *job = arg;
+    const struct DvState *s = job->s;
+    uint32_t chunk;
+    while ((chunk = atomic_fetch_add(&job->next_chunk, 1)) < job->num_chunks) {
+        uint32_t end = (chunk + 1) * DV_CHUNK < s->num_routers ? (chunk + 1) * DV_CHUNK : s->num_routers;
+        for (uint32_t x = chunk * DV_CHUNK; x < end; x++) {
+            for (uint32_t i = 0; i < s->width; i++) {
+                uint16_t via = s->via[(size_t)x * 64 + i];
+                if (via != NEXT_HOP_NONE) next_hop_set(job->table, x, s->base + i, via);
+            }
+        }
+    }
+    return NULL;
+}
+
+static void dv_job_init(struct DvJob *job, struct DvState *s, int *num_threads) {
+    job->s = s;
+    job->table = NULL;
+    job->num_chunks = (s->num_routers + DV_CHUNK - 1) / DV_CHUNK;
+    atomic_init(&job->next_chunk, 0);
+    atomic_init(&job->route_changes, 0);
+    atomic_init(&job->entries_sent, 0);
+    if (*num_threads <= 0) *num_threads = default_thread_count();
+    if ((uint32_t)*num_threads > job->num_chunks) *num_threads = job->num_chunks ? (int)job->num_chunks : 1;
+}
+
+/**
+ * @brief Runs synchronous rounds of the protocol until no router changes its
+ * vector. In each round, every router that received a triggered update
+ * recomputes the affected entries from its neighbors' vectors; rounds are
+ * split over threads by router. Routes that lose their next hop count up
+ * towards infinity until they are withdrawn or a real path wins, which split
+ * horizon with poisoned reverse shortens but cannot always prevent.
+ * @param stats Rounds, changes and advertised entries are added to it.
+ * @return True on success, False if out of memory.
+ */
+bool dv_converge(struct DvState *s, int num_threads, struct DvStats *stats) {
+    struct DvJob job;
+    dv_job_init(&job, s, &num_threads);
+    for (;;) {
+        atomic_store(&job.next_chunk, 0);
+        atomic_store(&job.route_changes, 0);
+        if (!run_workers(dv_round_worker, &job, num_threads)) return false;
+        uint64_t changes = atomic_load(&job.route_changes);
+        if (changes == 0) break;
+        stats->rounds++;
+        stats->route_changes += changes;
+        atomic_store(&job.next_chunk, 0);
+        if (!run_workers(dv_commit_worker, &job, num_threads)) return false;
+    }
+    memset(s->changed, 0, s->num_routers * sizeof(uint64_t));
+    stats->entries_sent += atomic_load(&job.entries_sent);
+    return true;
+}
+
+/**
+ * @brief Fills a next-hop table by running the distance-vector protocol to
+ * convergence from a cold start, 64 destinations at a time.
+ * @param stats Receives the rounds of the slowest block (all blocks run
+ * side by side in a real network) and the total changes and entries sent.
+ * @return True on success, False if out of memory.
+ */
+bool dv_build_next_hops(struct NextHopTable *t, const struct Graph *g, int num_threads, struct DvStats *stats) {
+    struct DvState s;
+    memset(stats, 0, sizeof(*stats));
+    if (!next_hop_table_alloc(t, g)) return false;
+    if (!dv_state_init(&s, g, dv_metric_infinity(g), dv_split_horizon)) {
+        dv_state_free(&s);
+        next_hop_table_free(t);
+        return false;
+    }
+
+    bool ok = true;
+    for (uint32_t base = 0; ok && base < g->num_routers; base += 64) {
+        struct DvStats block = { 0 };
+        dv_state_reset(&s, base, g->num_routers - base < 64 ? g->num_routers - base : 64);
+        ok = dv_converge(&s, num_threads, &block);
+        if (block.rounds > stats->rounds) stats->rounds = block.rounds;
+        stats->route_changes += block.route_changes;
+        stats->entries_sent += block.entries_sent;
+
+        struct DvJob job;
+        int threads = num_threads;
+        dv_job_init(&job, &s, &threads);
+        job.table = t;
+        ok = ok && run_workers(dv_store_worker, &job, threads);
+    }
+    dv_state_free(&s);
+    if (!ok) next_hop_table_free(t);
+    return ok;
+}
+
+// =======================================================
+// TIMING WHEEL
+// =======================================================
+
+// Hierarchical timing wheel: 4 levels of 256 slots on a 1 ns tick, so it
+// spans 2^32 ns (about 4.3 s) ahead of the current time. An event goes into
+// the lowest level whose slot range still contains it; when the current
+// time reaches a higher-level slot, that slot's events cascade down. Events
+// further out wait in an unsorted overflow slot. Slots are arrays rather
+// than linked lists, so filling and draining them streams through memory.
+#define WHEEL_BITS 8
+#define WHEEL_SLOTS (1u << WHEEL_BITS)
+#define WHEEL_LEVELS 4
+
+// A scheduled event. Packet simulation: packet 'seq' of flow 'flow' arriving
+// at hop 'hop' of its path ('hop' links crossed so far). Link-state
+// simulation: see ls_run.
+struct SimEvent {
+    uint64_t time; // ns
+    uint32_t flow;
+    uint32_t seq;
+    uint32_t hop;
+    uint32_t from;
+};
+
+struct WheelSlot {
+    struct SimEvent *events;
+    uint32_t first; // Events before 'first' were already taken
+    uint32_t count;
+    uint32_t capacity;
+};
+
+struct TimingWheel {
+    uint64_t now;   // No pending event is earlier
+    uint64_t pending;
+    struct WheelSlot slots[WHEEL_LEVELS][WHEEL_SLOTS];
+    struct WheelSlot overflow;
+    uint64_t occupied[WHEEL_LEVELS][WHEEL_SLOTS / 64];
+};
+
+static void wheel_init(struct TimingWheel *w) {
+    memset(w, 0, sizeof(*w));
+}
+
+static void wheel_free(struct TimingWheel *w) {
+    for (uint32_t level = 0; level < WHEEL_LEVELS; level++) {
+        for (uint32_t slot = 0; slot < WHEEL_SLOTS; slot++) free(w->slots[level][slot].events);
+    }
+    free(w->overflow.events);
+    memset(w, 0, sizeof(*w));
+}
+
+static bool wheel_slot_push(struct WheelSlot *s, const struct SimEvent *e) {
+    if (s->count == s->capacity) {
+        uint32_t new_cap = s->capacity ? s->capacity * 2 : 16;
+        struct SimEvent *grown = new_cap > s->capacity ? realloc(s->events, (size_t)new_cap * sizeof(struct SimEvent))
+                                                       : NULL;
+        if (grown == NULL) return false;
+        s->events = grown;
+        s->capacity = new_cap;
+    }
+    s->events[s->count++] = *e;
+    return true;
+}
+
+// Files an event under its time, relative to the current time
+static inline bool wheel_link(struct TimingWheel *w, const struct SimEvent *e) {
+    uint64_t diff = e->time ^ w->now;
+    uint32_t level = diff ? (uint32_t)(63 - __builtin_clzll(diff)) / WHEEL_BITS : 0;
+    if (level >= WHEEL_LEVELS) return wheel_slot_push(&w->overflow, e);
+    uint32_t slot = (uint32_t)(e->time >> (level * WHEEL_BITS)) & (WHEEL_SLOTS - 1);
+    w->occupied[level][slot / 64] |= 1ull << (slot % 64);
+    return wheel_slot_push(&w->slots[level][slot], e);
+}
+
+/**
+ * @brief Schedules an event. Events in the past run at the current time.
+ * @return True on success, False if out of memory.
+ */
+static inline bool wheel_schedule(struct TimingWheel *w, struct SimEvent e) {
+    if (e.time < w->now) e.time = w->now;
+    w->pending++;
+    return wheel_link(w, &e);
+}
+
+// First occupied slot at or after 'from' in one level, or -1
+static inline int wheel_find_slot(const uint64_t *bits, uint32_t from) {
+    for (uint32_t word = from / 64; word < WHEEL_SLOTS / 64; word++) {
+        uint64_t m = bits[word];
+        if (word == from / 64) m &= ~0ull << (from % 64);
+        if (m) return (int)(word * 64 + (uint32_t)__builtin_ctzll(m));
+    }
+    return -1;
+}
+
+// Re-files every event of a slot against the current time and empties it
+static bool wheel_cascade(struct TimingWheel *w, struct WheelSlot *s) {
+    uint32_t count = s->count;
+    s->count = 0;
+    for (uint32_t i = 0; i < count; i++) {
+        if (!wheel_link(w, &s->events[i])) return false;
+    }
+    return true;
+}
+
+/**
+ * @brief Removes the earliest pending event and advances the current time to
+ * it. Events due at the same nanosecond come out in the order they were
+ * scheduled.
+ * @return True with the event in 'out', False when nothing is pending (or,
+ * with 'pending' still set, when out of memory while cascading).
+ */
+static bool wheel_next(struct TimingWheel *w, struct SimEvent *out) {
+    for (;;) {
+        int slot = wheel_find_slot(w->occupied[0], (uint32_t)(w->now & (WHEEL_SLOTS - 1)));
+        if (slot >= 0) {
+            struct WheelSlot *s = &w->slots[0][slot];
+            w->now = (w->now & ~(uint64_t)(WHEEL_SLOTS - 1)) | (uint32_t)slot;
+            *out = s->events[s->first++];
+            if (s->first == s->count) {
+                s->first = s->count = 0;
+                w->occupied[0][slot / 64] &= ~(1ull << (slot % 64));
+            }
+            w->pending--;
+            return true;
+        }
+
+        // Level 0 is empty up to its end: move to the next occupied slot
+        // of a higher level and spread its events over the levels below
+        int level = 1;
+        for (; level < WHEEL_LEVELS; level++) {
+            uint32_t shift = (uint32_t)level * WHEEL_BITS;
+            slot = wheel_find_slot(w->occupied[level], ((uint32_t)(w->now >> shift) & (WHEEL_SLOTS - 1)) + 1);
+            if (slot < 0) continue;
+            uint64_t above = shift + WHEEL_BITS < 64 ? w->now >> (shift + WHEEL_BITS) << (shift + WHEEL_BITS) : 0;
+            w->now = above | (uint64_t)slot << shift;
+            w->occupied[level][slot / 64] &= ~(1ull << (slot % 64));
+            if (!wheel_cascade(w, &w->slots[level][slot])) return false;
+            break;
+        }
+        if (level < WHEEL_LEVELS) continue;
+
+        // The wheel is empty: jump to the earliest far-away event
+        if (w->overflow.count == 0) return false;
+        uint64_t earliest = UINT64_MAX;
+        for (uint32_t i = 0; i < w->overflow.count; i++) {
+            if (w->overflow.events[i].time < earliest) earliest = w->overflow.events[i].time;
+        }
+        w->now = earliest;
+        struct WheelSlot far = w->overflow;
+        memset(&w->overflow, 0, sizeof(w->overflow));
+        bool ok = wheel_cascade(w, &far);
+        free(far.events);
+        if (!ok) return false;
+    }
+}
+
+// =======================================================
+// LINK-STATE ROUTING
+// =======================================================
+
+// Kinds of events besides LSA arrivals (SimEvent.hop), and no router
+#define LS_SPF_EVENT 0xFFFFFFFFu
+#define LS_LINK_EVENT 0xFFFFFFFEu
+#define LS_NONE 0xFFFFFFFFu
+// LSA changes a router remembers for incremental SPF; more mean a full run
+#define LS_MAX_CHANGES 8
+// Simulated time an SPF run takes per router settled or link examined
+// (roughly what a step costs here, on one core)
+#define LS_SPF_STEP_NS 60
+
+// One LSA instance: the links its origin router had when it issued 'seq'
+struct LsaVersion {
+    uint32_t seq;
+    uint32_t count;
+    uint64_t first;   // First link in LinkStateSim.lsa_neighbors / lsa_costs
+    uint32_t older;   // Previous version of the same origin, or LS_NONE
+};
+
+// Per-router protocol state besides its LSDB and shortest-path tree
+struct LsRouter {
+    uint64_t last_spf;   // When the last SPF run finished (ns)
+    uint64_t hold;       // Current SPF hold time (ns), doubled while changes keep coming
+    uint32_t spf_runs;
+    bool spf_pending;
+    bool full_spf;       // Too many changes (or none run yet): incremental SPF is not worth it
+    uint8_t num_changes;
+    struct {
+        uint32_t origin;
+        uint32_t old_seq;
+    } changes[LS_MAX_CHANGES]; // LSAs replaced since the last SPF run
+};
+
+struct LsStats {
+    uint64_t lsas_flooded;   // LSA transmissions over links
+    uint64_t lsas_installed; // Newer LSAs accepted into an LSDB
+    uint64_t full_spf;
+    uint64_t incremental_spf;
+    double full_spf_time;    // Wall-clock seconds spent in each kind of run
+    double incremental_spf_time;
+    uint64_t flooded_at;     // Last LSA installed (simulated ns)
+    uint64_t converged_at;   // Last SPF run finished (simulated ns)
+};
+
+// OSPF-style link-state routing on a topology: every router floods its own
+// LSA, keeps the newest LSA of every router in its LSDB, and computes its
+// shortest-path tree from that view of the network once its SPF timer fires.
+// Link propagation takes the link cost in microseconds, as in --simulate,
+// and an SPF run LS_SPF_STEP_NS per step of work, so runs are repeatable.
+struct LinkStateSim {
+    const struct Graph *g;     // Current topology
+    uint32_t num_routers;
+    struct TimingWheel wheel;
+    struct LsaVersion *versions;
+    uint32_t num_versions;
+    uint32_t versions_capacity;
+    uint32_t *latest;          // Per origin: newest version, or LS_NONE
+    uint32_t *lsa_neighbors;
+    uint32_t *lsa_costs;
+    uint64_t lsa_links;
+    uint64_t lsa_capacity;
+    uint32_t *lsdb;            // [router * num_routers + origin]: sequence number held, 0 = none
+    uint64_t *dist;            // [router * num_routers + v]: shortest-path tree, UINT64_MAX = unreachable
+    uint32_t *parent;          // Predecessor of v in the tree, or LS_NONE
+    struct LsRouter *routers;
+    struct {
+        const struct Graph *g; // Topology after the change
+        uint32_t a, b;
+    } *link_changes;           // Scheduled with ls_schedule_link_change
+    uint32_t num_link_changes;
+    uint32_t link_changes_capacity;
+    struct SearchWorkspace ws;
+    uint64_t spf_steps;        // Routers settled and links examined by all SPF runs
+    uint64_t spf_start_ns;     // SPF throttling: delay after the first change,
+    uint64_t spf_hold_ns;      // minimum gap between runs (doubling while changes keep coming)
+    uint64_t spf_max_ns;       // and its ceiling
+    struct LsStats stats;
+};
+
+bool ls_init(struct LinkStateSim *sim, const struct Graph *g) {
+    memset(sim, 0, sizeof(*sim));
+    uint32_t n = g->num_routers;
+    size_t cells = (size_t)n * n;
+    sim->g = g;
+    sim->num_routers = n;
+    wheel_init(&sim->wheel);
+    sim->latest = malloc((size_t)n * sizeof(uint32_t));
+    sim->lsdb = calloc(cells ? cells : 1, sizeof(uint32_t));
+    sim->dist = malloc((cells ? cells : 1) * sizeof(uint64_t));
+    sim->parent = malloc((cells ? cells : 1) * sizeof(uint32_t));
+    sim->routers = calloc(n ? n : 1, sizeof(struct LsRouter));
+    sim->spf_start_ns = (uint64_t)spf_throttle_ms[0] * 1000000;
+    sim->spf_hold_ns = (uint64_t)spf_throttle_ms[1] * 1000000;
+    sim->spf_max_ns = (uint64_t)spf_throttle_ms[2] * 1000000;
+    if (sim->latest == NULL || sim->lsdb == NULL || sim->dist == NULL || sim->parent == NULL || sim->routers == NULL ||
+        !search_workspace_init(&sim->ws, n)) {
+        return false;
+    }
+    memset(sim->latest, 0xFF, (size_t)n * sizeof(uint32_t));
+    memset(sim->dist, 0xFF, cells * sizeof(uint64_t));
+    memset(sim->parent, 0xFF, cells * sizeof(uint32_t));
+    for (uint32_t r = 0; r < n; r++) sim->routers[r].full_spf = true;
+    return true;
+}
+
+void ls_free(struct LinkStateSim *sim) {
+    wheel_free(&sim->wheel);
+    free(sim->versions);
+    free(sim->latest);
+    free(sim->lsa_neighbors);
+    free(sim->lsa_costs);
+    free(sim->lsdb);
+    free(sim->dist);
+    free(sim->parent);
+    free(sim->routers);
+    free(sim->link_changes);
+    search_workspace_free(&sim->ws);
+    memset(sim, 0, sizeof(*sim));
+}
+
+// Version 'seq' of origin o's LSA, or NULL if the router holds none
+static inline const struct LsaVersion *ls_lsa(const struct LinkStateSim *sim, uint32_t o, uint32_t seq) {
+    if (seq == 0) return NULL;
+    for (uint32_t v = sim->latest[o]; v != LS_NONE; v = sim->versions[v].older) {
+        if (sim->versions[v].seq == seq) return &sim->versions[v];
+    }
+    return NULL;
+}
+
+// Cost an LSA gives its link to router v, or UINT64_MAX if it lists no such link
+static inline uint64_t ls_lsa_cost(const struct LinkStateSim *sim, const struct LsaVersion *lsa, uint32_t v) {
+    if (lsa == NULL) return UINT64_MAX;
+    const uint32_t *nb = sim->lsa_neighbors + lsa->first;
+    uint32_t lo = 0, hi = lsa->count;
+    while (lo < hi) {
+        uint32_t mid = (lo + hi) / 2;
+        if (nb[mid] < v) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo < lsa->count && nb[lo] == v ? sim->lsa_costs[lsa->first + lo] : UINT64_MAX;
+}
+
+// Router r's view of link u -> v: its cost if both LSAs r holds list the
+// link (the two-way check), UINT64_MAX otherwise
+static inline uint64_t ls_view_cost(const struct LinkStateSim *sim, uint32_t r, const struct LsaVersion *lsa_u,
+                                    uint32_t u, uint32_t k) {
+    uint32_t v = sim->lsa_neighbors[lsa_u->first + k];
+    const struct LsaVersion *lsa_v = ls_lsa(sim, v, sim->lsdb[(size_t)r * sim->num_routers + v]);
+    return ls_lsa_cost(sim, lsa_v, u) == UINT64_MAX ? UINT64_MAX : sim->lsa_costs[lsa_u->first + k];
+}
+
+// Issues a new LSA for router o from its links in the current topology
+static bool ls_originate_lsa(struct LinkStateSim *sim, uint32_t o) {
+    const struct Graph *g = sim->g;
+    uint64_t count = g->offsets[o + 1] - g->offsets[o];
+    if (sim->num_versions == sim->versions_capacity) {
+        uint32_t new_cap = sim->versions_capacity ? sim->versions_capacity * 2 : 1024;
+        struct LsaVersion *grown = realloc(sim->versions, (size_t)new_cap * sizeof(struct LsaVersion));
+        if (grown == NULL) return false;
+        sim->versions = grown;
+        sim->versions_capacity = new_cap;
+    }
+    if (sim->lsa_links + count > sim->lsa_capacity) {
+        uint64_t new_cap = sim->lsa_capacity ? sim->lsa_capacity * 2 : 4096;
+        while (new_cap < sim->lsa_links + count) new_cap *= 2;
+        uint32_t *neighbors = realloc(sim->lsa_neighbors, new_cap * sizeof(uint32_t));
+        if (neighbors == NULL) return false;
+        sim->lsa_neighbors = neighbors;
+        uint32_t *costs = realloc(sim->lsa_costs, new_cap * sizeof(uint32_t));
+        if (costs == NULL) return false;
+        sim->lsa_costs = costs;
+        sim->lsa_capacity = new_cap;
+    }
+    uint32_t previous = sim->latest[o];
+    struct LsaVersion *lsa = &sim->versions[sim->num_versions];
+    lsa->seq = previous == LS_NONE ? 1 : sim->versions[previous].seq + 1;
+    lsa->first = sim->lsa_links;
+    lsa->older = previous;
+    // Rows are sorted by neighbor: parallel links collapse into the cheapest
+    // one and links back to the router itself are left out
+    uint32_t *neighbors = sim->lsa_neighbors + sim->lsa_links, *costs = sim->lsa_costs + sim->lsa_links;
+    lsa->count = 0;
+    for (uint64_t k = g->offsets[o]; k < g->offsets[o + 1]; k++) {
+        uint64_t cost = graph_link_weight(g, k);
+        uint32_t v = g->neighbors[k];
+        if (v == o) continue;
+        if (lsa->count > 0 && neighbors[lsa->count - 1] == v) {
+            if (cost < costs[lsa->count - 1]) costs[lsa->count - 1] = (uint32_t)cost;
+            continue;
+        }
+        neighbors[lsa->count] = v;
+        costs[lsa->count++] = cost < UINT32_MAX ? (uint32_t)cost : UINT32_MAX;
+    }
+    sim->lsa_links += lsa->count;
+    sim->latest[o] = sim->num_versions++;
+    return true;
+}
+
+// SPF throttling: the first change after a quiet period waits the start
+// delay; later ones wait for the hold time after the last run, which
+// doubles each time up to the maximum and starts over once things calm down
+static bool ls_schedule_spf(struct LinkStateSim *sim, uint32_t r, uint64_t now) {
+    struct LsRouter *x = &sim->routers[r];
+    if (x->spf_pending) return true;
+    uint64_t at = now + sim->spf_start_ns;
+    if (x->spf_runs == 0 || now >= x->last_spf + sim->spf_max_ns) {
+        x->hold = sim->spf_hold_ns;
+    } else {
+        if (x->last_spf + x->hold > at) at = x->last_spf + x->hold;
+        x->hold = x->hold * 2 < sim->spf_max_ns ? x->hold * 2 : sim->spf_max_ns;
+    }
+    x->spf_pending = true;
+    return wheel_schedule(&sim->wheel, (struct SimEvent){ at, r, 0, LS_SPF_EVENT, r });
+}
+
+// Router r accepts LSA (o, seq): stores it, floods it on every link but the
+// one it came from, and arms its SPF timer
+static bool ls_install(struct LinkStateSim *sim, uint32_t r, uint32_t o, uint32_t seq, uint32_t from, uint64_t now) {
+    const struct Graph *g = sim->g;
+    uint32_t *held = &sim->lsdb[(size_t)r * sim->num_routers + o];
+    struct LsRouter *x = &sim->routers[r];
+    // Only the LSA an origin had at the last SPF run matters
+    uint32_t c = 0;
+    while (c < x->num_changes && x->changes[c].origin != o) c++;
+    if (c < x->num_changes || x->full_spf) {
+        // Already recorded
+    } else if (x->num_changes < LS_MAX_CHANGES) {
+        x->changes[x->num_changes].origin = o;
+        x->changes[x->num_changes].old_seq = *held;
+        x->num_changes++;
+    } else {
+        x->full_spf = true;
+    }
+    *held = seq;
+    sim->stats.lsas_installed++;
+    sim->stats.flooded_at = now;
+
+    for (uint64_t k = g->offsets[r]; k < g->offsets[r + 1]; k++) {
+        uint32_t y = g->neighbors[k];
+        if (y == from) continue;
+        uint64_t delay = graph_link_weight(g, k) * 1000;
+        if (!wheel_schedule(&sim->wheel, (struct SimEvent){ now + delay, y, seq, o, r })) return false;
+        sim->stats.lsas_flooded++;
+    }
+    return ls_schedule_spf(sim, r, now);
+}
+
+// Full SPF for router r: Dijkstra over its LSDB view with the 4-ary heap
+static bool ls_full_spf(struct LinkStateSim *sim, uint32_t r) {
+    uint32_t n = sim->num_routers;
+    uint64_t *dist = &sim->dist[(size_t)r * n];
+    uint32_t *parent = &sim->parent[(size_t)r * n];
+    struct SearchWorkspace *ws = &sim->ws;
+    memset(dist, 0xFF, (size_t)n * sizeof(uint64_t));
+    memset(parent, 0xFF, (size_t)n * sizeof(uint32_t));
+    dist[r] = 0;
+    ws->heap_size = 0;
+    if (!heap_push(ws, 0, r)) return false;
+
+    while (ws->heap_size > 0) {
+        struct HeapItem item = heap_pop(ws);
+        uint32_t u = item.node;
+        sim->spf_steps++;
+        if (item.dist > dist[u]) continue;
+        const struct LsaVersion *lsa = ls_lsa(sim, u, sim->lsdb[(size_t)r * n + u]);
+        if (lsa) sim->spf_steps += lsa->count;
+        for (uint32_t k = 0; lsa && k < lsa->count; k++) {
+            uint64_t cost = ls_view_cost(sim, r, lsa, u, k);
+            uint32_t v = sim->lsa_neighbors[lsa->first + k];
+            if (cost == UINT64_MAX || item.dist + cost >= dist[v]) continue;
+            dist[v] = item.dist + cost;
+            parent[v] = u;
+            if (!heap_push(ws, dist[v], v)) return false;
+        }
+    }
+    return true;
+}
+
+/*
+ * Incremental SPF for router r after a few LSAs changed. Links that got
+ * worse or disappeared only matter if r's tree uses them: the routers below
+ * such a link are detached and re-attached through their best neighbor
+ * outside the detached part. Links that appeared or got cheaper are relaxed
+ * from their endpoints. A Dijkstra from those seeds then settles only the
+ * routers whose distance changes.
+ */
+static bool ls_incremental_spf(struct LinkStateSim *sim, uint32_t r) {
+    uint32_t n = sim->num_routers;
+    uint64_t *dist = &sim->dist[(size_t)r * n];
+    uint32_t *parent = &sim->parent[(size_t)r * n];
+    const uint32_t *held = &sim->lsdb[(size_t)r * n];
+    struct SearchWorkspace *ws = &sim->ws;
+    struct LsRouter *x = &sim->routers[r];
+    uint32_t size = 0;
+
+    // Detach the subtrees below tree links that got worse
+    search_begin(ws);
+    for (uint32_t c = 0; c < x->num_changes; c++) {
+        uint32_t o = x->changes[c].origin;
+        const struct LsaVersion *old_lsa = ls_lsa(sim, o, x->changes[c].old_seq);
+        const struct LsaVersion *new_lsa = ls_lsa(sim, o, held[o]);
+        sim->spf_steps += (old_lsa ? old_lsa->count : 0) + (new_lsa ? new_lsa->count : 0);
+        for (uint32_t k = 0; old_lsa && k < old_lsa->count; k++) {
+            uint32_t v = sim->lsa_neighbors[old_lsa->first + k];
+            uint64_t now_cost = ls_lsa_cost(sim, new_lsa, v);
+            if (now_cost <= sim->lsa_costs[old_lsa->first + k]) continue;
+            uint32_t root = parent[v] == o ? v : now_cost == UINT64_MAX && parent[o] == v ? o : LS_NONE;
+            if (root != LS_NONE && !search_seen(ws, root)) {
+                search_visit(ws, root, 0, 0);
+                ws->queue[size++] = root;
+            }
+        }
+    }
+    for (uint32_t i = 0; i < size; i++) {
+        uint32_t u = ws->queue[i];
+        const struct LsaVersion *lsa = ls_lsa(sim, u, held[u]);
+        if (lsa) sim->spf_steps += lsa->count;
+        for (uint32_t k = 0; lsa && k < lsa->count; k++) {
+            uint32_t y = sim->lsa_neighbors[lsa->first + k];
+            if (parent[y] == u && !search_seen(ws, y)) {
+                search_visit(ws, y, 0, 0);
+                ws->queue[size++] = y;
+            }
+        }
+    }
+    for (uint32_t i = 0; i < size; i++) {
+        dist[ws->queue[i]] = UINT64_MAX;
+        parent[ws->queue[i]] = LS_NONE;
+    }
+
+    // Re-attach each detached router through its best neighbor outside
+    ws->heap_size = 0;
+    for (uint32_t i = 0; i < size; i++) {
+        uint32_t u = ws->queue[i];
+        const struct LsaVersion *lsa = ls_lsa(sim, u, held[u]);
+        if (lsa) sim->spf_steps += lsa->count;
+        for (uint32_t k = 0; lsa && k < lsa->count; k++) {
+            uint32_t y = sim->lsa_neighbors[lsa->first + k];
+            if (search_seen(ws, y) || dist[y] == UINT64_MAX || ls_lsa_cost(sim, lsa, y) == UINT64_MAX) continue;
+            uint64_t cost = ls_lsa_cost(sim, ls_lsa(sim, y, held[y]), u);
+            if (cost == UINT64_MAX || dist[y] + cost >= dist[u]) continue;
+            dist[u] = dist[y] + cost;
+            parent[u] = y;
+        }
+        if (dist[u] != UINT64_MAX && !heap_push(ws, dist[u], u)) return false;
+    }
+
+    // Relax links that appeared or got cheaper, in both directions
+    for (uint32_t c = 0; c < x->num_changes; c++) {
+        uint32_t o = x->changes[c].origin;
+        const struct LsaVersion *old_lsa = ls_lsa(sim, o, x->changes[c].old_seq);
+        const struct LsaVersion *new_lsa = ls_lsa(sim, o, held[o]);
+        sim->spf_steps += (old_lsa ? old_lsa->count : 0) + (new_lsa ? new_lsa->count : 0);
+        for (uint32_t k = 0; new_lsa && k < new_lsa->count; k++) {
+            uint32_t v = sim->lsa_neighbors[new_lsa->first + k];
+            if (sim->lsa_costs[new_lsa->first + k] >= ls_lsa_cost(sim, old_lsa, v)) continue;
+            uint32_t ends[2] = { o, v };
+            for (int e = 0; e < 2; e++) {
+                uint32_t a = ends[e], b = ends[1 - e];
+                const struct LsaVersion *lsa_a = ls_lsa(sim, a, held[a]);
+                uint64_t cost = ls_lsa_cost(sim, lsa_a, b);
+                if (dist[a] == UINT64_MAX || cost == UINT64_MAX ||
+                    ls_lsa_cost(sim, ls_lsa(sim, b, held[b]), a) == UINT64_MAX || dist[a] + cost >= dist[b]) {
+                    continue;
+                }
+                dist[b] = dist[a] + cost;
+                parent[b] = a;
+                if (!heap_push(ws, dist[b], b)) return false;
+            }
+        }
+    }
+
+    while (ws->heap_size > 0) {
+        struct HeapItem item = heap_pop(ws);
+        uint32_t u = item.node;
+        sim->spf_steps++;
+        if (item.dist > dist[u]) continue;
+        const struct LsaVersion *lsa = ls_lsa(sim, u, held[u]);
+        if (lsa) sim->spf_steps += lsa->count;
+        for (uint32_t k = 0; lsa && k < lsa->count; k++) {
+            uint64_t cost = ls_view_cost(sim, r, lsa, u, k);
+            uint32_t v = sim->lsa_neighbors[lsa->first + k];
+            if (cost == UINT64_MAX || item.dist + cost >= dist[v]) continue;
+            dist[v] = item.dist + cost;
+            parent[v] = u;
+            if (!heap_push(ws, dist[v], v)) return false;
+        }
+    }
+    return true;
+}
+
+// Router r's SPF timer fired: recompute its tree from its current LSDB
+static bool ls_run_spf(struct LinkStateSim *sim, uint32_t r, uint64_t now) {
+    struct LsRouter *x = &sim->routers[r];
+    bool full = x->full_spf;
+    uint64_t steps = sim->spf_steps;
+    double start = now_seconds();
+    bool ok = full ? ls_full_spf(sim, r) : ls_incremental_spf(sim, r);
+    double elapsed = now_seconds() - start;
+    if (full) {
+        sim->stats.full_spf++;
+        sim->stats.full_spf_time += elapsed;
+    } else {
+        sim->stats.incremental_spf++;
+        sim->stats.incremental_spf_time += elapsed;
+    }
+    x->spf_pending = false;
+    x->full_spf = false;
+    x->num_changes = 0;
+    x->spf_runs++;
+    // Charged by the work done, not the time it took here, so runs repeat exactly
+    x->last_spf = now + (sim->spf_steps - steps) * LS_SPF_STEP_NS;
+    if (x->last_spf > sim->stats.converged_at) sim->stats.converged_at = x->last_spf;
+    return ok;
+}
+
+/**
+ * @brief Brings every router up at the current time: each one issues its
+ * first LSA, which then floods through the network.
+ * @return True on success, False if out of memory.
+ */
+bool ls_start(struct LinkStateSim *sim) {
+    uint64_t now = sim->wheel.now;
+    for (uint32_t r = 0; r < sim->num_routers; r++) {
+        if (!ls_originate_lsa(sim, r) || !ls_install(sim, r, r, sim->versions[sim->latest[r]].seq, r, now)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * @brief The link between routers a and b (0-based) changed at the current
+ * time; 'g' is the topology with the change applied. Both ends notice at
+ * once and issue new LSAs.
+ * @return True on success, False if out of memory.
+ */
+bool ls_link_changed(struct LinkStateSim *sim, const struct Graph *g, uint32_t a, uint32_t b) {
+    uint64_t now = sim->wheel.now;
+    sim->g = g;
+    uint32_t ends[2] = { a, b };
+    for (int e = 0; e < 2; e++) {
+        uint32_t r = ends[e];
+        if (!ls_originate_lsa(sim, r) || !ls_install(sim, r, r, sim->versions[sim->latest[r]].seq, r, now)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * @brief Schedules a change of the link between routers a and b (0-based)
+ * at time 'at'; 'g' (which must outlive the run) is the topology with the
+ * change applied.
+ * @return True on success, False if out of memory.
+ */
+bool ls_schedule_link_change(struct LinkStateSim *sim, const struct Graph *g, uint32_t a, uint32_t b, uint64_t at) {
+    if (sim->num_link_changes == sim->link_changes_capacity) {
+        uint32_t new_cap = sim->link_changes_capacity ? sim->link_changes_capacity * 2 : 16;
+        void *grown = realloc(sim->link_changes, (size_t)new_cap * sizeof(sim->link_changes[0]));
+        if (grown == NULL) return false;
+        sim->link_changes = grown;
+        sim->link_changes_capacity = new_cap;
+    }
+    uint32_t i = sim->num_link_changes++;
+    sim->link_changes[i].g = g;
+    sim->link_changes[i].a = a;
+    sim->link_changes[i].b = b;
+    return wheel_schedule(&sim->wheel, (struct SimEvent){ at, a, i, LS_LINK_EVENT, b });
+}
+
+/**
+ * @brief Runs the simulation until every LSA has been flooded and every
+ * pending SPF run is done. Events are LSA arrivals (SimEvent.flow is the
+ * receiving router, 'hop' the LSA's origin, 'seq' its sequence number and
+ * 'from' the neighbor that sent it), SPF timers ('hop' LS_SPF_EVENT) and
+ * scheduled link changes ('hop' LS_LINK_EVENT, 'seq' the change).
+ * @return True on success, False if out of memory.
+ */
+bool ls_run(struct LinkStateSim *sim) {
+    struct SimEvent e;
+    while (wheel_next(&sim->wheel, &e)) {
+        bool ok;
+        if (e.hop == LS_SPF_EVENT) {
+            ok = ls_run_spf(sim, e.flow, e.time);
+        } else if (e.hop == LS_LINK_EVENT) {
+            ok = ls_link_changed(sim, sim->link_changes[e.seq].g, e.flow, e.from);
+        } else {
+            // Older or duplicate copies are acknowledged and dropped
+            ok = e.seq <= sim->lsdb[(size_t)e.flow * sim->num_routers + e.hop] ||
+                 ls_install(sim, e.flow, e.hop, e.seq, e.from, e.time);
+        }
+        if (!ok) return false;
+    }
+    return sim->wheel.pending == 0;
+}
+
+/**
+ * @brief Copies every router's first hops into a next-hop table.
+ * @return True on success, False if out of memory.
+ */
+bool ls_store_next_hops(struct LinkStateSim *sim, struct NextHopTable *t) {
+    uint32_t n = sim->num_routers;
+    uint32_t *first = malloc((n ? n : 1) * sizeof(uint32_t));
+    if (first == NULL) return false;
+    for (uint32_t r = 0; r < n; r++) {
+        const uint32_t *parent = &sim->parent[(size_t)r * n];
+        memset(first, 0xFF, (size_t)n * sizeof(uint32_t));
+        for (uint32_t v = 0; v < n; v++) {
+            // Climb to the first router whose first hop is known, then fill in on the way back
+            uint32_t depth = 0, u = v;
+            while (u != r && parent[u] != LS_NONE && first[u] == LS_NONE && parent[u] != r) {
+                sim->ws.queue[depth++] = u;
+                u = parent[u];
+            }
+            uint32_t hop = u == r || parent[u] == LS_NONE ? LS_NONE : parent[u] == r ? u : first[u];
+            if (u != r) first[u] = hop;
+            while (depth > 0) first[sim->ws.queue[--depth]] = hop;
+            if (hop != LS_NONE) next_hop_set(t, r, v, graph_link_index(sim->g, r, hop));
+        }
+    }
+    free(first);
+    return true;
+}
+
+/**
+ * @brief Fills a next-hop table by simulating link-state routing from a cold
+ * start: LSA flooding, then one SPF run per router once its timer fires.
+ * @param stats Receives the flooding and SPF counts and timings.
+ * @return True on success, False if out of memory (the simulation keeps an
+ * LSDB and a shortest-path tree per router, 16 bytes per router pair).
+ */
+bool ls_build_next_hops(struct NextHopTable *t, const struct Graph *g, struct LsStats *stats) {
+    struct LinkStateSim sim;
+    bool ok = ls_init(&sim, g) && ls_start(&sim) && ls_run(&sim) && next_hop_table_alloc(t, g);
+    if (ok && !ls_store_next_hops(&sim, t)) {
+        next_hop_table_free(t);
+        ok = false;
+    }
+    *stats = sim.stats;
+    ls_free(&sim);
+    return ok;
+}
+
+// =======================================================
+// EQUAL-COST MULTIPATH
+// =======================================================
+
+/**
+ * @brief Hashes a flow (source and destination address) for ECMP: CRC32C
+ * with SSE4.2, a multiply-shift hash otherwise. Every packet of a flow gets
+ * the same hash, so a flow stays on one path.
+ */
+static inline uint32_t flow_hash(uint32_t src, uint32_t dst) {
+#ifdef __SSE4_2__
+    return (uint32_t)_mm_crc32_u64(0, route_key_pack(src, dst));
+#else
+    return (uint32_t)route_key_hash(route_key_pack(src, dst));
+#endif
+}
+
+// Picks one of 'count' equal-cost next hops of 'router' for a flow. The
+// router is mixed in with a non-linear finalizer (MurmurHash3's): with a
+// linear one such as CRC, every router would split the flows the same way
+// and most equal-cost paths would stay unused (hash polarization).
+static inline uint32_t ecmp_select(uint32_t flow, uint32_t router, uint32_t count) {
+    uint32_t h = flow ^ (router * 0x9E3779B1u);
+    h ^= h >> 16;
+    h *= 0x85EBCA6Bu;
+    h ^= h >> 13;
+    h *= 0xC2B2AE35u;
+    h ^= h >> 16;
+    return (uint32_t)(((uint64_t)h * count) >> 32);
+}
+
+// True if link e of router u starts a shortest path, given each router's
+// distance 'to' the destination (UINT64_MAX = unknown). 'tree' is one hop
+// known to qualify; zero-cost links only qualify through it, so a walk can
+// never cycle.
+static inline bool ecmp_link_ok(const struct Graph *g, uint64_t e, uint64_t dist_u, uint64_t dist_v, uint32_t tree) {
+    uint64_t w = graph_link_weight(g, e);
+    return g->neighbors[e] == tree || (w > 0 && dist_v != UINT64_MAX && dist_v + w == dist_u);
+}
+
+/**
+ * @brief Computes a shortest path for one flow, choosing among all
+ * equal-cost next hops at every router with ecmp_select(). The search runs
+ * from the destination, so the distance to it is known for every router
+ * closer than the source.
+ * @param src Source router (1-based).
+ * @param dst Destination router (1-based).
+ * @param flow Flow hash (see flow_hash).
+ * @param out Receives the path as 1-based router IDs (appended).
+ * @param cost Receives the path cost; may be NULL.
+ * @return True if a path exists, False if dst is unreachable or out of memory.
+ */
+bool graph_ecmp_path(const struct Graph *g, struct SearchWorkspace *ws, uint32_t src, uint32_t dst, uint32_t flow,
+                     struct PathBuilder *out, uint64_t *cost) {
+    uint32_t s = src - 1, d = dst - 1;
+    search_begin(ws);
+    bool found = g->weights ? search_dijkstra(g, ws, d, s) : search_bfs(g, ws, d, s);
+    if (!found) return false;
+
+    for (uint32_t u = s;;) {
+        if (!path_builder_push(out, u + 1)) return false;
+        if (u == d) break;
+        // Two passes over the row: count the distinct next hops, then take the chosen one
+        uint32_t count = 0, pick = UINT32_MAX, last = UINT32_MAX;
+        for (int pass = 0; pass < 2; pass++) {
+            uint32_t k = 0;
+            last = UINT32_MAX;
+            for (uint64_t e = g->offsets[u]; e < g->offsets[u + 1]; e++) {
+                uint32_t v = g->neighbors[e];
+                if (v == last) continue; // Parallel links lead to the same router
+                uint64_t dist_v = search_seen(ws, v) ? ws->dist[v] : UINT64_MAX;
+                if (!ecmp_link_ok(g, e, ws->dist[u], dist_v, ws->parent[u])) continue;
+                last = v;
+                if (pass == 1 && k == pick) break;
+                k++;
+            }
+            if (pass == 0) {
+                count = k;
+                pick = ecmp_select(flow, u, count);
+            }
+        }
+        u = last;
+    }
+    if (cost) *cost = ws->dist[s];
+    return true;
+}
+
+// Distance from u to d along the table's routes, remembered in the workspace
+// for the rest of the query (search_begin() forgets). A walk stops at the
+// first router whose distance is already known and fills in the routers it
+// crossed, so routes that merge are only walked once.
+static uint64_t next_hop_distance_cached(const struct NextHopTable *t, const struct Graph *g,
+                                         struct SearchWorkspace *ws, uint32_t u, uint32_t d) {
+    uint32_t depth = 0;
+    uint64_t dist = 0;
+    while (u != d && !search_seen(ws, u)) {
+        uint32_t link = next_hop_get(t, u, d);
+        if (link == NEXT_HOP_NONE || depth >= t->num_routers) {
+            dist = UINT64_MAX;
+            break;
+        }
+        ws->queue[depth++] = u;
+        u = g->neighbors[g->offsets[u] + link];
+    }
+    if (dist != UINT64_MAX) dist = u == d ? 0 : ws->dist[u];
+    while (depth > 0) {
+        uint32_t x = ws->queue[--depth];
+        if (dist != UINT64_MAX) dist += graph_link_weight(g, g->offsets[x] + next_hop_get(t, x, d));
+        search_visit(ws, x, dist, 0);
+    }
+    return dist;
+}
+
+/**
+ * @brief Same as graph_ecmp_path(), with distances taken from a next-hop
+ * table instead of a search. The table's own next hop always qualifies.
+ * @param ws Scratch space of the calling thread; remembers the distances
+ * walked so far, so each router's distance is walked at most once per query.
+ */
+bool next_hop_ecmp_path(const struct NextHopTable *t, const struct Graph *g, struct SearchWorkspace *ws,
+                        uint32_t src, uint32_t dst, uint32_t flow, struct PathBuilder *out, uint64_t *cost) {
+    uint32_t s = src - 1, d = dst - 1;
+    search_begin(ws);
+    uint64_t dist_u = next_hop_distance_cached(t, g, ws, s, d);
+    if (dist_u == UINT64_MAX) return false;
+    if (cost) *cost = dist_u;
+
+    for (uint32_t u = s;;) {
+        if (!path_builder_push(out, u + 1)) return false;
+        if (u == d) break;
+        uint32_t tree = g->neighbors[g->offsets[u] + next_hop_get(t, u, d)];
+        uint32_t count = 0, pick = UINT32_MAX, last = UINT32_MAX;
+        uint64_t last_dist = 0;
+        for (int pass = 0; pass < 2; pass++) {
+            uint32_t k = 0;
+            last = UINT32_MAX;
+            for (uint64_t e = g->offsets[u]; e < g->offsets[u + 1]; e++) {
+                uint32_t v = g->neighbors[e];
+                if (v == last) continue;
+                // Only routers strictly closer can qualify; skip the table walk for the rest
+                uint64_t w = graph_link_weight(g, e);
+                uint64_t dist_v = v == tree || (w > 0 && w <= dist_u) ? next_hop_distance_cached(t, g, ws, v, d)
+                                                                       : UINT64_MAX;
+                if (!ecmp_link_ok(g, e, dist_u, dist_v, tree)) continue;
+                last = v;
+                last_dist = dist_v;
+                if (pass == 1 && k == pick) break;
+                k++;
+            }
+            if (pass == 0) {
+                count = k;
+                pick = ecmp_select(flow, u, count);
+            }
+        }
+        u = last;
+        dist_u = last_dist;
+    }
+    return true;
+}
+
+// Flows carried per directed link, keyed by route_key_pack(from, to) of the
+// 1-based routers. Keyed by routers rather than CSR index, so the counts
+// survive topology changes.
+struct LinkLoad {
+    uint64_t *keys;  // ROUTE_CACHE_EMPTY = free slot
+    uint64_t *flows;
+    uint64_t mask;
+    size_t count;
+};
+
+bool link_load_init(struct LinkLoad *load) {
+    load->mask = 15;
+    load->count = 0;
+    load->keys = malloc((load->mask + 1) * sizeof(uint64_t));
+    load->flows = calloc(load->mask + 1, sizeof(uint64_t));
+    if (load->keys == NULL || load->flows == NULL) return false;
+    for (uint64_t i = 0; i <= load->mask; i++) load->keys[i] = ROUTE_CACHE_EMPTY;
+    return true;
+}
+
+void link_load_free(struct LinkLoad *load) {
+    free(load->keys);
+    free(load->flows);
+    memset(load, 0, sizeof(*load));
+}
+
+/**
+ * @brief Adds 'flows' to the directed link from -> to (1-based routers).
+ * @return True on success, False if out of memory.
+ */
+bool link_load_add(struct LinkLoad *load, uint32_t from, uint32_t to, uint64_t flows) {
+    uint64_t key = route_key_pack(from, to);
+    uint64_t i = route_key_hash(key) & load->mask;
+    while (load->keys[i] != key && load->keys[i] != ROUTE_CACHE_EMPTY) i = (i + 1) & load->mask;
+    if (load->keys[i] == key) {
+        load->flows[i] += flows;
+        return true;
+    }
+
+    // New link: keep the load factor below 50%
+    if ((load->count + 1) * 2 > load->mask + 1) {
+        struct LinkLoad bigger;
+        bigger.mask = load->mask * 2 + 1;
+        bigger.count = load->count;
+        bigger.keys = malloc((bigger.mask + 1) * sizeof(uint64_t));
+        bigger.flows = calloc(bigger.mask + 1, sizeof(uint64_t));
+        if (bigger.keys == NULL || bigger.flows == NULL) {
+            link_load_free(&bigger);
+            return false;
+        }
+        for (uint64_t j = 0; j <= bigger.mask; j++) bigger.keys[j] = ROUTE_CACHE_EMPTY;
+        for (uint64_t j = 0; j <= load->mask; j++) {
+            if (load->keys[j] == ROUTE_CACHE_EMPTY) continue;
+            uint64_t k = route_key_hash(load->keys[j]) & bigger.mask;
+            while (bigger.keys[k] != ROUTE_CACHE_EMPTY) k = (k + 1) & bigger.mask;
+            bigger.keys[k] = load->keys[j];
+            bigger.flows[k] = load->flows[j];
+        }
+        link_load_free(load);
+        *load = bigger;
+        i = route_key_hash(key) & load->mask;
+        while (load->keys[i] != ROUTE_CACHE_EMPTY) i = (i + 1) & load->mask;
+    }
+    load->keys[i] = key;
+    load->flows[i] = flows;
+    load->count++;
+    return true;
+}
+
+// Counts one flow on every link of a path
+static inline bool link_load_add_path(struct LinkLoad *load, const uint32_t *hops, uint32_t length) {
+    for (uint32_t i = 1; i < length; i++) {
+        if (!link_load_add(load, hops[i - 1], hops[i], 1)) return false;
+    }
+    return true;
+}
+
+static int compare_uint64(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return (x > y) - (x < y);
+}
+
+/**
+ * @brief Prints how evenly flows spread over the links that carried any:
+ * mean, median, 99th percentile and maximum flows per link, and the busiest link.
+ */
+void link_load_print(const struct LinkLoad *load, const char *label, FILE *out) {
+    uint64_t *flows = malloc((load->count ? load->count : 1) * sizeof(uint64_t));
+    uint64_t total = 0, max = 0, busiest = 0;
+    size_t n = 0;
+    if (flows == NULL) return;
+    for (uint64_t i = 0; i <= load->mask; i++) {
+        if (load->keys[i] == ROUTE_CACHE_EMPTY) continue;
+        if (load->flows[i] > max) {
+            max = load->flows[i];
+            busiest = load->keys[i];
+        }
+        total += load->flows[i];
+        flows[n++] = load->flows[i];
+    }
+    if (n == 0) {
+        fprintf(out, "%s: no links used\n", label);
+        free(flows);
+        return;
+    }
+    qsort(flows, n, sizeof(uint64_t), compare_uint64);
+    double mean = (double)total / n;
+    fprintf(out, "%s: %zu directed links used, flows per link mean %.1f, p50 %llu, p99 %llu, max %llu "
+            "(%.2fx mean, R%u->R%u)\n", label, n, mean, (unsigned long long)flows[n / 2],
+            (unsigned long long)flows[(size_t)(n * 0.99)], (unsigned long long)max, max / mean,
+            (uint32_t)(busiest >> 32), (uint32_t)busiest);
+    free(flows);
+}
+
+// =======================================================
+// CONFIGURATION FILES
+// =======================================================
+
+// Read-only mapping of a whole file
+struct MappedFile {
+    const char *data;
+    size_t size;
+};
+
+// Cursor over the lines of a mapped file
+struct LineReader {
+    const char *p;
+    const char *end;
+    uint64_t line;
+};
+
+/**
+ * @brief Maps a file read-only. Empty files map to a NULL data pointer.
+ * @return True on success, False if the file cannot be opened or mapped.
+ */
+bool map_file(const char *path, struct MappedFile *file) {
+    struct stat st;
+    int fd = open(path, O_RDONLY);
+    memset(file, 0, sizeof(*file));
+    if (fd < 0) return false;
+    if (fstat(fd, &st) != 0) {
+        close(fd);
+        return false;
+    }
+    if (st.st_size > 0) {
+        void *data = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (data == MAP_FAILED) {
+            close(fd);
+            return false;
+        }
+        madvise(data, (size_t)st.st_size, MADV_SEQUENTIAL);
+        file->data = data;
+        file->size = (size_t)st.st_size;
+    }
+    close(fd);
+    return true;
+}
+
+void unmap_file(struct MappedFile *file) {
+    if (file->data) munmap((void *)file->data, file->size);
+    memset(file, 0, sizeof(*file));
+}
+
+/**
+ * @brief Returns the next line that has content, without its comment ('#')
+ * and leading separators. Fields may still end with separators.
+ * @return True if a line was found, False at the end of the file.
+ */
+static bool next_config_line(struct LineReader *r, const char **start, const char **stop) {
+    while (r->p < r->end) {
+        const char *line = r->p;
+        const char *newline = memchr(line, '\n', (size_t)(r->end - line));
+        const char *line_end = newline ? newline : r->end;
+        r->p = newline ? newline + 1 : r->end;
+        r->line++;
+
+        const char *comment = memchr(line, '#', (size_t)(line_end - line));
+        if (comment) line_end = comment;
+        line = skip_field_separators(line, line_end);
+        if (line < line_end) {
+            *start = line;
+            *stop = line_end;
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * @brief Loads a topology from an edge list: one undirected link per line,
+ * "router router [cost]" with blank- or comma-separated 1-based router IDs.
+ * Instead of a cost, "latency=us" and/or "bandwidth=mbps" derive one (see
+ * scan_link_metrics). The router count is the highest ID seen. Any cost
+ * makes the graph weighted; links without one cost 1.
+ * @return True on success, False (after printing the reason) otherwise.
+ */
+bool load_topology_file(const char *path, struct Graph *g) {
+    struct MappedFile file;
+    if (!map_file(path, &file)) {
+        printf("Error: Cannot read topology file '%s'.\n", path);
+        return false;
+    }
+
+    size_t capacity = file.size / 4 + 16;
+    struct Edge *edges = malloc(capacity * sizeof(struct Edge));
+    uint64_t count = 0;
+    uint32_t max_router = 0;
+    bool weighted = false;
+    bool ok = false;
+    struct LineReader reader = { file.data, file.data + file.size, 0 };
+    const char *p, *stop;
+
+    if (edges == NULL) goto out_of_memory;
+    while (next_config_line(&reader, &p, &stop)) {
+        uint32_t a, b, cost = 1;
+        p = scan_uint(p, stop, &a);
+        if (p) p = scan_uint(skip_field_separators(p, stop), stop, &b);
+        if (p) {
+            p = skip_field_separators(p, stop);
+            if (p < stop) weighted = true;
+            p = scan_link_metrics(p, stop, &cost);
+        }
+        if (p == NULL || a == 0 || b == 0) {
+            printf("Error: %s:%llu: expected \"router router [cost | latency=us bandwidth=mbps]\".\n", path,
+                   (unsigned long long)reader.line);
+            goto done;
+        }
+        if (a == b) continue;
+
+        if (count + 2 > capacity) {
+            capacity *= 2;
+            struct Edge *grown = realloc(edges, capacity * sizeof(struct Edge));
+            if (grown == NULL) goto out_of_memory;
+            edges = grown;
+        }
+        edges[count++] = (struct Edge){ a - 1, b - 1, cost };
+        edges[count++] = (struct Edge){ b - 1, a - 1, cost };
+        if (a > max_router) max_router = a;
+        if (b > max_router) max_router = b;
+    }
+
+    if (max_router == 0) {
+        printf("Error: Topology file '%s' has no links.\n", path);
+        goto done;
+    }
+    if (graph_build(g, max_router, edges, count, weighted)) {
+        ok = true;
+        goto done;
+    }
+    graph_free(g);
+
+out_of_memory:
+    printf("Error: Out of memory while loading '%s'.\n", path);
+done:
+    free(edges);
+    unmap_file(&file);
+    return ok;
+}
+
+/**
+ * @brief Appends a network to the router configuration.
+ * @return True on success, False if out of memory.
+ */
+bool router_config_add(struct RouterConfig *config, uint32_t router, uint32_t prefix, uint8_t prefix_len) {
+    if (config->count == config->capacity) {
+        size_t capacity = config->capacity ? config->capacity * 2 : 16;
+        uint32_t *prefixes = realloc(config->prefixes, capacity * sizeof(uint32_t));
+        if (prefixes == NULL) return false;
+        config->prefixes = prefixes;
+        uint8_t *prefix_lens = realloc(config->prefix_lens, capacity);
+        if (prefix_lens == NULL) return false;
+        config->prefix_lens = prefix_lens;
+        uint32_t *routers = realloc(config->routers, capacity * sizeof(uint32_t));
+        if (routers == NULL) return false;
+        config->routers = routers;
+        config->capacity = capacity;
+    }
+    config->prefixes[config->count] = prefix;
+    config->prefix_lens[config->count] = prefix_len;
+    config->routers[config->count] = router;
+    config->count++;
+    return true;
+}
+
+void router_config_free(struct RouterConfig *config) {
+    free(config->prefixes);
+    free(config->prefix_lens);
+    free(config->routers);
+    memset(config, 0, sizeof(*config));
+}
+
+/**
+ * @brief Loads the networks joined to each router: one per line,
+ * "router a.b.c.d[/len]" with a blank or comma between the fields.
+ * Every network goes into the configuration, then into the forwarding table
+ * as one batch.
+ * @param num_routers Highest valid router ID (the topology size).
+ * @return True on success, False (after printing the reason) otherwise.
+ */
+bool load_networks_file(const char *path, uint32_t num_routers, struct RouterConfig *config, struct Fib *fib) {
+    struct MappedFile file;
+    if (!map_file(path, &file)) {
+        printf("Error: Cannot read networks file '%s'.\n", path);
+        return false;
+    }
+
+    struct LineReader reader = { file.data, file.data + file.size, 0 };
+    const char *p, *stop;
+    size_t first = config->count;
+    bool ok = true, out_of_memory = false;
+
+    while (next_config_line(&reader, &p, &stop)) {
+        uint32_t router, prefix;
+        uint8_t prefix_len;
+        p = scan_uint(p, stop, &router);
+        // The address scan may read past the line, but never past the mapping
+        if (p) p = scan_prefix(skip_field_separators(p, stop), reader.end, &prefix, &prefix_len);
+        if (p) p = skip_field_separators(p, stop);
+        if (p == NULL || p != stop || router == 0 || router > num_routers) {
+            printf("Error: %s:%llu: expected \"router a.b.c.d[/len]\" with a router between 1 and %u.\n", path,
+                   (unsigned long long)reader.line, num_routers);
+            ok = false;
+            break;
+        }
+        if (!router_config_add(config, router, prefix, prefix_len)) {
+            ok = false;
+            out_of_memory = true;
+            break;
+        }
+    }
+    if (ok && !fib_insert_batch(fib, config->prefixes + first, config->prefix_lens + first, config->routers + first,
+                                config->count - first)) {
+        ok = false;
+        out_of_memory = true;
+    }
+    if (out_of_memory) printf("Error: Out of memory while loading '%s'.\n", path);
+
+    unmap_file(&file);
+    return ok;
+}
+
+// =======================================================
+// COMPILED NETWORK IMAGES
+// =======================================================
+
+// Image layout: header, then 64-byte aligned sections at the offsets it
+// records. Offsets are relative to the start of the file, so the mapping can
+// sit at any address; the arrays are used in place, exactly as built.
+#define IMAGE_MAGIC "RTRIMAGE"
+#define IMAGE_VERSION 1
+#define IMAGE_BYTE_ORDER 0x01020304u
+#define IMAGE_ALIGN 64
+
+struct ImageSection {
+    uint64_t offset;
+    uint64_t bytes; // 0 = absent
+};
+
+struct ImageHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t byte_order;     // IMAGE_BYTE_ORDER as stored by the writer
+    uint32_t header_bytes;   // Struct sizes of the writer: images are only
+    uint32_t fib_node_bytes; // valid for the same layout
+    uint64_t file_bytes;
+    uint32_t num_routers;
+    uint32_t fib_count;
+    uint32_t fib_num_prefixes;
+    uint32_t next_hop_entry_bytes; // 0 = no next-hop table
+    uint64_t num_links;
+    uint64_t bits_words;
+    uint64_t next_hop_row_stride;
+    struct ImageSection offsets, neighbors, weights, link_bits, fib_nodes, fib_direct, next_hops;
+};
+
+// A mapped image; the network structures loaded from it point into 'data'
+struct NetworkImage {
+    void *data;
+    size_t size;
+};
+
+// Image behind the global network (--image), unmapped by free_network
+struct NetworkImage router_image;
+
+// Appends one section (zero-padded to IMAGE_ALIGN) and records where it went
+static bool image_put(FILE *f, uint64_t *at, struct ImageSection *s, const void *data, uint64_t bytes) {
+    static const char zeros[IMAGE_ALIGN];
+    uint64_t pad = (IMAGE_ALIGN - bytes % IMAGE_ALIGN) % IMAGE_ALIGN;
+    s->offset = bytes ? *at : 0;
+    s->bytes = bytes;
+    if (bytes && (fwrite(data, 1, bytes, f) != bytes || fwrite(zeros, 1, pad, f) != pad)) return false;
+    *at += bytes + pad;
+    return true;
+}
+
+/**
+ * @brief Writes the topology, forwarding table (trie and direct index) and,
+ * if given, the next-hop table to a network image. The file is written under
+ * a temporary name and renamed, so running simulators that have the old image
+ * mapped keep a consistent copy.
+ * @param t Next-hop table, or NULL to leave it out.
+ * @return True on success, False (after printing the reason) otherwise.
+ */
+bool image_write(const char *path, const struct Graph *g, const struct Fib *fib, const struct NextHopTable *t) {
+    if (!fib->direct_valid) {
+        printf("Error: The forwarding table index must be built before compiling.\n");
+        return false;
+    }
+    size_t path_len = strlen(path);
+    char *tmp_path = malloc(path_len + 5);
+    if (tmp_path == NULL) {
+        printf("Error: Out of memory.\n");
+        return false;
+    }
+    memcpy(tmp_path, path, path_len);
+    memcpy(tmp_path + path_len, ".tmp", 5);
+
+    struct ImageHeader h;
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, IMAGE_MAGIC, sizeof(h.magic));
+    h.version = IMAGE_VERSION;
+    h.byte_order = IMAGE_BYTE_ORDER;
+    h.header_bytes = sizeof(struct ImageHeader);
+    h.fib_node_bytes = sizeof(struct FibNode);
+    h.num_routers = g->num_routers;
+    h.num_links = g->num_links;
+    h.bits_words = g->bits_words;
+    h.fib_count = fib->count;
+    h.fib_num_prefixes = fib->num_prefixes;
+    if (t) {
+        h.next_hop_entry_bytes = t->entry_bytes;
+        h.next_hop_row_stride = t->row_stride;
+    }
+
+    uint64_t n = g->num_routers;
+    uint64_t at = (sizeof(h) + IMAGE_ALIGN - 1) / IMAGE_ALIGN * IMAGE_ALIGN;
+    FILE *f = fopen(tmp_path, "wb");
+    bool ok = f != NULL && fseek(f, (long)at, SEEK_SET) == 0 &&
+              image_put(f, &at, &h.offsets, g->offsets, (n + 1) * sizeof(uint64_t)) &&
+              image_put(f, &at, &h.neighbors, g->neighbors, g->num_links * sizeof(uint32_t)) &&
+              image_put(f, &at, &h.weights, g->weights, g->weights ? g->num_links * sizeof(uint32_t) : 0) &&
+              image_put(f, &at, &h.link_bits, g->link_bits, g->link_bits ? n * g->bits_words * sizeof(uint64_t) : 0) &&
+              image_put(f, &at, &h.fib_nodes, fib->nodes, (uint64_t)fib->count * sizeof(struct FibNode)) &&
+              image_put(f, &at, &h.fib_direct, fib->direct, sizeof(struct FibDirectEntry) << FIB_DIRECT_BITS) &&
+              image_put(f, &at, &h.next_hops, t ? t->entries : NULL, t ? n * t->row_stride * t->entry_bytes : 0);
+    h.file_bytes = at;
+    ok = ok && fseek(f, 0, SEEK_SET) == 0 && fwrite(&h, sizeof(h), 1, f) == 1;
+    if (f != NULL && fclose(f) != 0) ok = false;
+    if (ok && rename(tmp_path, path) != 0) ok = false;
+    if (!ok) {
+        printf("Error: Cannot write image '%s'.\n", path);
+        unlink(tmp_path);
+    }
+    free(tmp_path);
+    return ok;
+}
+
+// Section check: inside the file, aligned, and exactly the size the counts imply
+static bool image_section_ok(const struct ImageSection *s, uint64_t expected, size_t file_size) {
+    return s->bytes == expected && s->offset % IMAGE_ALIGN == 0 && s->offset <= file_size &&
+           s->bytes <= file_size - s->offset;
+}
+
+/**
+ * @brief Maps a network image read-only and points the topology, forwarding
+ * table and next-hop table at its sections, without copying or parsing them.
+ * Pages are read on first use. The image is trusted beyond the header and
+ * section checks: only load images compiled by this program.
+ * @param t Receives the next-hop table; num_routers is 0 if the image has none.
+ * @return True on success, False (after printing the reason) otherwise.
+ */
+bool image_open(const char *path, struct NetworkImage *img, struct Graph *g, struct Fib *fib,
+                struct NextHopTable *t) {
+    struct stat st;
+    int fd = open(path, O_RDONLY);
+    memset(img, 0, sizeof(*img));
+    if (fd < 0 || fstat(fd, &st) != 0) {
+        if (fd >= 0) close(fd);
+        printf("Error: Cannot read image '%s'.\n", path);
+        return false;
+    }
+    if ((size_t)st.st_size < sizeof(struct ImageHeader)) {
+        close(fd);
+        printf("Error: '%s' is not a valid network image.\n", path);
+        return false;
+    }
+    void *data = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        printf("Error: Cannot map image '%s'.\n", path);
+        return false;
+    }
+    img->data = data;
+    img->size = (size_t)st.st_size;
+
+    const struct ImageHeader *h = data;
+    const char *base = data;
+    uint64_t n = h->num_routers;
+    bool ok = memcmp(h->magic, IMAGE_MAGIC, sizeof(h->magic)) == 0;
+    if (ok && (h->version != IMAGE_VERSION || h->byte_order != IMAGE_BYTE_ORDER ||
+               h->header_bytes != sizeof(struct ImageHeader) || h->fib_node_bytes != sizeof(struct FibNode))) {
+        printf("Error: Image '%s' was compiled by an incompatible version; compile it again.\n", path);
+        munmap(data, img->size);
+        memset(img, 0, sizeof(*img));
+        return false;
+    }
+    ok = ok && h->file_bytes == img->size && n > 0 && h->fib_count > 0 &&
+         image_section_ok(&h->offsets, (n + 1) * sizeof(uint64_t), img->size) &&
+         image_section_ok(&h->neighbors, h->num_links * sizeof(uint32_t), img->size) &&
+         image_section_ok(&h->weights, h->weights.bytes ? h->num_links * sizeof(uint32_t) : 0, img->size) &&
+         image_section_ok(&h->link_bits, h->link_bits.bytes ? n * h->bits_words * sizeof(uint64_t) : 0, img->size) &&
+         image_section_ok(&h->fib_nodes, (uint64_t)h->fib_count * sizeof(struct FibNode), img->size) &&
+         image_section_ok(&h->fib_direct, sizeof(struct FibDirectEntry) << FIB_DIRECT_BITS, img->size) &&
+         image_section_ok(&h->next_hops, n * h->next_hop_row_stride * h->next_hop_entry_bytes, img->size) &&
+         ((const uint64_t *)(base + h->offsets.offset))[n] == h->num_links;
+    if (!ok) {
+        printf("Error: '%s' is not a valid network image.\n", path);
+        munmap(data, img->size);
+        memset(img, 0, sizeof(*img));
+        return false;
+    }
+
+    g->num_routers = h->num_routers;
+    g->num_links = h->num_links;
+    g->bits_words = h->bits_words;
+    g->offsets = (uint64_t *)(base + h->offsets.offset);
+    g->neighbors = (uint32_t *)(base + h->neighbors.offset);
+    g->weights = h->weights.bytes ? (uint32_t *)(base + h->weights.offset) : NULL;
+    g->link_bits = h->link_bits.bytes ? (uint64_t *)(base + h->link_bits.offset) : NULL;
+
+    memset(fib, 0, sizeof(*fib));
+    fib->nodes = (struct FibNode *)(base + h->fib_nodes.offset);
+    fib->count = fib->capacity = h->fib_count;
+    fib->num_prefixes = h->fib_num_prefixes;
+    fib->direct = (struct FibDirectEntry *)(base + h->fib_direct.offset);
+    fib->direct_valid = true;
+    fib_build_small(fib);
+
+    memset(t, 0, sizeof(*t));
+    if (h->next_hops.bytes) {
+        t->num_routers = h->num_routers;
+        t->row_stride = h->next_hop_row_stride;
+        t->entry_bytes = (uint8_t)h->next_hop_entry_bytes;
+        t->entries = (uint8_t *)(base + h->next_hops.offset);
+    }
+    return true;
+}
+
+void image_close(struct NetworkImage *img) {
+    if (img->data) munmap(img->data, img->size);
+    memset(img, 0, sizeof(*img));
+}
+
+// =======================================================
+// ROUTE CACHE FILES
+// =======================================================
+
+// Route cache file: header, then one record per route, all 32-bit words:
+// key source, key destination, cost (ROUTE_COST_MAX if it does not fit), hop count, hops
+#define CACHE_FILE_MAGIC "RTRCACHE"
+#define CACHE_FILE_VERSION 1
+
+struct CacheFileHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t byte_order;  // IMAGE_BYTE_ORDER as stored by the writer
+    uint64_t fingerprint; // network_fingerprint of the network the routes were computed on
+    uint64_t num_routes;
+    uint64_t record_words;
+};
+
+static inline uint64_t fingerprint_mix(uint64_t h, uint64_t v) {
+    h = (h ^ v) * 0x9E3779B97F4A7C15ull;
+    return h ^ (h >> 29);
+}
+
+static uint64_t fingerprint_words(uint64_t h, const uint32_t *words, uint64_t count) {
+    for (uint64_t i = 0; i < count; i++) h = fingerprint_mix(h, words[i]);
+    return h;
+}
+
+/**
+ * @brief Hashes everything a cached route depends on: the links and their
+ * costs, how routes are keyed and chosen (--ecmp), and with address-pair
+ * keys also the prefixes, since they decide which routers an address uses.
+ */
+uint64_t network_fingerprint(const struct NetworkSnapshot *net) {
+    const struct Graph *g = net->graph;
+    uint64_t h = fingerprint_mix(0, g->num_routers);
+    h = fingerprint_mix(h, g->num_links);
+    // Routing mode: hand-entered routes, searches and the ways of filling the
+    // next-hop table may pick different routes, so their caches do not mix
+    h = fingerprint_mix(h, (uint64_t)link_state_mode << 5 | (uint64_t)distance_vector_mode << 4 |
+                               (uint64_t)precompute_mode << 3 | (uint64_t)auto_route_mode << 2 |
+                               (uint64_t)ecmp_mode << 1 | route_cache_per_flow);
+    for (uint64_t i = 0; i <= g->num_routers; i++) h = fingerprint_mix(h, g->offsets[i]);
+    h = fingerprint_words(h, g->neighbors, g->num_links);
+    if (g->weights) h = fingerprint_words(h, g->weights, g->num_links);
+    if (route_cache_per_flow) {
+        for (uint32_t i = 0; i < net->fib->count; i++) {
+            const struct FibNode *n = &net->fib->nodes[i];
+            if (n->router) h = fingerprint_mix(h, (uint64_t)n->prefix << 32 | (uint64_t)n->len << 24 | (uint32_t)n->router);
+        }
+    }
+    return h;
+}
+
+// Routes collected for a route cache file; 'seen' drops keys that several
+// caches (one per batch thread) hold
+struct CacheDump {
+    uint32_t *words;
+    size_t used;
+    size_t capacity;
+    uint64_t routes;
+    struct RouteCache seen;
+};
+
+bool cache_dump_init(struct CacheDump *d) {
+    memset(d, 0, sizeof(*d));
+    return route_cache_init(&d->seen, 0);
+}
+
+void cache_dump_free(struct CacheDump *d) {
+    free(d->words);
+    route_cache_free(&d->seen);
+    memset(d, 0, sizeof(*d));
+}
+
+/**
+ * @brief Appends the routes of a cache whose keys are not in the dump yet.
+ * @return True on success, False if out of memory.
+ */
+bool cache_dump_add(struct CacheDump *d, const struct RouteCache *cache, const struct PathPool *pool) {
+    for (uint64_t i = 0; cache->keys && i <= cache->mask; i++) {
+        uint64_t key = cache->keys[i];
+        if (key == ROUTE_CACHE_EMPTY) continue;
+        uint32_t src = (uint32_t)(key >> 32), dst = (uint32_t)key;
+        if (route_cache_find(&d->seen, src, dst, NULL)) continue;
+        if (!route_cache_insert(&d->seen, src, dst, 1, 0)) return false;
+
+        uint32_t hop_count;
+        const uint32_t *hops = path_pool_hops(pool, cache->values[i].path, &hop_count);
+        if (d->used + 4 + hop_count > d->capacity) {
+            size_t capacity = d->capacity ? d->capacity : 4096;
+            while (capacity < d->used + 4 + hop_count) capacity *= 2;
+            uint32_t *grown = realloc(d->words, capacity * sizeof(uint32_t));
+            if (grown == NULL) return false;
+            d->words = grown;
+            d->capacity = capacity;
+        }
+        uint32_t *w = d->words + d->used;
+        w[0] = src;
+        w[1] = dst;
+        w[2] = cache->values[i].cost;
+        w[3] = hop_count;
+        memcpy(w + 4, hops, hop_count * sizeof(uint32_t));
+        d->used += 4 + hop_count;
+        d->routes++;
+    }
+    return true;
+}
+
+/**
+ * @brief Writes the collected routes under a temporary name and renames the
+ * file into place, so a crash mid-write leaves the previous file intact.
+ * @return True on success, False otherwise.
+ */
+bool cache_dump_write(const struct CacheDump *d, const char *path, uint64_t fingerprint) {
+    struct CacheFileHeader h;
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, CACHE_FILE_MAGIC, sizeof(h.magic));
+    h.version = CACHE_FILE_VERSION;
+    h.byte_order = IMAGE_BYTE_ORDER;
+    h.fingerprint = fingerprint;
+    h.num_routes = d->routes;
+    h.record_words = d->used;
+
+    size_t path_len = strlen(path);
+    char *tmp_path = malloc(path_len + 5);
+    if (tmp_path == NULL) return false;
+    memcpy(tmp_path, path, path_len);
+    memcpy(tmp_path + path_len, ".tmp", 5);
+    FILE *f = fopen(tmp_path, "wb");
+    bool ok = f != NULL && fwrite(&h, sizeof(h), 1, f) == 1 &&
+              (d->used == 0 || fwrite(d->words, sizeof(uint32_t), d->used, f) == d->used);
+    if (f != NULL && fclose(f) != 0) ok = false;
+    if (ok && rename(tmp_path, path) != 0) ok = false;
+    if (!ok) unlink(tmp_path);
+    free(tmp_path);
+    return ok;
+}
+
+/**
+ * @brief Maps a route cache file and checks that it was saved for this
+ * network. A missing, damaged or stale file is reported on 'status' and the
+ * run starts with an empty cache.
+ * @return True if the file can be restored with route_cache_restore.
+ */
+bool route_cache_file_open(const char *path, uint64_t fingerprint, struct MappedFile *file, FILE *status) {
+    if (!map_file(path, file)) {
+        fprintf(status, "No route cache in '%s' yet; starting with an empty cache.\n", path);
+        return false;
+    }
+    const struct CacheFileHeader *h = (const struct CacheFileHeader *)file->data;
+    bool valid = file->size >= sizeof(*h) && memcmp(h->magic, CACHE_FILE_MAGIC, sizeof(h->magic)) == 0 &&
+                 h->version == CACHE_FILE_VERSION && h->byte_order == IMAGE_BYTE_ORDER &&
+                 h->record_words == (file->size - sizeof(*h)) / sizeof(uint32_t);
+    if (!valid) {
+        fprintf(status, "'%s' is not a valid route cache file; starting with an empty cache.\n", path);
+    } else if (h->fingerprint != fingerprint) {
+        fprintf(status, "Route cache '%s' was saved for a different network or routing mode; starting with an empty cache.\n", path);
+        valid = false;
+    }
+    if (!valid) unmap_file(file);
+    return valid;
+}
+
+/**
+ * @brief Loads the routes of an opened route cache file into a cache, up to
+ * its capacity. Stops at the first record that is cut off or names a router
+ * outside 1..num_routers.
+ * @return The number of routes restored.
+ */
+uint64_t route_cache_restore(const struct MappedFile *file, uint32_t num_routers, struct RouteCache *cache,
+                             struct PathPool *pool) {
+    const struct CacheFileHeader *h = (const struct CacheFileHeader *)file->data;
+    const uint32_t *w = (const uint32_t *)(file->data + sizeof(*h));
+    uint64_t words = h->record_words, at = 0, restored = 0;
+
+    while (at + 4 <= words && (cache->max_entries == 0 || cache->count < cache->max_entries)) {
+        uint32_t hop_count = w[at + 3];
+        if (hop_count == 0 || hop_count > words - at - 4) break;
+        const uint32_t *hops = w + at + 4;
+        uint32_t k = 0;
+        while (k < hop_count && hops[k] >= 1 && hops[k] <= num_routers) k++;
+        if (k < hop_count) break;
+        uint32_t id = path_pool_intern(pool, hops, hop_count);
+        if (id == 0 || !route_cache_insert(cache, w[at], w[at + 1], id, w[at + 2])) break;
+        restored++;
+        at += 4 + hop_count;
+    }
+    return restored;
+}
+
+/**
+ * @brief Saves one route cache (the interactive session's) to route_cache_path.
+ * @return True on success, False (after printing the reason) otherwise.
+ */
+bool route_cache_save(const struct RouteCache *cache, const struct PathPool *pool, const struct NetworkSnapshot *net,
+                      FILE *status) {
+    struct CacheDump dump;
+    bool ok = cache_dump_init(&dump) && cache_dump_add(&dump, cache, pool) &&
+              cache_dump_write(&dump, route_cache_path, network_fingerprint(net));
+    if (!ok) fprintf(status, "Error: Cannot save the route cache to '%s'.\n", route_cache_path);
+    cache_dump_free(&dump);
+    return ok;
+}
+
+// =======================================================
+// MAIN ROUTING LOGIC
+// =======================================================
+
+/**
+ * @brief Prints the link matrix for small topologies, a summary for large ones.
+ */
+void print_topology(const struct Graph *g) {
+    if (g->num_routers > 16) {
+        printf("Topology: %u routers, %llu directed links.\n", g->num_routers, (unsigned long long)g->num_links);
+        return;
+    }
+    printf("Routers are connected like this (1 = Direct Link):\n");
+    printf(" ");
+    for (uint32_t j = 1; j <= g->num_routers; j++) printf("%3u", j);
+    printf("\n");
+    for (uint32_t i = 1; i <= g->num_routers; i++) {
+        printf("%u", i);
+        for (uint32_t j = 1; j <= g->num_routers; j++) {
+            printf("%3d", graph_has_link(g, i, j));
+        }
+        printf("\n");
+    }
+}
+
+/**
+ * @brief Computes a shortest route between two routers (1-based) into 'out',
+ * from the precomputed next-hop table when the snapshot has one. With --ecmp,
+ * the flow hash picks one of the equal-cost routes.
+ * @param ws Search scratch space owned by the calling thread.
+ * @param flow Flow hash of the address pair (see flow_hash).
+ * @param cost Receives the route cost; may be NULL.
+ * @return True if a route exists, False otherwise.
+ */
+bool compute_route(const struct NetworkSnapshot *net, struct SearchWorkspace *ws, uint32_t src, uint32_t dst,
+                   uint32_t flow, struct PathBuilder *out, uint64_t *cost) {
+    if (ecmp_mode) {
+        return net->next_hops ? next_hop_ecmp_path(net->next_hops, net->graph, ws, src, dst, flow, out, cost)
+                              : graph_ecmp_path(net->graph, ws, src, dst, flow, out, cost);
+    }
+    if (net->next_hops) {
+        uint32_t start = out->length;
+        if (!next_hop_path(net->next_hops, net->graph, src, dst, out)) return false;
+        if (cost) *cost = graph_path_cost(net->graph, out->hops + start, out->length - start);
+        return true;
+    }
+    return graph_shortest_path(net->graph, ws, src, dst, out, cost);
+}
+
+/**
+ * @brief Builds the topology, forwarding table, route cache and (with
+ * --precompute) the next-hop table from the command-line files or prompts.
+ * Exits on errors.
+ * @param interactive Print the banner and link matrix; otherwise status goes to stderr.
+ */
+void load_network(bool interactive) {
+    FILE *status = interactive ? stdout : stderr;
+    if (image_path == NULL) fib_init(&router_fib);
+    if (!route_cache_init(&route_cache, route_cache_capacity) || !path_pool_init(&path_pool)) {
+        printf("Error: Out of memory while creating the route cache.\n");
+        exit(1);
+    }
+    // Topology: sparse graph from the --image, the --topology file or the built-in link list
+    double start = now_seconds();
+    if (image_path != NULL) {
+        if (!image_open(image_path, &router_image, &router_graph, &router_fib, &router_next_hops)) exit(1);
+        fprintf(status, "Mapped %u routers, %llu links, %u prefixes%s from '%s' in %.1f ms.\n",
+                router_graph.num_routers, (unsigned long long)router_graph.num_links / 2, router_fib.num_prefixes,
+                router_next_hops.num_routers ? " and next hops" : "", image_path, (now_seconds() - start) * 1e3);
+        if (router_next_hops.num_routers) precompute_mode = true;
+    } else if (topology_path != NULL) {
+        if (!load_topology_file(topology_path, &router_graph)) exit(1);
+        fprintf(status, "Loaded %u routers and %llu links from '%s' in %.1f ms.\n", router_graph.num_routers,
+               (unsigned long long)router_graph.num_links / 2, topology_path, (now_seconds() - start) * 1e3);
+    } else if (!graph_from_links(&router_graph, DEFAULT_NUM_ROUTERS, default_links,
+                                 sizeof(default_links) / sizeof(default_links[0]))) {
+        printf("Error: Out of memory while building the topology.\n");
+        exit(1);
+    }
+    if (!search_workspace_init(&router_search, router_graph.num_routers)) {
+        printf("Error: Out of memory while building the topology.\n");
+        exit(1);
+    }
+    if (precompute_mode && router_next_hops.num_routers == 0) {
+        start = now_seconds();
+        if (link_state_mode) {
+            struct LsStats ls;
+            if (!ls_build_next_hops(&router_next_hops, &router_graph, &ls)) {
+                printf("Error: Out of memory while running link-state routing.\n");
+                exit(1);
+            }
+            fprintf(status, "Link-state routing converged after %.1f ms simulated (%.1f ms): %llu LSAs sent, %llu "
+                    "SPF runs.\n", (double)ls.converged_at / 1e6, (now_seconds() - start) * 1e3,
+                    (unsigned long long)ls.lsas_flooded, (unsigned long long)(ls.full_spf + ls.incremental_spf));
+        } else if (distance_vector_mode) {
+            struct DvStats dv;
+            if (!dv_build_next_hops(&router_next_hops, &router_graph, num_worker_threads, &dv)) {
+                printf("Error: Out of memory while running distance-vector routing.\n");
+                exit(1);
+            }
+            fprintf(status, "Distance-vector routing converged in %u rounds (%.1f ms): %llu route changes, %llu "
+                    "entries advertised.\n", dv.rounds, (now_seconds() - start) * 1e3,
+                    (unsigned long long)dv.route_changes, (unsigned long long)dv.entries_sent);
+        } else {
+            if (!next_hop_table_build(&router_next_hops, &router_graph, num_worker_threads)) {
+                printf("Error: Out of memory while precomputing next hops.\n");
+                exit(1);
+            }
+            fprintf(status, "Next-hop table for %u routers precomputed in %.1f us.\n", router_graph.num_routers,
+                    (now_seconds() - start) * 1e6);
+        }
+    }
+
+    if (interactive) {
+        printf("--- Network Router Simulation ---\n");
+        print_topology(&router_graph);
+    }
+
+    // 1. INPUT NETWORK IPs (an image already holds the built forwarding table)
+    if (image_path != NULL) {
+        // Nothing to parse or build
+    } else if (networks_path != NULL) {
+        start = now_seconds();
+        if (!load_networks_file(networks_path, router_graph.num_routers, &router_configs, &router_fib)) exit(1);
+        fprintf(status, "Loaded %zu networks from '%s' in %.1f ms.\n", router_configs.count, networks_path,
+               (now_seconds() - start) * 1e3);
+    } else {
+        uint32_t num_routers = router_graph.num_routers;
+        int *num_networks = calloc(num_routers, sizeof(int));
+        int total_networks = 0;
+        if (num_networks == NULL) {
+            printf("Error: Out of memory.\n");
+            exit(1);
+        }
+        for (uint32_t i = 0; i < num_routers; i++) {
+            do {
+                printf("How many networks are joined to router %u (max %d): ", i + 1, MAX_NETWORKS_PER_ROUTER);
+                if (scanf("%d", &num_networks[i]) != 1) {
+                    // Handle non-integer input
+                    discard_input_line();
+                    num_networks[i] = -1;
+                }
+            } while (num_networks[i] < 0 || num_networks[i] > MAX_NETWORKS_PER_ROUTER);
+            total_networks += num_networks[i];
+        }
+        printf("Total networks defined: %d\n", total_networks);
+
+        // Input IP addresses (a plain address is a /32 host network)
+        char input_ip[MAX_PREFIX_LEN];
+        for (uint32_t i = 0; i < num_routers; i++) {
+            for (int j = 0; j < num_networks[i]; j++) {
+                uint32_t prefix;
+                uint8_t prefix_len;
+                do {
+                    printf("Enter router %u Network IP address %d (a.b.c.d or a.b.c.d/len): ", i + 1, j + 1);
+                    check_input_open(scanf("%18s", input_ip));
+                } while (!parse_prefix(input_ip, &prefix, &prefix_len));
+                // Copy validated network to the configuration structure and the FIB
+                if (!router_config_add(&router_configs, i + 1, prefix, prefix_len) ||
+                    !fib_insert(&router_fib, prefix, prefix_len, (int)(i + 1))) {
+                    printf("Error: Out of memory while building the forwarding table.\n");
+                    exit(1);
+                }
+            }
+        }
+        free(num_networks);
+    }
+    if (image_path == NULL) fib_build_index(&router_fib);
+    if (fib_dir24_mode) {
+        if (!fib_enable_dir24(&router_fib, huge_pages_mode)) {
+            printf("Error: Out of memory (or router IDs above %u) while building the DIR-24-8 table.\n",
+                   DIR24_MAX_ROUTER);
+            exit(1);
+        }
+        const char *pages[] = { "4 KB pages", "transparent huge pages", "huge pages" };
+        fprintf(status, "DIR-24-8 table: %.1f MB on %s.\n",
+                (DIR24_TBL24_BYTES + ((size_t)router_fib.dir24->num_chunks << 8) * sizeof(uint32_t)) / 1e6,
+                pages[router_fib.dir24->huge_pages]);
+    }
+    router_snapshot = (struct NetworkSnapshot){
+        .fib = &router_fib, .graph = &router_graph, .next_hops = precompute_mode ? &router_next_hops : NULL };
+    fprintf(status, "\nIP configurations loaded successfully.\n");
+}
+
+void free_network(void) {
+    if (router_image.data) {
+        // The tables live in the mapping; only the DIR-24-8 arrays were allocated
+        dir24_free(router_fib.dir24);
+        image_close(&router_image);
+        memset(&router_fib, 0, sizeof(router_fib));
+        memset(&router_graph, 0, sizeof(router_graph));
+        memset(&router_next_hops, 0, sizeof(router_next_hops));
+    } else {
+        fib_free(&router_fib);
+        graph_free(&router_graph);
+        next_hop_table_free(&router_next_hops);
+    }
+    router_config_free(&router_configs);
+    route_cache_free(&route_cache);
+    path_pool_free(&path_pool);
+    search_workspace_free(&router_search);
+}
+
+/**
+ * @brief Compile mode (--compile FILE): loads the network like --batch does
+ * (plus the next-hop table with --precompute) and writes it as an image
+ * that --image maps at startup.
+ * @return 0 on success, 1 on errors.
+ */
+int compile_network_image(const char *path) {
+    if (networks_path == NULL && image_path == NULL) {
+        fprintf(stderr, "Error: --compile needs a --networks file.\n");
+        return 1;
+    }
+    load_network(false);
+    double start = now_seconds();
+    bool ok = image_write(path, &router_graph, &router_fib, precompute_mode ? &router_next_hops : NULL);
+    struct stat st;
+    if (ok && stat(path, &st) == 0) {
+        fprintf(stderr, "Compiled '%s' (%.1f MB) in %.1f ms.\n", path, st.st_size / 1e6, (now_seconds() - start) * 1e3);
+    }
+    free_network();
+    return ok ? 0 : 1;
+}
+
+void run_routing_simulation() {
+    load_network(true);
+
+    // Warm start from the routes saved by an earlier run (--route-cache)
+    double next_save = 0;
+    if (route_cache_path != NULL) {
+        struct MappedFile file;
+        if (route_cache_file_open(route_cache_path, network_fingerprint(&router_snapshot), &file, stdout)) {
+            uint64_t restored = route_cache_restore(&file, router_graph.num_routers, &route_cache, &path_pool);
+            printf("Restored %llu routes from '%s'.\n", (unsigned long long)restored, route_cache_path);
+            unmap_file(&file);
+        }
+        next_save = now_seconds() + cache_save_interval;
+    }
+
+    // 2. ROUTING LOOP
+    int continue_flag = 0;
+    int query_number = 0;
+    while (continue_flag == 0) {
+        char source_ip[MAX_IP_LEN];
+        char destination_ip[MAX_IP_LEN];
+        uint32_t source_addr, dest_addr;
+        struct RouteKey current_route_key;
+        int source_router = 0;
+        int dest_router = 0;
+
+        printf("\n--- Start Routing Query %d ---\n", ++query_number);
+
+        // --- Get and Validate Source IP ---
+        do {
+            printf("Enter source IP address: ");
+            check_input_open(scanf("%15s", source_ip));
+            if (!parse_ipv4(source_ip, &source_addr)) {
+                printf("Invalid IP format. Please re-enter.\n");
+                source_router = 0;
+                continue;
+            }
+            source_router = find_router_by_ip(source_addr);
+            if (source_router == 0) {
+                printf("Error: Source IP not found in any router's network list. Please re-enter.\n");
+            }
+        } while (source_router == 0);
+
+        printf("Source router is %d\n", source_router);
+
+        // --- Get and Validate Destination IP ---
+        do {
+            printf("Enter Destination IP address: ");
+            check_input_open(scanf("%15s", destination_ip));
+            if (!parse_ipv4(destination_ip, &dest_addr)) {
+                printf("Invalid IP format. Please re-enter.\n");
+                dest_router = 0;
+                continue;
+            }
+            dest_router = find_router_by_ip(dest_addr);
+            if (dest_router == 0) {
+                printf("Error: Destination IP not found in any router's network list. Please re-enter.\n");
+            }
+        } while (dest_router == 0);
+
+        printf("Destination router is %d\n", dest_router);
+
+        // --- Check History (one entry per router pair) ---
+        current_route_key = route_key_for(source_addr, dest_addr, (uint32_t)source_router, (uint32_t)dest_router);
+        uint32_t cached_cost = 0;
+        uint32_t cached_path = route_cache_find(&route_cache, current_route_key.src, current_route_key.dst, &cached_cost);
+
+        if (cached_path != 0) {
+            // Route found in history
+            printf("\n--- HISTORY FOUND ---\n");
+            printf("Source IP address: %s \n--> Source Router: %d \n--> Destination Router: %d \n--> Destination IP address: %s\n",
+                   source_ip, source_router, dest_router, destination_ip);
+            uint32_t hop_count;
+            const uint32_t *hops = path_pool_hops(&path_pool, cached_path, &hop_count);
+            printf("Intermediate Routers details: ");
+            print_path(hops, hop_count);
+            uint64_t path_cost = cached_cost < ROUTE_COST_MAX ? cached_cost
+                                                              : graph_path_cost(&router_graph, hops, hop_count);
+            printf("Path cost: %llu\n", (unsigned long long)path_cost);
+        } else {
+            // --- Determine New Route ---
+            int current_router = source_router;
+            int direct_connection = graph_has_link(&router_graph, source_router, dest_router);
+            struct PathBuilder route_path;
+            bool have_route = true;
+            path_builder_init(&route_path);
+
+            // --- Automatic Routing (--auto): shortest path, no prompts ---
+            if (auto_route_mode) {
+                double start = now_seconds();
+                uint64_t cost;
+                have_route = compute_route(&router_snapshot, &router_search, source_router, dest_router,
+                                           flow_hash(source_addr, dest_addr), &route_path, &cost);
+                double elapsed_us = (now_seconds() - start) * 1e6;
+                if (have_route) {
+                    printf("\n--- AUTOMATIC ROUTE COMPUTED (%u hops, cost %llu, %.1f us) ---\n", route_path.length - 1,
+                           (unsigned long long)cost, elapsed_us);
+                } else {
+                    printf("\nNo route exists between R%d and R%d.\n", source_router, dest_router);
+                }
+                goto route_complete;
+            }
+
+            path_builder_push(&route_path, source_router); // Start path with source router
+
+            // If direct link exists, offer short path option
+            if (direct_connection == 1) {
+                int choice;
+                uint64_t direct_cost = graph_link_cost(&router_graph, source_router, dest_router);
+                printf("Direct link found between R%d and R%d (cost %llu).\n", source_router, dest_router,
+                       (unsigned long long)direct_cost);
+
+                // With link costs, a detour can be cheaper than the direct link
+                if (router_graph.weights) {
+                    struct PathBuilder best;
+                    uint64_t best_cost;
+                    path_builder_init(&best);
+                    if (compute_route(&router_snapshot, &router_search, source_router, dest_router,
+                                      flow_hash(source_addr, dest_addr), &best, &best_cost) &&
+                        best_cost < direct_cost) {
+                        printf("Note: the cheapest route costs %llu: ", (unsigned long long)best_cost);
+                        print_path(best.hops, best.length);
+                    }
+                    path_builder_free(&best);
+                }
+                printf("Do you want to choose the direct path for routing (1=Yes, 0=No/Custom): ");
+                if (scanf("%d", &choice) != 1) {
+                    discard_input_line();
+                    choice = 0;
+                }
+
+                if (choice == 1) {
+                    path_builder_push(&route_path, dest_router);
+                    printf("\n--- DIRECT ROUTE SELECTED ---\n");
+                    goto route_complete;
+                }
+            }
             
             // --- Custom Routing (if no direct path or user chose custom) ---
             printf("\n--- MANUAL ROUTE DEFINITION ---\n");
-            int intermediate_routers[NUM_ROUTERS] = {0};
-            int router_index = 0;
             int next_router = -1;
             
             // Keep track of the current point in the path definition
             current_router = source_router; 
 
-            do {
-                printf("Current router: R%d. Enter next intermediate router (1-%d, or 0 to finalize): ", current_router, NUM_ROUTERS);
-                if (scanf("%d", &next_router) != 1) {
-                    // Handle non-integer input
-                    while (getchar() != '\n');
-                    next_router = -1;
-                }
-                
-                // Check if the user wants to finalize the path (if a connection exists to dest)
-                if (next_router == 0) {
-                    if (connection_matrix[current_router - 1][dest_router - 1] == 1) {
-                        printf("Path finalized: R%d -> R%d (Destination)\n", current_router, dest_router);
-                        route_path = concat_router_ids(route_path, dest_router);
-                        break; // Exit do-while loop
-                    } else {
-                        printf("Cannot finalize yet. Router R%d has no direct link to R%d (Destination).\n", current_router, dest_router);
-                        continue;
-                    }
-                }
-                
-                // Check if the input is valid router ID
-                if (next_router < 1 || next_router > NUM_ROUTERS) {
-                    printf("Invalid router ID. Must be between 1 and %d.\n", NUM_ROUTERS);
-                    continue;
-                }
-                
-                // Check if the chosen router is the destination
-                if (next_router == dest_router) {
-                     if (connection_matrix[current_router - 1][dest_router - 1] == 1) {
-                        route_path = concat_router_ids(route_path, dest_router);
-                        printf("Destination R%d reached successfully!\n", dest_router);
-                        break; // Exit do-while loop
-                    } else {
-                        printf("R%d is the destination, but R%d has no direct link to R%d. Please choose an intermediate router first.\n", dest_router, current_router, dest_router);
-                        continue;
-                    }
-                }
+            do {
+                printf("Current router: R%d. Enter next intermediate router (1-%u, or 0 to finalize): ", current_router, router_graph.num_routers);
+                if (scanf("%d", &next_router) != 1) {
+                    // Handle non-integer input
+                    discard_input_line();
+                    next_router = -1;
+                }
+                
+                // Check if the user wants to finalize the path (if a connection exists to dest)
+                if (next_router == 0) {
+                    if (graph_has_link(&router_graph, current_router, dest_router)) {
+                        printf("Path finalized: R%d -> R%d (Destination)\n", current_router, dest_router);
+                        path_builder_push(&route_path, dest_router);
+                        break; // Exit do-while loop
+                    } else {
+                        printf("Cannot finalize yet. Router R%d has no direct link to R%d (Destination).\n", current_router, dest_router);
+                        continue;
+                    }
+                }
+                
+                // Check if the input is valid router ID
+                if (next_router < 1 || (uint32_t)next_router > router_graph.num_routers) {
+                    printf("Invalid router ID. Must be between 1 and %u.\n", router_graph.num_routers);
+                    continue;
+                }
+                
+                // Check if the chosen router is the destination
+                if (next_router == dest_router) {
+                     if (graph_has_link(&router_graph, current_router, dest_router)) {
+                        path_builder_push(&route_path, dest_router);
+                        printf("Destination R%d reached successfully!\n", dest_router);
+                        break; // Exit do-while loop
+                    } else {
+                        printf("R%d is the destination, but R%d has no direct link to R%d. Please choose an intermediate router first.\n", dest_router, current_router, dest_router);
+                        continue;
+                    }
+                }
+
+                // Check for direct connection from current router to the next intermediate router
+                if (graph_has_link(&router_graph, current_router, next_router)) {
+                    // Valid connection: update path and current router
+                    if (!path_builder_push(&route_path, next_router)) {
+                        printf("Error: Out of memory while building the path.\n");
+                        exit(1);
+                    }
+                    current_router = next_router;
+                    
+                    // Optimization: check if the new intermediate router can connect to the destination
+                    if (graph_has_link(&router_graph, current_router, dest_router)) {
+                        printf("R%d is now directly connected to Destination R%d. Type 0 to finalize or enter another intermediate router.\n", current_router, dest_router);
+                    }
+                } else {
+                    printf("Invalid path: Router R%d has no direct link to Router R%d.\n", current_router, next_router);
+                }
+
+            } while (current_router != dest_router);
+
+
+            route_complete:; // Label for jump from direct path logic
+
+            // 3. Save History and Display Result
+            // Path includes Source and Destination; identical paths share one pool entry
+            // and a full cache evicts its coldest entry
+            if (have_route) {
+                uint64_t cost = graph_path_cost(&router_graph, route_path.hops, route_path.length);
+                uint32_t path_id = path_pool_intern(&path_pool, route_path.hops, route_path.length);
+                if (path_id != 0 &&
+                    route_cache_insert(&route_cache, current_route_key.src, current_route_key.dst, path_id, cost)) {
+                    printf("\n--- NEW ROUTE LOGGED ---\n");
+                    printf("Source IP: %s\n", source_ip);
+                    printf("Intermediate Routers Path (IDs): ");
+                    for (uint32_t i = 0; i < route_path.length; i++) {
+                        printf("%u%s", route_path.hops[i], i + 1 < route_path.length ? "," : "\n");
+                    }
+
+                    printf("\nPath established: ");
+                    print_path(route_path.hops, route_path.length);
+                    printf("Path cost: %llu\n", (unsigned long long)cost);
+                } else {
+                    printf("\nWarning: Could not store the route (out of memory).\n");
+                }
+            }
+            path_builder_free(&route_path);
+
+        } // End of history check (else block)
+
+        if (route_cache_path != NULL && cache_save_interval > 0 && now_seconds() >= next_save) {
+            route_cache_save(&route_cache, &path_pool, &router_snapshot, stdout);
+            next_save = now_seconds() + cache_save_interval;
+        }
+
+        // 4. Continue Prompt
+        printf("\nDo you want to continue routing? (0=Yes, 1=No): ");
+        if (scanf("%d", &continue_flag) != 1) {
+             continue_flag = 1; // Default to stop on bad input or end of input
+        }
+    }
+    printf("\n--- Simulation Ended ---\n");
+    route_cache_print_stats(&route_cache, stdout);
+    if (route_cache_path != NULL && route_cache_save(&route_cache, &path_pool, &router_snapshot, stdout)) {
+        printf("Saved %zu routes to '%s'.\n", route_cache.count, route_cache_path);
+    }
+    free_network();
+}
+
+// =======================================================
+// LIVE UPDATES
+// =======================================================
+
+static void snapshot_free(struct NetworkSnapshot *snap) {
+    if (snap->own_fib) fib_free(snap->own_fib);
+    if (snap->own_graph) graph_free(snap->own_graph);
+    if (snap->own_next_hops) next_hop_table_free(snap->own_next_hops);
+    free(snap->own_fib);
+    free(snap->own_graph);
+    free(snap->own_next_hops);
+    free(snap);
+}
+
+/**
+ * @brief Starts a domain whose first snapshot is a copy of 'initial'.
+ * The parts of 'initial' stay owned by the caller.
+ * @return True on success, False if out of memory.
+ */
+bool snapshot_domain_init(struct SnapshotDomain *d, const struct NetworkSnapshot *initial) {
+    struct NetworkSnapshot *snap = malloc(sizeof(*snap));
+    if (snap == NULL) return false;
+    *snap = *initial;
+    snap->own_fib = NULL;
+    snap->own_graph = NULL;
+    snap->own_next_hops = NULL;
+    atomic_init(&d->current, snap);
+    atomic_init(&d->epoch, 1);
+    for (int i = 0; i < MAX_SNAPSHOT_READERS; i++) atomic_init(&d->reader_epoch[i], 0);
+    atomic_init(&d->num_readers, 0);
+    pthread_mutex_init(&d->update_lock, NULL);
+    return true;
+}
+
+/**
+ * @brief Frees the current snapshot, the parts it owns and the change history.
+ * No reader may be active.
+ */
+void snapshot_domain_destroy(struct SnapshotDomain *d) {
+    struct NetworkSnapshot *snap = atomic_load(&d->current);
+    const struct NetworkChange *change = snap->changes;
+    while (change) {
+        const struct NetworkChange *prev = change->prev;
+        free((void *)change);
+        change = prev;
+    }
+    snapshot_free(snap);
+    pthread_mutex_destroy(&d->update_lock);
+}
+
+// Gives the calling thread a reader slot (-1 if all are taken)
+int snapshot_reader_register(struct SnapshotDomain *d) {
+    int slot = atomic_fetch_add(&d->num_readers, 1);
+    return slot < MAX_SNAPSHOT_READERS ? slot : -1;
+}
+
+/**
+ * @brief Enters a read-side section and returns the current snapshot, which
+ * stays valid until snapshot_read_end(). Wait-free: two atomic operations.
+ */
+const struct NetworkSnapshot *snapshot_read_begin(struct SnapshotDomain *d, int slot) {
+    atomic_store(&d->reader_epoch[slot], atomic_load(&d->epoch));
+    return atomic_load(&d->current);
+}
+
+void snapshot_read_end(struct SnapshotDomain *d, int slot) {
+    atomic_store_explicit(&d->reader_epoch[slot], 0, memory_order_release);
+}
+
+// Waits until no reader can still hold a snapshot published before 'epoch'
+static void snapshot_wait_readers(struct SnapshotDomain *d, uint64_t epoch) {
+    int readers = atomic_load(&d->num_readers);
+    if (readers > MAX_SNAPSHOT_READERS) readers = MAX_SNAPSHOT_READERS;
+    for (int i = 0; i < readers; i++) {
+        for (;;) {
+            uint64_t seen = atomic_load(&d->reader_epoch[i]);
+            if (seen == 0 || seen >= epoch) break;
+            sched_yield();
+        }
+    }
+}
+
+/**
+ * @brief Applies one change: builds a new snapshot that shares every part the
+ * change does not touch, publishes it with one pointer swap, waits for the
+ * readers of the old snapshot and frees it. Readers are never blocked.
+ * Links take "router router [cost]" semantics from the topology file: an up
+ * link replaces any existing link between the two routers. With a next-hop
+ * table, link changes repair a copy of it (next_hop_table_update).
+ * @param error Receives a short reason on failure.
+ * @return True on success, False if the change is invalid or out of memory.
+ */
+bool network_apply_change(struct SnapshotDomain *d, const struct NetworkChange *change, const char **error) {
+    pthread_mutex_lock(&d->update_lock);
+    struct NetworkSnapshot *old = atomic_load(&d->current);
+    struct NetworkSnapshot *snap = calloc(1, sizeof(*snap));
+    struct NetworkChange *record = malloc(sizeof(*record));
+    uint32_t n = old->graph->num_routers;
+    bool ok = false;
+    *error = "out of memory";
+    if (snap == NULL || record == NULL) goto done;
+    snap->fib = old->fib;
+    snap->graph = old->graph;
+    snap->next_hops = old->next_hops;
+
+    if (change->kind == CHANGE_LINK_UP || change->kind == CHANGE_LINK_DOWN) {
+        bool up = change->kind == CHANGE_LINK_UP;
+        if (change->a < 1 || change->a > n || change->b < 1 || change->b > n || change->a == change->b) {
+            *error = "no such router";
+            goto done;
+        }
+        if (!up && !graph_has_link(old->graph, change->a, change->b)) {
+            *error = "no such link";
+            goto done;
+        }
+        struct Graph *g = calloc(1, sizeof(*g));
+        if (g == NULL) goto done;
+        snap->own_graph = g;
+        if (!graph_with_link(old->graph, change->a, change->b, change->cost, up, g)) goto done;
+        snap->graph = g;
+        if (old->next_hops) {
+            // Repair a copy of the table; rebuild only if that is not possible
+            struct NextHopTable *t = calloc(1, sizeof(*t));
+            if (t == NULL) goto done;
+            snap->own_next_hops = t;
+            if (!next_hop_table_copy(t, old->next_hops) ||
+                !next_hop_table_update(t, old->graph, g, change->a, change->b, num_worker_threads)) {
+                next_hop_table_free(t);
+                if (!next_hop_table_build(t, g, num_worker_threads)) goto done;
+            }
+            snap->next_hops = t;
+        }
+    } else {
+        if (change->kind == CHANGE_PREFIX_ADD && (change->router < 1 || change->router > n)) {
+            *error = "no such router";
+            goto done;
+        }
+        struct Fib *fib = calloc(1, sizeof(*fib));
+        if (fib == NULL) goto done;
+        snap->own_fib = fib;
+        if (!fib_copy(fib, old->fib)) goto done;
+        if (change->kind == CHANGE_PREFIX_ADD) {
+            if (!fib_insert(fib, change->prefix, change->prefix_len, (int)change->router)) goto done;
+        } else if (!fib_remove(fib, change->prefix, change->prefix_len)) {
+            *error = "no such prefix";
+            goto done;
+        }
+        if (!fib_build_index(fib)) goto done;
+        snap->fib = fib;
+    }
+
+    // Hand the untouched parts to the new snapshot so they outlive the old one
+    if (snap->fib == old->fib) {
+        snap->own_fib = old->own_fib;
+        old->own_fib = NULL;
+    }
+    if (snap->graph == old->graph) {
+        snap->own_graph = old->own_graph;
+        old->own_graph = NULL;
+    }
+    if (snap->next_hops == old->next_hops) {
+        snap->own_next_hops = old->own_next_hops;
+        old->own_next_hops = NULL;
+    }
+
+    *record = *change;
+    record->version = old->version + 1;
+    record->prev = old->changes;
+    snap->version = record->version;
+    snap->changes = record;
+
+    atomic_store(&d->current, snap);
+    uint64_t epoch = atomic_fetch_add(&d->epoch, 1) + 1;
+    snapshot_wait_readers(d, epoch);
+    old->changes = NULL;
+    snapshot_free(old);
+    snap = NULL;
+    record = NULL;
+    ok = true;
+
+done:
+    if (snap) snapshot_free(snap);
+    free(record);
+    pthread_mutex_unlock(&d->update_lock);
+    return ok;
+}
+
+/**
+ * @brief Parses an update line: "link up A B [cost | latency=us bandwidth=mbps]",
+ * "link down A B", "prefix add R a.b.c.d[/len]" or "prefix del a.b.c.d[/len]".
+ * @return True if the line is a well-formed update, False otherwise.
+ */
+bool parse_network_change(const char *p, const char *end, struct NetworkChange *change) {
+    memset(change, 0, sizeof(*change));
+    change->cost = 1;
+    const char *word = p;
+    while (p < end && isalpha((unsigned char)*p)) p++;
+    size_t len = (size_t)(p - word);
+    p = skip_field_separators(p, end);
+    const char *verb = p;
+    while (p < end && isalpha((unsigned char)*p)) p++;
+    size_t verb_len = (size_t)(p - verb);
+    p = skip_field_separators(p, end);
+
+    if (len == 4 && memcmp(word, "link", 4) == 0) {
+        if (verb_len == 2 && memcmp(verb, "up", 2) == 0) change->kind = CHANGE_LINK_UP;
+        else if (verb_len == 4 && memcmp(verb, "down", 4) == 0) change->kind = CHANGE_LINK_DOWN;
+        else return false;
+        if ((p = scan_uint(p, end, &change->a)) == NULL) return false;
+        if ((p = scan_uint(skip_field_separators(p, end), end, &change->b)) == NULL) return false;
+        if (change->kind == CHANGE_LINK_UP && (p = scan_link_metrics(p, end, &change->cost)) == NULL) return false;
+    } else if (len == 6 && memcmp(word, "prefix", 6) == 0) {
+        if (verb_len == 3 && memcmp(verb, "add", 3) == 0) {
+            change->kind = CHANGE_PREFIX_ADD;
+            if ((p = scan_uint(p, end, &change->router)) == NULL) return false;
+            p = skip_field_separators(p, end);
+        } else if (verb_len == 3 && memcmp(verb, "del", 3) == 0) {
+            change->kind = CHANGE_PREFIX_DEL;
+        } else {
+            return false;
+        }
+        if ((p = scan_prefix(p, end, &change->prefix, &change->prefix_len)) == NULL) return false;
+    } else {
+        return false;
+    }
+    return skip_field_separators(p, end) == end;
+}
+
+// =======================================================
+// BATCH QUERIES
+// =======================================================
+
+// Input bytes per pipeline block (blocks always end on a line boundary)
+#define BATCH_BLOCK_SIZE (256 * 1024)
+
+// Growable output text of one block
+struct OutputBuffer {
+    char *data;
+    size_t used;
+    size_t capacity;
+};
+
+// Makes room for 'len' more bytes and returns where they go
+static inline char *output_reserve(struct OutputBuffer *ob, size_t len) {
+    if (ob->used + len > ob->capacity) {
+        size_t capacity = ob->capacity ? ob->capacity : BATCH_BLOCK_SIZE;
+        while (capacity < ob->used + len) capacity *= 2;
+        char *grown = realloc(ob->data, capacity);
+        if (grown == NULL) {
+            fprintf(stderr, "Error: Out of memory.\n");
+            exit(1);
+        }
+        ob->data = grown;
+        ob->capacity = capacity;
+    }
+    return ob->data + ob->used;
+}
+
+// Appends a decimal number, returns the position after it
+static inline char *output_uint(char *p, uint64_t value) {
+    char digits[20];
+    int n = 0;
+    do {
+        digits[n++] = (char)('0' + value % 10);
+        value /= 10;
+    } while (value);
+    while (n) *p++ = digits[--n];
+    return p;
+}
+
+// Counters of a batch run (or of one block of it)
+struct BatchStats {
+    uint64_t queries;
+    uint64_t routed;
+    uint64_t no_route;
+    uint64_t invalid;
+    uint64_t first_invalid_line;
+    uint64_t line;
+    uint64_t updates;  // Network changes applied
+    uint64_t rejected; // Well-formed changes that could not be applied
+};
+
+// Private state of one query thread: its own route cache, path pool and
+// search scratch space, so answering a query never writes shared memory
+struct QueryWorker {
+    const struct NetworkSnapshot *net;
+    struct RouteCache cache;
+    struct PathPool pool;
+    struct SearchWorkspace search;
+    struct PathBuilder path;
+    struct SnapshotDomain *domain; // Where 'net' comes from, NULL for a fixed network
+    int reader_slot;
+    uint64_t version;              // Snapshot version the cache is valid for
+    uint64_t invalidated;          // Cached routes dropped after changes
+    uint64_t flush_equivalent;     // Routes a full flush would have dropped
+    struct LinkLoad load;          // Flows per link (--ecmp)
+    bool load_incomplete;          // Some flows were not counted (out of memory)
+    uint64_t save_epoch;           // Last periodic route cache save this worker added to
+};
+
+bool query_worker_init(struct QueryWorker *w, const struct NetworkSnapshot *net, size_t cache_capacity) {
+    memset(w, 0, sizeof(*w));
+    w->net = net;
+    path_builder_init(&w->path);
+    return route_cache_init(&w->cache, cache_capacity) && path_pool_init(&w->pool) &&
+           search_workspace_init(&w->search, net->graph->num_routers) && link_load_init(&w->load);
+}
+
+void query_worker_free(struct QueryWorker *w) {
+    route_cache_free(&w->cache);
+    path_pool_free(&w->pool);
+    search_workspace_free(&w->search);
+    path_builder_free(&w->path);
+    link_load_free(&w->load);
+}
+
+// Adds two distances, saturating at UINT64_MAX (unreachable)
+static inline uint64_t distance_add(uint64_t a, uint64_t b) {
+    return a > UINT64_MAX - b ? UINT64_MAX : a + b;
+}
+
+// True if the path uses the link between a and b (either direction)
+static bool path_uses_link(const uint32_t *hops, uint32_t length, uint32_t a, uint32_t b) {
+    for (uint32_t i = 1; i < length; i++) {
+        if ((hops[i - 1] == a && hops[i] == b) || (hops[i - 1] == b && hops[i] == a)) return true;
+    }
+    return false;
+}
+
+/**
+ * @brief Moves the worker to snapshot 'net' and drops only the cached routes
+ * that the changes since its previous snapshot can affect: routes over a link
+ * that went down or changed, routes a new link could now beat (checked with
+ * the distances from both ends of that link), and, for routes cached per
+ * address pair (route_cache_per_flow), routes whose source or destination lies in a
+ * changed prefix. Each distinct path is checked once.
+ */
+void query_worker_sync(struct QueryWorker *w, const struct NetworkSnapshot *net) {
+    const struct NetworkChange *first = net->changes;
+    uint64_t since = w->version;
+    w->net = net;
+    if (net->version == since) return;
+    w->version = net->version;
+    if (w->cache.count == 0) return;
+
+    const struct Graph *g = net->graph;
+    bool links_changed = false, prefixes_changed = false;
+    for (const struct NetworkChange *c = first; c && c->version > since; c = c->prev) {
+        if (c->kind == CHANGE_LINK_UP || c->kind == CHANGE_LINK_DOWN) links_changed = true;
+        else if (route_cache_per_flow) prefixes_changed = true; // Router-pair keys do not depend on prefixes
+    }
+
+    // Mark stale paths: walk every interned path once against the new graph
+    uint8_t *stale = links_changed ? calloc(w->pool.count, 1) : NULL;
+    uint64_t *cost = links_changed ? malloc(w->pool.count * sizeof(uint64_t)) : NULL;
+    uint64_t *from_a = links_changed ? malloc((size_t)g->num_routers * sizeof(uint64_t)) : NULL;
+    uint64_t *from_b = links_changed ? malloc((size_t)g->num_routers * sizeof(uint64_t)) : NULL;
+    bool flush_all = links_changed && (stale == NULL || cost == NULL || from_a == NULL || from_b == NULL);
+    if (links_changed && !flush_all) {
+        for (uint32_t id = 1; id < w->pool.count; id++) {
+            uint32_t length;
+            const uint32_t *hops = path_pool_hops(&w->pool, id, &length);
+            cost[id] = graph_path_cost(g, hops, length);
+            if (cost[id] == UINT64_MAX) stale[id] = 1;
+            for (const struct NetworkChange *c = first; c && c->version > since && !stale[id]; c = c->prev) {
+                if (c->kind == CHANGE_LINK_UP && path_uses_link(hops, length, c->a, c->b)) stale[id] = 1;
+            }
+        }
+        for (const struct NetworkChange *c = first; c && c->version > since && !flush_all; c = c->prev) {
+            if (c->kind != CHANGE_LINK_UP || graph_link_cost(g, c->a, c->b) == UINT64_MAX) continue;
+            uint64_t link = graph_link_cost(g, c->a, c->b);
+            if (!graph_distances(g, &w->search, c->a, from_a) || !graph_distances(g, &w->search, c->b, from_b)) {
+                flush_all = true;
+                break;
+            }
+            for (uint32_t id = 1; id < w->pool.count; id++) {
+                if (stale[id]) continue;
+                uint32_t length;
+                const uint32_t *hops = path_pool_hops(&w->pool, id, &length);
+                uint32_t s = hops[0] - 1, t = hops[length - 1] - 1;
+                uint64_t via_ab = distance_add(distance_add(from_a[s], link), from_b[t]);
+                uint64_t via_ba = distance_add(distance_add(from_b[s], link), from_a[t]);
+                if (via_ab < cost[id] || via_ba < cost[id]) stale[id] = 1;
+            }
+        }
+    }
+
+    // Collect the keys first: removing shifts entries within the table
+    uint64_t *keys = malloc(w->cache.count * sizeof(uint64_t));
+    size_t num_keys = 0;
+    if (keys == NULL) flush_all = true;
+    for (uint64_t i = 0; !flush_all && i <= w->cache.mask; i++) {
+        uint64_t key = w->cache.keys[i];
+        if (key == ROUTE_CACHE_EMPTY) continue;
+        bool drop = stale && stale[w->cache.values[i].path];
+        if (!drop && prefixes_changed) {
+            uint32_t src = (uint32_t)(key >> 32), dst = (uint32_t)key;
+            for (const struct NetworkChange *c = first; c && c->version > since && !drop; c = c->prev) {
+                if (c->kind != CHANGE_PREFIX_ADD && c->kind != CHANGE_PREFIX_DEL) continue;
+                uint32_t mask = prefix_mask(c->prefix_len);
+                drop = (src & mask) == c->prefix || (dst & mask) == c->prefix;
+            }
+        }
+        if (drop) keys[num_keys++] = key;
+    }
+
+    w->flush_equivalent += w->cache.count;
+    if (flush_all) {
+        // Out of memory: fall back to dropping everything
+        w->invalidated += w->cache.count;
+        size_t max_entries = w->cache.max_entries;
+        uint64_t hits = w->cache.hits, misses = w->cache.misses, evictions = w->cache.evictions;
+        route_cache_free(&w->cache);
+        route_cache_init(&w->cache, max_entries);
+        w->cache.hits = hits;
+        w->cache.misses = misses;
+        w->cache.evictions = evictions;
+    } else {
+        for (size_t k = 0; k < num_keys; k++) {
+            route_cache_remove(&w->cache, (uint32_t)(keys[k] >> 32), (uint32_t)keys[k]);
+        }
+        w->invalidated += num_keys;
+    }
+    free(keys);
+    free(stale);
+    free(cost);
+    free(from_a);
+    free(from_b);
+}
+
+/**
+ * @brief Routes one address pair: forwarding table, then the worker's route
+ * cache (keyed by the router pair, see route_key_for), then a shortest-path
+ * computation whose result is cached.
+ * @param cost Receives the route cost.
+ * @return The router path (owned by the worker's pool), or NULL if either
+ * address is unknown or no route exists.
+ */
+const uint32_t *query_worker_route(struct QueryWorker *w, uint32_t src, uint32_t dst, uint32_t *hop_count,
+                                   uint64_t *cost) {
+    int source_router = fib_lookup(w->net->fib, src);
+    int dest_router = fib_lookup(w->net->fib, dst);
+    if (source_router == 0 || dest_router == 0) return NULL;
+
+    struct RouteKey key = route_key_for(src, dst, (uint32_t)source_router, (uint32_t)dest_router);
+    uint32_t stored_cost;
+    uint32_t id = route_cache_find(&w->cache, key.src, key.dst, &stored_cost);
+    if (id != 0) {
+        const uint32_t *hops = path_pool_hops(&w->pool, id, hop_count);
+        *cost = stored_cost < ROUTE_COST_MAX ? stored_cost : graph_path_cost(w->net->graph, hops, *hop_count);
+        return hops;
+    }
+    uint64_t path_cost;
+    w->path.length = 0;
+    if (!compute_route(w->net, &w->search, (uint32_t)source_router, (uint32_t)dest_router, flow_hash(src, dst),
+                       &w->path, &path_cost)) {
+        return NULL;
+    }
+    id = path_pool_intern(&w->pool, w->path.hops, w->path.length);
+    if (id == 0) return NULL;
+    route_cache_insert(&w->cache, key.src, key.dst, id, path_cost);
+    *cost = path_cost;
+    return path_pool_hops(&w->pool, id, hop_count);
+}
+
+// True if the line is a network change ("link down 2 3", ...) rather than a query
+static inline bool batch_is_change(const char *line, const char *line_end) {
+    const char *text = skip_field_separators(line, line_end);
+    return text != line_end && isalpha((unsigned char)*text);
+}
+
+// Start of the first change line in [begin, end), or NULL. Query lines hold
+// only bytes below 0x40 (digits, dots, separators), so the scan skips 8 bytes
+// at a time to the next letter and only then looks at its line.
+static const char *batch_find_change(const char *begin, const char *end) {
+    const char *p = begin;
+    for (;;) {
+        uint64_t word;
+        while (end - p >= 8 && (memcpy(&word, p, 8), (word & 0xC0C0C0C0C0C0C0C0ull) == 0)) p += 8;
+        while (p < end && (unsigned char)*p < 0x40) p++;
+        if (p == end) return NULL;
+        const char *line = p;
+        while (line > begin && line[-1] != '\n') line--;
+        const char *line_end = memchr(p, '\n', (size_t)(end - p));
+        if (line_end == NULL) line_end = end;
+        if (batch_is_change(line, line_end)) return line;
+        p = line_end;
+    }
+}
+
+// End of the line starting at 'line' (past its newline)
+static inline const char *batch_line_after(const char *line, const char *end) {
+    const char *newline = memchr(line, '\n', (size_t)(end - line));
+    return newline ? newline + 1 : end;
+}
+
+/**
+ * @brief Applies one change line to the network. Called outside the
+ * worker's read-side section.
+ */
+static void batch_change(struct QueryWorker *w, const char *line, const char *line_end, struct BatchStats *stats) {
+    struct NetworkChange change;
+    const char *error;
+    if (w->domain == NULL || !parse_network_change(skip_field_separators(line, line_end), line_end, &change)) {
+        if (stats->invalid++ == 0) stats->first_invalid_line = stats->line;
+        return;
+    }
+    if (network_apply_change(w->domain, &change, &error)) stats->updates++;
+    else stats->rejected++;
+}
+
+/**
+ * @brief Answers one "src dst" query line and appends "src dst 1,2,3 cost"
+ * (the router path and its cost) or "src dst none" to the output.
+ */
+static void batch_query(struct QueryWorker *w, const char *line, const char *line_end, const char *data_end,
+                        struct OutputBuffer *ob, struct BatchStats *stats) {
+    uint32_t src, dst;
+    const char *src_text = skip_field_separators(line, line_end);
+    if (src_text == line_end || *src_text == '#') return; // Blank line or comment
+
+    const char *src_end = scan_ipv4_bounded(src_text, data_end, &src);
+    const char *dst_text = src_end ? skip_field_separators(src_end, line_end) : NULL;
+    const char *dst_end = dst_text && dst_text > src_end ? scan_ipv4_bounded(dst_text, data_end, &dst) : NULL;
+    if (dst_end == NULL || skip_field_separators(dst_end, line_end) != line_end) {
+        if (stats->invalid++ == 0) stats->first_invalid_line = stats->line;
+        return;
+    }
+    stats->queries++;
+
+    uint32_t hop_count = 0;
+    uint64_t cost = 0;
+    const uint32_t *hops = query_worker_route(w, src, dst, &hop_count, &cost);
+
+    // Worst case: two addresses, separators, hop_count 10-digit IDs with commas and the cost
+    size_t src_len = (size_t)(src_end - src_text), dst_len = (size_t)(dst_end - dst_text);
+    char *out = output_reserve(ob, src_len + dst_len + 20 + (size_t)hop_count * 11);
+    memcpy(out, src_text, src_len);
+    out += src_len;
+    *out++ = ' ';
+    memcpy(out, dst_text, dst_len);
+    out += dst_len;
+    *out++ = ' ';
+    if (hops == NULL) {
+        memcpy(out, "none", 4);
+        out += 4;
+        stats->no_route++;
+    } else {
+        stats->routed++;
+        if (ecmp_mode && !link_load_add_path(&w->load, hops, hop_count)) w->load_incomplete = true;
+        for (uint32_t i = 0; i < hop_count; i++) {
+            out = output_uint(out, hops[i]);
+            *out++ = ',';
+        }
+        out[-1] = ' ';
+        out = output_uint(out, cost);
+    }
+    *out++ = '\n';
+    ob->used = (size_t)(out - ob->data);
+}
+
+// A block moves FREE -> BUSY (claimed, being answered) -> DONE -> written -> FREE
+enum { BLOCK_FREE, BLOCK_BUSY, BLOCK_DONE };
+
+// One slot of the pipeline ring: a block of input lines and its answers. A
+// change line always ends its block, so every query in a block sees the same
+// network: the one after the 'changes_before' change lines above it.
+struct BatchBlock {
+    int state;
+    const char *begin;
+    const char *end;
+    const char *change;      // Start of the closing change line, or NULL
+    uint64_t seq;            // Position in the input, in blocks
+    uint64_t changes_before;
+    char *input;       // Copy of the lines when reading a stream
+    struct OutputBuffer out;
+    struct BatchStats stats;
+};
+
+// Shared state of a batch run. Threads claim blocks in order under 'lock',
+// answer them without any lock, and whichever thread finds the oldest block
+// done writes it, so the output keeps the input order. A block waits until
+// the change lines above it are applied, and a change line waits until every
+// block above it is answered, so each query sees the same network on any
+// number of threads and gets the same cost. Among equal-cost routes, though,
+// the hops may differ: a thread keeps a cached route after a change as long
+// as it is still a shortest one.
+struct BatchJob {
+    pthread_mutex_t lock;
+    pthread_cond_t changed;
+    struct BatchBlock *ring;
+    uint32_t ring_size;
+    uint64_t next_block;  // Next block to claim
+    uint64_t next_write;  // Next block to write
+    uint64_t changes_claimed; // Change lines in the blocks claimed so far
+    uint64_t changes_applied; // ... and applied (or rejected) so far
+    bool input_done;
+    bool writing;
+    const char *data;     // Whole input when memory-mapped
+    size_t size;
+    size_t offset;
+    FILE *in;             // Stream input otherwise
+    char *carry;          // Incomplete last line of the previous read
+    size_t carry_len;
+    FILE *out;
+    struct QueryWorker *workers;
+    atomic_int next_worker;
+    struct SnapshotDomain domain;
+    struct BatchStats total;
+    int num_workers;
+    // Periodic --route-cache save: the routes added so far in this round
+    struct CacheDump save;
+    uint64_t save_epoch;
+    int save_pending;     // Workers that have not added their routes yet
+    uint64_t save_version;
+    bool save_mixed;      // A change landed during the round: skip it
+    double next_save;
+};
+
+// Claims the next stretch of input for block 'b' (lock held), ending it after the first change
+// line, if any. Returns false at the end.
+static bool batch_fill_block(struct BatchJob *job, struct BatchBlock *b) {
+    if (job->data) {
+        if (job->offset >= job->size) return false;
+        size_t end = job->offset + BATCH_BLOCK_SIZE;
+        if (end >= job->size) {
+            end = job->size;
+        } else {
+            const char *newline = memchr(job->data + end, '\n', job->size - end);
+            end = newline ? (size_t)(newline - job->data) + 1 : job->size;
+        }
+        b->begin = job->data + job->offset;
+        b->change = batch_find_change(b->begin, job->data + end);
+        b->end = b->change ? batch_line_after(b->change, job->data + end) : job->data + end;
+        job->offset = (size_t)(b->end - job->data);
+        return true;
+    }
+
+    // Stream: previous carry + one read, cut after the last newline
+    if (b->input == NULL && (b->input = malloc(2 * BATCH_BLOCK_SIZE)) == NULL) {
+        fprintf(stderr, "Error: Out of memory.\n");
+        exit(1);
+    }
+    // The carry can hold a whole block left over after a change line: then there is no need to read
+    memcpy(b->input, job->carry, job->carry_len);
+    size_t len = job->carry_len;
+    if (len < BATCH_BLOCK_SIZE) len += fread(b->input + len, 1, BATCH_BLOCK_SIZE, job->in);
+    size_t cut = len;
+    job->carry_len = 0;
+    if (len == 0) return false;
+    if (!feof(job->in) && !ferror(job->in)) {
+        while (cut > 0 && b->input[cut - 1] != '\n') cut--;
+        if (cut == 0 || len - cut > BATCH_BLOCK_SIZE) cut = len; // Overlong line: answer it as is
+    }
+    b->change = batch_find_change(b->input, b->input + cut);
+    if (b->change) cut = (size_t)(batch_line_after(b->change, b->input + cut) - b->input);
+    job->carry_len = len - cut;
+    memcpy(job->carry, b->input + cut, job->carry_len);
+    b->begin = b->input;
+    b->end = b->input + cut;
+    return true;
+}
+
+// Writes every finished block at the head of the ring, in order (lock held)
+static void batch_write_ready(struct BatchJob *job) {
+    while (!job->writing && job->next_write < job->next_block) {
+        struct BatchBlock *b = &job->ring[job->next_write % job->ring_size];
+        if (b->state != BLOCK_DONE) break;
+
+        job->writing = true;
+        pthread_mutex_unlock(&job->lock);
+        if (b->out.used) fwrite(b->out.data, 1, b->out.used, job->out);
+        pthread_mutex_lock(&job->lock);
+        job->writing = false;
+
+        struct BatchStats *t = &job->total;
+        if (b->stats.invalid && t->invalid == 0) t->first_invalid_line = t->line + b->stats.first_invalid_line;
+        t->queries += b->stats.queries;
+        t->routed += b->stats.routed;
+        t->no_route += b->stats.no_route;
+        t->invalid += b->stats.invalid;
+        t->line += b->stats.line;
+        t->updates += b->stats.updates;
+        t->rejected += b->stats.rejected;
+        b->state = BLOCK_FREE;
+        job->next_write++;
+        pthread_cond_broadcast(&job->changed);
+    }
+}
+
+/**
+ * @brief Periodic --route-cache save. When one is due, each worker adds its
+ * routes the next time it finishes a block (its cache is private, so only it
+ * may read it), and the last one writes the file. A round in which the
+ * network changed is dropped; the save at the end of the run covers it.
+ * Called inside the worker's read-side section.
+ */
+static void batch_save_periodic(struct BatchJob *job, struct QueryWorker *w) {
+    pthread_mutex_lock(&job->lock);
+    double now = now_seconds();
+    if (now >= job->next_save) {
+        // Also restarts a round that idle workers never completed
+        cache_dump_free(&job->save);
+        job->save_pending = cache_dump_init(&job->save) ? job->num_workers : 0;
+        job->save_epoch++;
+        job->save_version = w->version;
+        job->save_mixed = false;
+        job->next_save = now + cache_save_interval;
+    }
+    if (job->save_pending > 0 && w->save_epoch != job->save_epoch) {
+        w->save_epoch = job->save_epoch;
+        if (w->version != job->save_version || !cache_dump_add(&job->save, &w->cache, &w->pool)) {
+            job->save_mixed = true;
+        }
+        if (--job->save_pending == 0) {
+            if (!job->save_mixed) cache_dump_write(&job->save, route_cache_path, network_fingerprint(w->net));
+            cache_dump_free(&job->save);
+        }
+    }
+    pthread_mutex_unlock(&job->lock);
+}
+
+static void *batch_worker(void *arg) {
+    struct BatchJob *job = arg;
+    struct QueryWorker *w = &job->workers[atomic_fetch_add(&job->next_worker, 1)];
+
+    pthread_mutex_lock(&job->lock);
+    for (;;) {
+        // Wait until the slot of the next block has been written out
+        while (!job->input_done && job->ring[job->next_block % job->ring_size].state != BLOCK_FREE) {
+            pthread_cond_wait(&job->changed, &job->lock);
+        }
+        if (job->input_done) break;
+        struct BatchBlock *b = &job->ring[job->next_block % job->ring_size];
+        if (!batch_fill_block(job, b)) {
+            job->input_done = true;
+            break;
+        }
+        b->state = BLOCK_BUSY;
+        b->seq = job->next_block++;
+        b->changes_before = job->changes_claimed;
+        if (b->change) job->changes_claimed++;
+        while (job->changes_applied < b->changes_before) pthread_cond_wait(&job->changed, &job->lock);
+        pthread_mutex_unlock(&job->lock);
+
+        // Answer the block's queries on the current snapshot; only worker-private memory is written
+        const char *queries_end = b->change ? b->change : b->end;
+        memset(&b->stats, 0, sizeof(b->stats));
+        b->out.used = 0;
+        query_worker_sync(w, snapshot_read_begin(w->domain, w->reader_slot));
+        for (const char *p = b->begin; p < queries_end;) {
+            const char *newline = memchr(p, '\n', (size_t)(queries_end - p));
+            const char *line_end = newline ? newline : queries_end;
+            b->stats.line++;
+            batch_query(w, p, line_end, queries_end, &b->out, &b->stats);
+            p = line_end + 1;
+        }
+        if (route_cache_path != NULL && cache_save_interval > 0) batch_save_periodic(job, w);
+        snapshot_read_end(w->domain, w->reader_slot);
+
+        pthread_mutex_lock(&job->lock);
+        if (b->change) {
+            // Every block above must be answered on the old network first
+            while (job->next_write < b->seq) pthread_cond_wait(&job->changed, &job->lock);
+            pthread_mutex_unlock(&job->lock);
+            const char *newline = memchr(b->change, '\n', (size_t)(b->end - b->change));
+            b->stats.line++;
+            batch_change(w, b->change, newline ? newline : b->end, &b->stats);
+            pthread_mutex_lock(&job->lock);
+            job->changes_applied++;
+            pthread_cond_broadcast(&job->changed);
+        }
+        b->state = BLOCK_DONE;
+        batch_write_ready(job);
+    }
+    batch_write_ready(job);
+    pthread_cond_broadcast(&job->changed);
+    pthread_mutex_unlock(&job->lock);
+    return NULL;
+}
+
+/**
+ * @brief Answers every query line of a memory-mapped input (data, size) or a
+ * stream (in) on num_threads threads, each with its own route cache of
+ * 'cache_capacity' entries, and writes the answers to 'out' in input order.
+ * Change lines ("link up ...", see parse_network_change) update the network
+ * for every query below them, and for none above, on any number of threads;
+ * only the choice among equal-cost routes may differ with the threads.
+ * @param total Receives the query counters.
+ * @param cache_total Receives the summed counters of the worker caches (may be NULL).
+ * @param invalidated Receives the cached routes dropped after changes (may be NULL).
+ * @param load_total Receives the flows per link with --ecmp (may be NULL;
+ *        otherwise initialized by the caller).
+ * @return True on success, False if out of memory.
+ */
+bool batch_run(const struct NetworkSnapshot *net, const char *data, size_t size, FILE *in, FILE *out,
+               int num_threads, size_t cache_capacity, struct BatchStats *total, struct RouteCache *cache_total,
+               uint64_t *invalidated, struct LinkLoad *load_total) {
+    if (num_threads < 1) num_threads = 1;
+    if (num_threads > MAX_SNAPSHOT_READERS) num_threads = MAX_SNAPSHOT_READERS;
+    struct BatchJob job;
+    memset(&job, 0, sizeof(job));
+    job.ring_size = 4 * (uint32_t)num_threads;
+    job.ring = calloc(job.ring_size, sizeof(struct BatchBlock));
+    job.workers = calloc((size_t)num_threads, sizeof(struct QueryWorker));
+    job.carry = data ? NULL : malloc(2 * BATCH_BLOCK_SIZE);
+    job.data = data;
+    job.size = size;
+    job.in = in;
+    job.out = out;
+    atomic_init(&job.next_worker, 0);
+    bool ok = job.ring != NULL && job.workers != NULL && (data != NULL || job.carry != NULL) &&
+              snapshot_domain_init(&job.domain, net);
+    bool have_domain = ok;
+    for (int i = 0; ok && i < num_threads; i++) {
+        ok = query_worker_init(&job.workers[i], net, cache_capacity);
+        job.workers[i].domain = &job.domain;
+        job.workers[i].reader_slot = snapshot_reader_register(&job.domain);
+    }
+    job.num_workers = num_threads;
+
+    // Warm start (--route-cache): every thread gets the saved routes, since
+    // any thread may answer any query
+    if (ok && route_cache_path != NULL) {
+        struct MappedFile file;
+        if (route_cache_file_open(route_cache_path, network_fingerprint(net), &file, stderr)) {
+            uint64_t restored = 0;
+            for (int i = 0; i < num_threads; i++) {
+                restored = route_cache_restore(&file, net->graph->num_routers, &job.workers[i].cache,
+                                               &job.workers[i].pool);
+            }
+            fprintf(stderr, "Restored %llu routes from '%s'.\n", (unsigned long long)restored, route_cache_path);
+            unmap_file(&file);
+        }
+        job.next_save = now_seconds() + cache_save_interval;
+    }
+
+    if (ok) {
+        pthread_mutex_init(&job.lock, NULL);
+        pthread_cond_init(&job.changed, NULL);
+        ok = run_workers(batch_worker, &job, num_threads);
+        pthread_mutex_destroy(&job.lock);
+        pthread_cond_destroy(&job.changed);
+        *total = job.total;
+    }
+    cache_dump_free(&job.save);
+
+    // Final save: bring every cache up to the last network version first
+    if (ok && route_cache_path != NULL) {
+        const struct NetworkSnapshot *last = atomic_load(&job.domain.current);
+        struct CacheDump dump;
+        bool saved = cache_dump_init(&dump);
+        for (int i = 0; saved && i < num_threads; i++) {
+            query_worker_sync(&job.workers[i], last);
+            saved = cache_dump_add(&dump, &job.workers[i].cache, &job.workers[i].pool);
+        }
+        if (saved && cache_dump_write(&dump, route_cache_path, network_fingerprint(last))) {
+            fprintf(stderr, "Saved %llu routes to '%s'.\n", (unsigned long long)dump.routes, route_cache_path);
+        } else {
+            fprintf(stderr, "Error: Cannot save the route cache to '%s'.\n", route_cache_path);
+        }
+        cache_dump_free(&dump);
+    }
+
+    if (cache_total) memset(cache_total, 0, sizeof(*cache_total));
+    if (invalidated) *invalidated = 0;
+    for (int i = 0; job.workers && i < num_threads; i++) {
+        if (invalidated) *invalidated += job.workers[i].invalidated;
+        if (load_total && job.workers[i].load.keys) {
+            const struct LinkLoad *load = &job.workers[i].load;
+            for (uint64_t k = 0; k <= load->mask; k++) {
+                if (load->keys[k] == ROUTE_CACHE_EMPTY) continue;
+                if (!link_load_add(load_total, (uint32_t)(load->keys[k] >> 32), (uint32_t)load->keys[k],
+                                   load->flows[k])) {
+                    ok = false;
+                }
+            }
+            if (job.workers[i].load_incomplete) ok = false;
+        }
+        if (cache_total) {
+            cache_total->count += job.workers[i].cache.count;
+            cache_total->max_entries += job.workers[i].cache.max_entries;
+            cache_total->hits += job.workers[i].cache.hits;
+            cache_total->misses += job.workers[i].cache.misses;
+            cache_total->evictions += job.workers[i].cache.evictions;
+        }
+        query_worker_free(&job.workers[i]);
+    }
+    for (uint32_t i = 0; job.ring && i < job.ring_size; i++) {
+        free(job.ring[i].input);
+        free(job.ring[i].out.data);
+    }
+    if (have_domain) snapshot_domain_destroy(&job.domain);
+    free(job.ring);
+    free(job.workers);
+    free(job.carry);
+    return ok;
+}
+
+/**
+ * @brief Non-interactive mode (--batch): reads "src dst" address pairs, one
+ * per line, from a file (memory-mapped) or stdin ("-"), routes each one
+ * automatically and writes one result line per query to stdout, in input
+ * order. Queries are spread over --threads threads sharing the read-only
+ * network. Status and the final throughput go to stderr.
+ * @return 0 on success, 1 if the input cannot be read.
+ */
+int run_batch_queries(const char *path) {
+    if (networks_path == NULL && image_path == NULL) {
+        fprintf(stderr, "Error: --batch needs a --networks file or an --image.\n");
+        return 1;
+    }
+    load_network(false);
+
+    struct MappedFile file = { 0 };
+    bool from_stdin = strcmp(path, "-") == 0;
+    if (!from_stdin && !map_file(path, &file)) {
+        fprintf(stderr, "Error: Cannot read query file '%s'.\n", path);
+        free_network();
+        return 1;
+    }
+
+    int threads = num_worker_threads > 0 ? num_worker_threads : default_thread_count();
+    struct BatchStats stats;
+    struct RouteCache cache_total;
+    struct LinkLoad load;
+    uint64_t invalidated;
+    double start = now_seconds();
+    bool ok = link_load_init(&load);
+    ok = ok && (from_stdin ? batch_run(&router_snapshot, NULL, 0, stdin, stdout, threads, route_cache_capacity, &stats,
+                                       &cache_total, &invalidated, &load)
+                           : file.size == 0 ||
+                                 batch_run(&router_snapshot, file.data, file.size, NULL, stdout, threads,
+                                           route_cache_capacity, &stats, &cache_total, &invalidated, &load));
+    fflush(stdout);
+    double elapsed = now_seconds() - start;
+
+    if (!ok) {
+        fprintf(stderr, "Error: Out of memory.\n");
+    } else if (file.size || from_stdin) {
+        fprintf(stderr, "Batch: %llu queries in %.3f s (%.0f queries/s, %d threads): %llu routed, %llu without a route",
+                (unsigned long long)stats.queries, elapsed, elapsed > 0 ? stats.queries / elapsed : 0.0, threads,
+                (unsigned long long)stats.routed, (unsigned long long)stats.no_route);
+        if (stats.invalid) {
+            fprintf(stderr, ", %llu invalid lines skipped (first: line %llu)", (unsigned long long)stats.invalid,
+                    (unsigned long long)stats.first_invalid_line);
+        }
+        fprintf(stderr, "\n");
+        if (stats.updates || stats.rejected) {
+            fprintf(stderr, "Updates: %llu applied, %llu rejected, %llu cached routes invalidated\n",
+                    (unsigned long long)stats.updates, (unsigned long long)stats.rejected,
+                    (unsigned long long)invalidated);
+        }
+        route_cache_print_stats(&cache_total, stderr);
+        if (ecmp_mode) link_load_print(&load, "Link load (ECMP)", stderr);
+    }
+
+    link_load_free(&load);
+    unmap_file(&file);
+    free_network();
+    return ok ? 0 : 1;
+}
+
+// =======================================================
+// PACKET SIMULATION
+// =======================================================
+
+// Output side of one directed link: packets are serialized one after the
+// other, then take the link's propagation delay to reach the next router
+struct SimLink {
+    uint64_t busy_until; // End of the last queued packet's transmission (ns)
+    uint64_t delay_ns;   // Link cost in microseconds, which can exceed 2^32 ns
+    uint64_t packets;
+    uint32_t drops;
+};
+
+// Marks a flow whose endpoints are unknown or not connected
+#define SIM_NO_ROUTE 0xFFFFFFFFu
+
+// Packets sent at a fixed interval along one route
+struct SimFlow {
+    uint32_t src_addr, dst_addr;
+    uint64_t path;        // First link in PacketSim.path_links
+    uint32_t hops;        // Links on the route, or SIM_NO_ROUTE
+    uint32_t packets;
+    uint32_t bytes;
+    uint64_t start_ns;
+    uint64_t interval_ns;
+    uint64_t delivered;
+    uint64_t dropped;
+    uint64_t latency_sum; // ns, over delivered packets
+    uint64_t latency_min;
+    uint64_t latency_max;
+    uint64_t queue_limit_ps; // Backlog (transmission time) at which a packet is dropped
+};
+
+// Log-linear latency histogram: 16 buckets per power of two (about 6% wide)
+#define SIM_HISTOGRAM_BUCKETS 1024
+
+struct PacketSim {
+    struct TimingWheel wheel;
+    struct SimLink *links; // One per CSR link of the graph
+    uint64_t num_links;
+    struct SimFlow *flows;
+    uint32_t num_flows;
+    uint32_t flow_capacity;
+    uint32_t *path_links;  // CSR link indices of every flow's route
+    uint64_t path_length;
+    uint64_t path_capacity;
+    uint32_t ps_per_byte;  // Serialization time (picoseconds per byte)
+    uint64_t queue_bytes;  // Drop-tail limit of each link's queue
+    uint64_t events;
+    uint64_t histogram[SIM_HISTOGRAM_BUCKETS];
+};
+
+static inline uint32_t sim_latency_bucket(uint64_t ns) {
+    if (ns < 16) return (uint32_t)ns;
+    uint32_t e = (uint32_t)(63 - __builtin_clzll(ns));
+    return (e - 3) * 16 + (uint32_t)((ns >> (e - 4)) & 15);
+}
+
+static inline uint64_t sim_bucket_value(uint32_t bucket) {
+    if (bucket < 16) return bucket;
+    return (uint64_t)(16 + bucket % 16) << (bucket / 16 - 1);
+}
+
+/**
+ * @brief Sets up a simulation on a graph. Each link's propagation delay is
+ * its cost in microseconds; all links share one bandwidth and queue limit.
+ * @param mbps Link bandwidth in Mbit/s.
+ * @param queue_bytes Bytes a link may hold waiting for transmission.
+ * @return True on success, False if out of memory.
+ */
+bool packet_sim_init(struct PacketSim *sim, const struct Graph *g, uint32_t mbps, uint64_t queue_bytes) {
+    memset(sim, 0, sizeof(*sim));
+    wheel_init(&sim->wheel);
+    sim->num_links = g->num_links;
+    sim->links = calloc(g->num_links ? g->num_links : 1, sizeof(struct SimLink));
+    if (sim->links == NULL) return false;
+    for (uint64_t e = 0; e < g->num_links; e++) {
+        sim->links[e].delay_ns = graph_link_weight(g, e) * 1000;
+    }
+    sim->ps_per_byte = mbps ? (8000000 + mbps - 1) / mbps : 8000;
+    if (sim->ps_per_byte == 0) sim->ps_per_byte = 1;
+    sim->queue_bytes = queue_bytes;
+    return true;
+}
+
+void packet_sim_free(struct PacketSim *sim) {
+    wheel_free(&sim->wheel);
+    free(sim->links);
+    free(sim->flows);
+    free(sim->path_links);
+    memset(sim, 0, sizeof(*sim));
+}
+
+/**
+ * @brief Adds a flow of 'packets' packets of 'bytes' bytes, the first at
+ * 'start_ns' and one every 'interval_ns' after that, along a router path.
+ * @param hops The route as 1-based router IDs; 'length' 0 means no route.
+ * @return True on success, False if out of memory.
+ */
+bool packet_sim_add_flow(struct PacketSim *sim, const struct Graph *g, uint32_t src_addr, uint32_t dst_addr,
+                         const uint32_t *hops, uint32_t length, uint32_t packets, uint32_t bytes,
+                         uint64_t start_ns, uint64_t interval_ns) {
+    if (sim->num_flows == sim->flow_capacity) {
+        uint32_t new_cap = sim->flow_capacity ? sim->flow_capacity * 2 : 64;
+        struct SimFlow *grown = realloc(sim->flows, (size_t)new_cap * sizeof(struct SimFlow));
+        if (grown == NULL) return false;
+        sim->flows = grown;
+        sim->flow_capacity = new_cap;
+    }
+    if (length > 0 && sim->path_length + length > sim->path_capacity) {
+        uint64_t new_cap = sim->path_capacity ? sim->path_capacity * 2 : 1024;
+        while (new_cap < sim->path_length + length) new_cap *= 2;
+        uint32_t *grown = realloc(sim->path_links, new_cap * sizeof(uint32_t));
+        if (grown == NULL) return false;
+        sim->path_links = grown;
+        sim->path_capacity = new_cap;
+    }
+
+    struct SimFlow *f = &sim->flows[sim->num_flows++];
+    memset(f, 0, sizeof(*f));
+    f->src_addr = src_addr;
+    f->dst_addr = dst_addr;
+    f->path = sim->path_length;
+    f->hops = length ? length - 1 : SIM_NO_ROUTE;
+    f->packets = packets;
+    f->bytes = bytes;
+    f->start_ns = start_ns;
+    f->interval_ns = interval_ns;
+    f->latency_min = UINT64_MAX;
+    // Same test as backlog bytes + bytes > queue_bytes, without a division per hop
+    uint64_t room = bytes > sim->queue_bytes ? 0 : sim->queue_bytes - bytes + 1;
+    f->queue_limit_ps = room > UINT64_MAX / sim->ps_per_byte ? UINT64_MAX : room * sim->ps_per_byte;
+    for (uint32_t i = 0; i + 1 < length; i++) {
+        uint32_t u = hops[i] - 1;
+        sim->path_links[sim->path_length++] = (uint32_t)g->offsets[u] + graph_link_index(g, u, hops[i + 1] - 1);
+    }
+    return true;
+}
+
+// Schedules the injection of packet 'seq' of flow 'flow'
+static inline bool packet_sim_inject(struct PacketSim *sim, uint32_t flow, uint32_t seq) {
+    const struct SimFlow *f = &sim->flows[flow];
+    return wheel_schedule(&sim->wheel, (struct SimEvent){ f->start_ns + seq * f->interval_ns, flow, seq, 0, 0 });
+}
+
+/**
+ * @brief Runs the simulation until every packet has been delivered or
+ * dropped. A packet at a router joins the queue of the next link on its
+ * route; it is dropped when the bytes waiting there would exceed the queue
+ * limit, otherwise it arrives at the next router once it has been
+ * transmitted and has crossed the link. Each flow injects its next packet
+ * when the current one leaves its source, so only packets in flight take
+ * event memory.
+ * @return True on success, False if out of memory.
+ */
+bool packet_sim_run(struct PacketSim *sim) {
+    struct TimingWheel *w = &sim->wheel;
+    for (uint32_t i = 0; i < sim->num_flows; i++) {
+        if (sim->flows[i].hops != SIM_NO_ROUTE && sim->flows[i].packets && !packet_sim_inject(sim, i, 0)) {
+            return false;
+        }
+    }
+
+    struct SimEvent e;
+    while (wheel_next(w, &e)) {
+        struct SimFlow *f = &sim->flows[e.flow];
+        sim->events++;
+
+        if (e.hop == 0 && e.seq + 1 < f->packets && !packet_sim_inject(sim, e.flow, e.seq + 1)) return false;
+
+        if (e.hop == f->hops) {
+            uint64_t latency = e.time - (f->start_ns + e.seq * f->interval_ns);
+            f->delivered++;
+            f->latency_sum += latency;
+            if (latency < f->latency_min) f->latency_min = latency;
+            if (latency > f->latency_max) f->latency_max = latency;
+            sim->histogram[sim_latency_bucket(latency)]++;
+            continue;
+        }
+
+        struct SimLink *link = &sim->links[sim->path_links[f->path + e.hop]];
+        uint64_t start = link->busy_until > e.time ? link->busy_until : e.time;
+        if ((start - e.time) * 1000 >= f->queue_limit_ps) {
+            f->dropped++;
+            link->drops++;
+            continue;
+        }
+        link->busy_until = start + ((uint64_t)f->bytes * sim->ps_per_byte + 999) / 1000;
+        link->packets++;
+        e.time = link->busy_until + link->delay_ns;
+        e.hop++;
+        if (!wheel_schedule(w, e)) return false;
+    }
+    return w->pending == 0;
+}
+
+/**
+ * @brief Approximate latency percentile over all delivered packets.
+ * @param q Fraction between 0 and 1.
+ * @return Latency in ns (lower edge of its histogram bucket).
+ */
+uint64_t packet_sim_percentile(const struct PacketSim *sim, double q) {
+    uint64_t total = 0, seen = 0;
+    for (uint32_t b = 0; b < SIM_HISTOGRAM_BUCKETS; b++) total += sim->histogram[b];
+    uint64_t rank = (uint64_t)(q * (double)total);
+    if (rank >= total && total) rank = total - 1;
+    for (uint32_t b = 0; b < SIM_HISTOGRAM_BUCKETS; b++) {
+        seen += sim->histogram[b];
+        if (seen > rank) return sim_bucket_value(b);
+    }
+    return 0;
+}
+
+// Totals over all flows, for the summary lines
+static void packet_sim_totals(const struct PacketSim *sim, uint64_t *sent, uint64_t *delivered, uint64_t *dropped,
+                              uint32_t *unrouted) {
+    *sent = *delivered = *dropped = 0;
+    *unrouted = 0;
+    for (uint32_t i = 0; i < sim->num_flows; i++) {
+        const struct SimFlow *f = &sim->flows[i];
+        if (f->hops == SIM_NO_ROUTE) {
+            (*unrouted)++;
+            continue;
+        }
+        *sent += f->packets;
+        *delivered += f->delivered;
+        *dropped += f->dropped;
+    }
+}
+
+/**
+ * @brief Simulation mode (--simulate FILE): reads flows, one per line as
+ * "src dst [packets [interval_us [bytes [start_us]]]]", routes each one once
+ * on the loaded network and simulates its packets hop by hop. Writes one
+ * line per flow to stdout: "src dst hops delivered/sent dropped" followed by
+ * the min / mean / max end-to-end latency in microseconds, or "src dst none".
+ * @return 0 on success, 1 if the file cannot be read or is malformed.
+ */
+int run_packet_simulation(const char *path) {
+    if (networks_path == NULL && image_path == NULL) {
+        fprintf(stderr, "Error: --simulate needs a --networks file or an --image.\n");
+        return 1;
+    }
+    load_network(false);
+
+    struct MappedFile file;
+    if (!map_file(path, &file)) {
+        fprintf(stderr, "Error: Cannot read flow file '%s'.\n", path);
+        free_network();
+        return 1;
+    }
+
+    const struct NetworkSnapshot *net = &router_snapshot;
+    struct PacketSim sim;
+    struct PathBuilder route;
+    path_builder_init(&route);
+    bool ok = packet_sim_init(&sim, net->graph, sim_link_mbps, sim_queue_bytes);
+    bool valid = true;
+    struct LineReader reader = { file.data, file.data + file.size, 0 };
+    const char *p, *stop;
+
+    while (ok && valid && next_config_line(&reader, &p, &stop)) {
+        uint32_t src, dst, packets = 1000, interval_us = 10, bytes = 1500, start_us = 0;
+        uint32_t *fields[] = { &packets, &interval_us, &bytes, &start_us };
+        p = scan_ipv4_bounded(p, stop, &src);
+        if (p) p = scan_ipv4_bounded(skip_field_separators(p, stop), stop, &dst);
+        for (int k = 0; p && k < 4 && (p = skip_field_separators(p, stop)) < stop; k++) {
+            p = scan_uint(p, stop, fields[k]);
+        }
+        if (p == NULL || skip_field_separators(p, stop) < stop || bytes == 0 || interval_us == 0) {
+            fprintf(stderr, "Error: %s:%llu: expected \"src dst [packets [interval_us [bytes [start_us]]]]\".\n",
+                    path, (unsigned long long)reader.line);
+            valid = false;
+            break;
+        }
+
+        int source_router = fib_lookup(net->fib, src);
+        int dest_router = fib_lookup(net->fib, dst);
+        route.length = 0;
+        bool found = source_router != 0 && dest_router != 0 &&
+                     compute_route(net, &router_search, (uint32_t)source_router, (uint32_t)dest_router,
+                                   flow_hash(src, dst), &route, NULL);
+        ok = packet_sim_add_flow(&sim, net->graph, src, dst, route.hops, found ? route.length : 0, packets, bytes,
+                                 (uint64_t)start_us * 1000, (uint64_t)interval_us * 1000);
+    }
+
+    double start = now_seconds();
+    ok = ok && (!valid || packet_sim_run(&sim));
+    double elapsed = now_seconds() - start;
+
+    if (!ok) {
+        fprintf(stderr, "Error: Out of memory.\n");
+    } else if (valid) {
+        for (uint32_t i = 0; i < sim.num_flows; i++) {
+            const struct SimFlow *f = &sim.flows[i];
+            char a[MAX_IP_LEN], b[MAX_IP_LEN];
+            format_ipv4(f->src_addr, a);
+            format_ipv4(f->dst_addr, b);
+            if (f->hops == SIM_NO_ROUTE) {
+                printf("%s %s none\n", a, b);
+            } else if (f->delivered == 0) {
+                printf("%s %s %u 0/%u %llu\n", a, b, f->hops, f->packets, (unsigned long long)f->dropped);
+            } else {
+                printf("%s %s %u %llu/%u %llu %.3f %.3f %.3f\n", a, b, f->hops, (unsigned long long)f->delivered,
+                       f->packets, (unsigned long long)f->dropped, f->latency_min / 1e3,
+                       (double)f->latency_sum / f->delivered / 1e3, f->latency_max / 1e3);
+            }
+        }
+        fflush(stdout);
+
+        uint64_t sent, delivered, dropped;
+        uint32_t unrouted;
+        packet_sim_totals(&sim, &sent, &delivered, &dropped, &unrouted);
+        fprintf(stderr, "Simulation: %u flows (%u without a route), %llu packets: %llu delivered, %llu dropped\n",
+                sim.num_flows, unrouted, (unsigned long long)sent, (unsigned long long)delivered,
+                (unsigned long long)dropped);
+        fprintf(stderr, "Simulated %.3f ms in %.3f s: %llu events (%.1f M events/s)\n", sim.wheel.now / 1e6, elapsed,
+                (unsigned long long)sim.events, elapsed > 0 ? sim.events / elapsed / 1e6 : 0.0);
+        if (delivered) {
+            fprintf(stderr, "Latency: p50 %.1f us, p99 %.1f us, p99.9 %.1f us\n",
+                    packet_sim_percentile(&sim, 0.5) / 1e3, packet_sim_percentile(&sim, 0.99) / 1e3,
+                    packet_sim_percentile(&sim, 0.999) / 1e3);
+        }
+    }
+
+    path_builder_free(&route);
+    packet_sim_free(&sim);
+    unmap_file(&file);
+    free_network();
+    return ok && valid ? 0 : 1;
+}
+
+// =======================================================
+// BENCHMARKS
+// =======================================================
+
+// xorshift64* generator: deterministic inputs for repeatable benchmarks
+static uint64_t bench_rng_state = 0x9E3779B97F4A7C15ull;
+
+static uint64_t bench_rand(void) {
+    bench_rng_state ^= bench_rng_state >> 12;
+    bench_rng_state ^= bench_rng_state << 25;
+    bench_rng_state ^= bench_rng_state >> 27;
+    return bench_rng_state * 0x2545F4914F6CDD1Dull;
+}
+
+// Prefix lengths roughly shaped like a real routing table (mostly /24, some /16-/23, few /8-/15 and /32)
+static uint8_t bench_prefix_len(void) {
+    uint32_t r = (uint32_t)(bench_rand() % 100);
+    if (r < 55) return 24;
+    if (r < 85) return (uint8_t)(16 + bench_rand() % 8);
+    if (r < 90) return (uint8_t)(8 + bench_rand() % 8);
+    return (uint8_t)(25 + bench_rand() % 8);
+}
+
+/**
+ * @brief Legacy digit check used by validate_ip_strtok.
+ */
+bool validate_number(const char *str) {
+    if (!*str) return false;
+    while (*str) {
+        if (!isdigit((unsigned char)*str)) {
+            return false;
+        }
+        str++;
+    }
+    return true;
+}
+
+/**
+ * @brief Legacy strtok/atoi validator, kept as the parser benchmark baseline.
+ */
+bool validate_ip_strtok(const char *ip_str) {
+    if (ip_str == NULL || ip_str[0] == '\0') return false;
+
+    // We must work on a copy because strtok modifies the string.
+    char temp_ip[MAX_IP_LEN];
+    strncpy(temp_ip, ip_str, MAX_IP_LEN - 1);
+    temp_ip[MAX_IP_LEN - 1] = '\0';
+
+    char *ptr;
+    int dots = 0;
+    int num;
+    int octet_count = 0;
+
+    ptr = strtok(temp_ip, ".");
+
+    while (ptr) {
+        octet_count++;
+        if (!validate_number(ptr)) return false;
+
+        num = atoi(ptr);
+        if (num < 0 || num > 255) return false;
+
+        ptr = strtok(NULL, ".");
+        if (ptr != NULL) {
+            dots++;
+        }
+    }
+
+    // Must have 4 octets and 3 dots
+    if (octet_count != 4 || dots != 3) {
+        return false;
+    }
+    return true;
+}
+
+/**
+ * @brief Measures ns/address for the legacy validator + sscanf conversion,
+ * the single-pass scalar parser and the buffered (SIMD when available) parser.
+ * @param count Number of random addresses to parse.
+ */
+int run_parse_benchmark(int count) {
+    printf("--- IPv4 Parser Benchmark: %d addresses ---\n", count);
+
+    char (*strings)[MAX_IP_LEN] = malloc((size_t)count * MAX_IP_LEN);
+    char *buffer = malloc((size_t)count * MAX_IP_LEN);
+    uint32_t *expected = malloc(count * sizeof(uint32_t));
+    uint32_t *parsed = malloc(count * sizeof(uint32_t));
+    if (strings == NULL || buffer == NULL || expected == NULL || parsed == NULL) {
+        printf("Error: Out of memory.\n");
+        return 1;
+    }
+
+    size_t buffer_len = 0;
+    for (int i = 0; i < count; i++) {
+        // Mix of 1-3 digit octets, like real addresses
+        uint32_t addr = (uint32_t)bench_rand();
+        if (i % 3 == 0) addr &= 0xFF0F3F7Fu;
+        expected[i] = addr;
+        format_ipv4(addr, strings[i]);
+        size_t len = strlen(strings[i]);
+        memcpy(buffer + buffer_len, strings[i], len);
+        buffer_len += len;
+        buffer[buffer_len++] = '\n';
+    }
+
+    long long checksum = 0;
+    double start = now_seconds();
+    for (int i = 0; i < count; i++) {
+        if (validate_ip_strtok(strings[i])) {
+            unsigned int a, b, c, d;
+            sscanf(strings[i], "%u.%u.%u.%u", &a, &b, &c, &d);
+            checksum += (a << 24) | (b << 16) | (c << 8) | d;
+        }
+    }
+    double legacy_time = now_seconds() - start;
+    printf("strtok/atoi + sscanf: %7.1f ns/address (checksum %lld)\n", legacy_time * 1e9 / count, checksum);
+
+    checksum = 0;
+    int errors = 0;
+    start = now_seconds();
+    for (int i = 0; i < count; i++) {
+        uint32_t addr;
+        if (parse_ipv4(strings[i], &addr)) checksum += addr;
+        else errors++;
+    }
+    double scalar_time = now_seconds() - start;
+    printf("parse_ipv4 (scalar):  %7.1f ns/address (checksum %lld)\n", scalar_time * 1e9 / count, checksum);
+
+    size_t parsed_count = 0;
+    start = now_seconds();
+    parse_ipv4_list(buffer, buffer + buffer_len, parsed, count, &parsed_count);
+    double list_time = now_seconds() - start;
+#ifdef __SSSE3__
+    const char *list_kind = "SSSE3";
+#else
+    const char *list_kind = "scalar";
+#endif
+    printf("parse_ipv4_list (%s): %7.1f ns/address\n", list_kind, list_time * 1e9 / count);
+
+    for (int i = 0; i < count; i++) {
+        if ((size_t)i >= parsed_count || parsed[i] != expected[i]) errors++;
+    }
+    printf("Speedup over legacy: %.1fx scalar, %.1fx buffered; %d mismatches\n",
+           legacy_time / scalar_time, legacy_time / list_time, errors);
+
+    free(strings);
+    free(buffer);
+    free(expected);
+    free(parsed);
+    return errors ? 1 : 0;
+}
+
+/**
+ * @brief Builds a random connected topology: a ring plus random chords.
+ * @param degree Average links per router (at least 2).
+ * @param weighted Give each undirected link a random cost of 1-100.
+ */
+bool bench_make_graph(struct Graph *g, uint32_t num_routers, uint32_t degree, bool weighted) {
+    uint64_t links = (uint64_t)num_routers * (degree / 2);
+    struct Edge *edges = malloc(links * 2 * sizeof(struct Edge));
+    if (edges == NULL) return false;
+
+    for (uint64_t l = 0; l < links; l++) {
+        uint32_t a = (uint32_t)(l % num_routers);
+        uint32_t b = l < num_routers ? (a + 1) % num_routers : (uint32_t)(bench_rand() % num_routers);
+        uint32_t w = weighted ? 1 + (uint32_t)(bench_rand() % 100) : 1;
+        edges[2 * l] = (struct Edge){ a, b, w };
+        edges[2 * l + 1] = (struct Edge){ b, a, w };
+    }
+    bool ok = graph_build(g, num_routers, edges, links * 2, weighted);
+    free(edges);
+    return ok;
+}
+
+static int compare_doubles(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+/**
+ * @brief Prints mean / median / 99th percentile of latency samples (sorts them).
+ */
+void print_latency_summary(const char *label, double *samples_us, int count) {
+    double total = 0;
+    for (int i = 0; i < count; i++) total += samples_us[i];
+    qsort(samples_us, count, sizeof(double), compare_doubles);
+    printf("%s: mean %.1f us, p50 %.1f us, p99 %.1f us, max %.1f us (%d samples)\n", label, total / count,
+           samples_us[count / 2], samples_us[(int)(count * 0.99)], samples_us[count - 1], count);
+}
+
+/**
+ * @brief Measures per-query BFS and Dijkstra latency on a random topology and
+ * fills a route cache with the results, as the --auto routing mode does.
+ * @param num_routers Number of routers in the generated topology.
+ */
+int run_route_benchmark(uint32_t num_routers) {
+    const int num_queries = 500;
+    const uint32_t degree = 6;
+
+    printf("--- Shortest Path Benchmark: %u routers, average degree %u ---\n", num_routers, degree);
+
+    double *samples = malloc(num_queries * sizeof(double));
+    struct SearchWorkspace ws;
+    struct RouteCache cache;
+    struct PathPool pool;
+    if (samples == NULL || !search_workspace_init(&ws, num_routers) || !route_cache_init(&cache, 0) ||
+        !path_pool_init(&pool)) {
+        printf("Error: Out of memory.\n");
+        return 1;
+    }
+
+    for (int weighted = 0; weighted <= 1; weighted++) {
+        struct Graph g;
+        double start = now_seconds();
+        if (!bench_make_graph(&g, num_routers, degree, weighted)) {
+            printf("Error: Out of memory.\n");
+            return 1;
+        }
+        printf("%s graph: %llu directed links, built in %.3f s\n", weighted ? "Weighted" : "Unit-cost",
+               (unsigned long long)g.num_links, now_seconds() - start);
+
+        uint64_t total_hops = 0;
+        for (int q = 0; q < num_queries; q++) {
+            uint32_t src = 1 + (uint32_t)(bench_rand() % num_routers);
+            uint32_t dst = 1 + (uint32_t)(bench_rand() % num_routers);
+            struct PathBuilder path;
+            path_builder_init(&path);
+
+            start = now_seconds();
+            uint64_t cost;
+            bool found = graph_shortest_path(&g, &ws, src, dst, &path, &cost);
+            samples[q] = (now_seconds() - start) * 1e6;
+
+            if (found) {
+                total_hops += path.length - 1;
+                route_cache_insert(&cache, src, dst, path_pool_intern(&pool, path.hops, path.length), cost);
+            }
+            path_builder_free(&path);
+        }
+        printf("Average path length: %.2f hops\n", (double)total_hops / num_queries);
+        print_latency_summary(weighted ? "Dijkstra" : "BFS", samples, num_queries);
+        graph_free(&g);
+    }
+    printf("Route cache filled with %zu routes (%u distinct paths)\n", cache.count, pool.count - 1);
+
+    search_workspace_free(&ws);
+    route_cache_free(&cache);
+    path_pool_free(&pool);
+    free(samples);
+    return 0;
+}
+
+/**
+ * @brief Compares topology storage: the old dense int matrix against the CSR
+ * rows and the bitset, for one sparse and one dense graph.
+ */
+int run_graph_benchmark(uint32_t num_routers) {
+    const int num_queries = 2000000;
+    struct { uint32_t routers, degree; } shapes[2] = { { num_routers, 6 }, { 4096, 1024 } };
+
+    for (int s = 0; s < 2; s++) {
+        struct Graph g;
+        uint32_t n = shapes[s].routers;
+        double start = now_seconds();
+        if (!bench_make_graph(&g, n, shapes[s].degree, false)) {
+            printf("Error: Out of memory.\n");
+            return 1;
+        }
+        double build = now_seconds() - start;
+
+        double matrix_mb = (double)n * n * sizeof(int) / 1048576.0;
+        double csr_mb = ((double)(n + 1) * sizeof(uint64_t) + (double)g.num_links * sizeof(uint32_t)) / 1048576.0;
+        double bits_mb = (double)n * (((uint64_t)n + 63) / 64) * sizeof(uint64_t) / 1048576.0;
+        printf("--- Topology Benchmark: %u routers, %llu directed links (built in %.3f s) ---\n", n,
+               (unsigned long long)g.num_links, build);
+        printf("Dense int matrix: %10.2f MB\n", matrix_mb);
+        printf("CSR rows:         %10.2f MB\n", csr_mb);
+        printf("Bitset:           %10.2f MB (%s)\n", bits_mb, g.link_bits ? "built" : "skipped, sparse graph");
+
+        // Neighbour iteration: sweep every row once
+        uint64_t checksum = 0;
+        start = now_seconds();
+        for (uint32_t r = 0; r < n; r++) {
+            for (uint64_t k = g.offsets[r]; k < g.offsets[r + 1]; k++) checksum += g.neighbors[k];
+        }
+        double sweep = now_seconds() - start;
+        printf("Neighbour sweep:  %10.2f ns/link (%.0f M links/s)\n", sweep * 1e9 / (double)g.num_links,
+               (double)g.num_links / sweep / 1e6);
+
+        // Link tests, half of them against real neighbours
+        uint32_t *pairs = malloc((size_t)num_queries * 2 * sizeof(uint32_t));
+        if (pairs == NULL) {
+            printf("Error: Out of memory.\n");
+            return 1;
+        }
+        for (int q = 0; q < num_queries; q++) {
+            uint32_t a = (uint32_t)(bench_rand() % n);
+            uint64_t deg = g.offsets[a + 1] - g.offsets[a];
+            pairs[2 * q] = a + 1;
+            pairs[2 * q + 1] = 1 + ((q & 1) && deg ? g.neighbors[g.offsets[a] + bench_rand() % deg]
+                                                    : (uint32_t)(bench_rand() % n));
+        }
+        uint64_t *bits = g.link_bits;
+        for (int pass = 0; pass < (bits ? 2 : 1); pass++) {
+            g.link_bits = pass == 0 ? NULL : bits;
+            uint64_t linked = 0;
+            start = now_seconds();
+            for (int q = 0; q < num_queries; q++) linked += graph_has_link(&g, pairs[2 * q], pairs[2 * q + 1]);
+            double elapsed = now_seconds() - start;
+            printf("Link test (%s): %6.2f ns/query (%llu linked)\n", pass == 0 ? "binary search" : "bitset",
+                   elapsed * 1e9 / num_queries, (unsigned long long)linked);
+        }
+        g.link_bits = bits;
+        printf("(checksum %llu)\n\n", (unsigned long long)checksum);
+
+        free(pairs);
+        graph_free(&g);
+    }
+    return 0;
+}
+
+/**
+ * @brief Writes a synthetic topology and networks file, then times the loaders
+ * against compiling the result into an image and mapping it.
+ */
+int run_config_benchmark(uint32_t num_routers) {
+    const uint32_t degree = 6;
+    const uint32_t networks_per_router = 10;
+    char topology_file[] = "/tmp/router-topology-XXXXXX";
+    char networks_file[] = "/tmp/router-networks-XXXXXX";
+    char image_file[] = "/tmp/router-image-XXXXXX";
+    int image_fd = mkstemp(image_file);
+    if (image_fd >= 0) close(image_fd);
+    int topology_fd = mkstemp(topology_file);
+    int networks_fd = mkstemp(networks_file);
+    FILE *topology_out = topology_fd >= 0 ? fdopen(topology_fd, "w") : NULL;
+    FILE *networks_out = networks_fd >= 0 ? fdopen(networks_fd, "w") : NULL;
+    if (topology_out == NULL || networks_out == NULL) {
+        printf("Error: Cannot create files in /tmp.\n");
+        return 1;
+    }
+
+    printf("--- Configuration Loader Benchmark: %u routers, %u links, %u networks ---\n", num_routers,
+           num_routers * (degree / 2), num_routers * networks_per_router);
+    for (uint64_t l = 0; l < (uint64_t)num_routers * (degree / 2); l++) {
+        uint32_t a = (uint32_t)(l % num_routers);
+        uint32_t b = l < num_routers ? (a + 1) % num_routers : (uint32_t)(bench_rand() % num_routers);
+        fprintf(topology_out, "%u %u %u\n", a + 1, b + 1, 1 + (uint32_t)(bench_rand() % 100));
+    }
+    for (uint64_t n = 0; n < (uint64_t)num_routers * networks_per_router; n++) {
+        char text[MAX_IP_LEN];
+        format_ipv4((uint32_t)bench_rand(), text);
+        fprintf(networks_out, "%u,%s/%u\n", 1 + (uint32_t)(n % num_routers), text, bench_prefix_len());
+    }
+    fclose(topology_out);
+    fclose(networks_out);
+
+    struct Graph g;
+    struct Fib fib;
+    struct RouterConfig config = { 0 };
+    struct stat st;
+    int status = 1;
+    fib_init(&fib);
+
+    double start = now_seconds();
+    if (!load_topology_file(topology_file, &g)) goto cleanup;
+    double topology_time = now_seconds() - start;
+    stat(topology_file, &st);
+    printf("Topology: %7.1f ms (%.1f MB, %.1f M links/s)\n", topology_time * 1e3, st.st_size / 1048576.0,
+           (double)g.num_links / 2 / topology_time / 1e6);
+
+    start = now_seconds();
+    if (!load_networks_file(networks_file, g.num_routers, &config, &fib)) {
+        graph_free(&g);
+        goto cleanup;
+    }
+    fib_build_index(&fib);
+    double networks_time = now_seconds() - start;
+    stat(networks_file, &st);
+    printf("Networks: %7.1f ms (%.1f MB, %.1f M networks/s, %u distinct prefixes in the FIB)\n",
+           networks_time * 1e3, st.st_size / 1048576.0, (double)config.count / networks_time / 1e6,
+           fib.num_prefixes);
+    printf("Total:    %7.1f ms\n", (topology_time + networks_time) * 1e3);
+
+    // Compiled image: mapping alone, then with every page faulted in
+    start = now_seconds();
+    if (!image_write(image_file, &g, &fib, NULL)) {
+        graph_free(&g);
+        goto cleanup;
+    }
+    double write_time = now_seconds() - start;
+    struct NetworkImage img;
+    struct Graph mapped_graph;
+    struct Fib mapped_fib;
+    struct NextHopTable mapped_next_hops;
+    start = now_seconds();
+    if (!image_open(image_file, &img, &mapped_graph, &mapped_fib, &mapped_next_hops)) {
+        graph_free(&g);
+        goto cleanup;
+    }
+    double map_time = now_seconds() - start;
+    volatile uint64_t touched = 0;
+    for (size_t off = 0; off < img.size; off += 4096) touched += ((const uint8_t *)img.data)[off];
+    double fault_time = now_seconds() - start;
+
+    int mismatches = 0;
+    for (int i = 0; i < 1000000; i++) {
+        uint32_t addr = (uint32_t)bench_rand();
+        mismatches += fib_lookup(&mapped_fib, addr) != fib_lookup(&fib, addr);
+    }
+    for (uint32_t r = 0; r < g.num_routers; r += 97) {
+        mismatches += mapped_graph.offsets[r + 1] != g.offsets[r + 1];
+    }
+    printf("Image:    %7.1f ms to map, %.1f ms with all pages faulted in (%.1f MB, written in %.1f ms), "
+           "%.0fx faster than loading; %d mismatches\n",
+           map_time * 1e3, fault_time * 1e3, img.size / 1e6, write_time * 1e3,
+           (topology_time + networks_time) / fault_time, mismatches);
+    image_close(&img);
+    graph_free(&g);
+    status = 0;
+
+cleanup:
+    router_config_free(&config);
+    fib_free(&fib);
+    unlink(topology_file);
+    unlink(networks_file);
+    unlink(image_file);
+    return status;
+}
+
+/**
+ * @brief Runs the batch query engine on a synthetic network and query trace
+ * with 1, 2, 4, ... threads (up to --threads or the online CPUs).
+ */
+int run_query_benchmark(uint32_t num_routers) {
+    const int num_queries = 4000000;
+    const uint32_t hot_pairs = 200000;
+    int max_threads = num_worker_threads > 0 ? num_worker_threads : default_thread_count();
+    if (num_routers > 65536) num_routers = 65536; // One /24 per router inside 10.0.0.0/8
+
+    struct Graph g;
+    struct Fib fib;
+    struct NextHopTable table;
+    fib_init(&fib);
+    if (!bench_make_graph(&g, num_routers, 6, false) || !next_hop_table_build(&table, &g, max_threads)) {
+        printf("Error: Out of memory.\n");
+        return 1;
+    }
+    for (uint32_t r = 0; r < num_routers; r++) fib_insert(&fib, 0x0A000000u | (r << 8), 24, (int)r + 1);
+    fib_build_index(&fib);
+    struct NetworkSnapshot net = { .fib = &fib, .graph = &g, .next_hops = &table };
+
+    // Trace: random pairs drawn from a hot set, so most queries hit the caches
+    char *text = malloc((size_t)num_queries * 2 * MAX_IP_LEN);
+    uint32_t *pairs = malloc(hot_pairs * 2 * sizeof(uint32_t));
+    FILE *sink = fopen("/dev/null", "w");
+    if (text == NULL || pairs == NULL || sink == NULL) {
+        printf("Error: Out of memory.\n");
+        return 1;
+    }
+    for (uint32_t i = 0; i < hot_pairs * 2; i++) {
+        pairs[i] = 0x0A000000u | (uint32_t)(bench_rand() % num_routers) << 8 | (uint32_t)(bench_rand() & 0xFF);
+    }
+    size_t len = 0;
+    for (int q = 0; q < num_queries; q++) {
+        uint32_t k = (uint32_t)(bench_rand() % hot_pairs);
+        format_ipv4(pairs[2 * k], text + len);
+        len += strlen(text + len);
+        text[len++] = ' ';
+        format_ipv4(pairs[2 * k + 1], text + len);
+        len += strlen(text + len);
+        text[len++] = '\n';
+    }
+
+    printf("--- Batch Query Benchmark: %u routers, %d queries over %u distinct pairs ---\n", num_routers, num_queries,
+           hot_pairs);
+    double base_rate = 0;
+    for (int threads = 1;; threads = threads * 2 < max_threads ? threads * 2 : max_threads) {
+        struct BatchStats stats;
+        struct RouteCache cache_total;
+        double start = now_seconds();
+        if (!batch_run(&net, text, len, NULL, sink, threads, 0, &stats, &cache_total, NULL, NULL)) {
+            printf("Error: Out of memory.\n");
+            return 1;
+        }
+        double rate = stats.queries / (now_seconds() - start);
+        if (threads == 1) base_rate = rate;
+        printf("%3d threads: %10.0f queries/s (%.2fx), cache hit rate %.1f%%\n", threads, rate, rate / base_rate,
+               100.0 * cache_total.hits / (cache_total.hits + cache_total.misses));
+        if (threads == max_threads) break;
+    }
+
+    // Second trace: the same number of host pairs behind only a few router
+    // pairs, cached per address pair and per router pair
+    const uint32_t router_pairs = 2000;
+    len = 0;
+    for (uint32_t i = 0; i < hot_pairs; i++) {
+        uint64_t seed = (i % router_pairs) * 0x9E3779B97F4A7C15ull;
+        pairs[2 * i] = 0x0A000000u | (uint32_t)((seed >> 20) % num_routers) << 8 | (uint32_t)(bench_rand() & 0xFF);
+        pairs[2 * i + 1] = 0x0A000000u | (uint32_t)((seed >> 40) % num_routers) << 8 | (uint32_t)(bench_rand() & 0xFF);
+    }
+    for (int q = 0; q < num_queries; q++) {
+        uint32_t k = (uint32_t)(bench_rand() % hot_pairs);
+        format_ipv4(pairs[2 * k], text + len);
+        len += strlen(text + len);
+        text[len++] = ' ';
+        format_ipv4(pairs[2 * k + 1], text + len);
+        len += strlen(text + len);
+        text[len++] = '\n';
+    }
+    printf("--- Route cache keys: %d queries, %u host pairs behind %u router pairs, 1 thread ---\n", num_queries,
+           hot_pairs, router_pairs);
+    for (int per_flow = 1; per_flow >= 0; per_flow--) {
+        struct BatchStats stats;
+        struct RouteCache cache_total;
+        route_cache_per_flow = per_flow;
+        double start = now_seconds();
+        if (!batch_run(&net, text, len, NULL, sink, 1, 0, &stats, &cache_total, NULL, NULL)) {
+            printf("Error: Out of memory.\n");
+            return 1;
+        }
+        double rate = stats.queries / (now_seconds() - start);
+        printf("%s: %10.0f queries/s, %7zu entries (%6.2f MB), hit rate %.1f%%\n",
+               per_flow ? "Address pairs" : "Router pairs ", rate, cache_total.count,
+               cache_total.count * (sizeof(uint64_t) + sizeof(struct RouteCacheValue)) / 1e6,
+               100.0 * cache_total.hits / (cache_total.hits + cache_total.misses));
+    }
+    route_cache_per_flow = ecmp_mode;
+
+    fclose(sink);
+    free(text);
+    free(pairs);
+    fib_free(&fib);
+    graph_free(&g);
+    next_hop_table_free(&table);
+    return 0;
+}
+
+// Shared state of the update benchmark's reader threads
+struct UpdateBenchJob {
+    struct SnapshotDomain *domain;
+    struct QueryWorker *workers;
+    const uint32_t *pairs;
+    uint32_t num_pairs;
+    atomic_int next_worker;
+    atomic_bool stop;
+    atomic_uint_fast64_t queries;
+};
+
+static void *update_bench_reader(void *arg) {
+    struct UpdateBenchJob *job = arg;
+    struct QueryWorker *w = &job->workers[atomic_fetch_add(&job->next_worker, 1)];
+    uint64_t x = 0x2545F4914F6CDD1Dull ^ (uint64_t)(w - job->workers), done = 0;
+
+    while (!atomic_load_explicit(&job->stop, memory_order_relaxed)) {
+        query_worker_sync(w, snapshot_read_begin(job->domain, w->reader_slot));
+        for (int q = 0; q < 256; q++) {
+            x ^= x >> 12, x ^= x << 25, x ^= x >> 27;
+            uint32_t k = (uint32_t)((x * 0x2545F4914F6CDD1Dull) >> 32) % job->num_pairs;
+            uint32_t hop_count;
+            uint64_t cost;
+            query_worker_route(w, job->pairs[2 * k], job->pairs[2 * k + 1], &hop_count, &cost);
+        }
+        snapshot_read_end(job->domain, w->reader_slot);
+        done += 256;
+    }
+    atomic_fetch_add(&job->queries, done);
+    return NULL;
+}
+
+/**
+ * @brief Flaps random links (down, then up again) while reader threads keep
+ * routing queries, and reports update latency, reader throughput and how
+ * many cached routes each change invalidated compared to a full flush.
+ * Then replays a batch file with link flaps between its queries on one and
+ * on several threads, and checks that the answers agree.
+ */
+int run_update_benchmark(uint32_t num_routers) {
+    const int num_flaps = 50;
+    const uint32_t hot_pairs = 20000;
+    int readers = num_worker_threads > 0 ? num_worker_threads : default_thread_count();
+    if (readers > MAX_SNAPSHOT_READERS - 1) readers = MAX_SNAPSHOT_READERS - 1;
+    if (num_routers > 65536) num_routers = 65536; // One /24 per router inside 10.0.0.0/8
+
+    struct Graph g;
+    struct Fib fib;
+    struct SnapshotDomain domain;
+    fib_init(&fib);
+    if (!bench_make_graph(&g, num_routers, 6, false)) {
+        printf("Error: Out of memory.\n");
+        return 1;
+    }
+    for (uint32_t r = 0; r < num_routers; r++) fib_insert(&fib, 0x0A000000u | (r << 8), 24, (int)r + 1);
+    fib_build_index(&fib);
+    struct NetworkSnapshot net = { .fib = &fib, .graph = &g };
+
+    struct UpdateBenchJob job = { .domain = &domain, .num_pairs = hot_pairs };
+    uint32_t *pairs = malloc(hot_pairs * 2 * sizeof(uint32_t));
+    double *samples = malloc(2 * num_flaps * sizeof(double));
+    job.workers = calloc((size_t)readers, sizeof(struct QueryWorker));
+    if (pairs == NULL || samples == NULL || job.workers == NULL || !snapshot_domain_init(&domain, &net)) {
+        printf("Error: Out of memory.\n");
+        return 1;
+    }
+    for (uint32_t i = 0; i < hot_pairs * 2; i++) {
+        pairs[i] = 0x0A000000u | (uint32_t)(bench_rand() % num_routers) << 8 | (uint32_t)(bench_rand() & 0xFF);
+    }
+    job.pairs = pairs;
+    for (int i = 0; i < readers; i++) {
+        if (!query_worker_init(&job.workers[i], &net, 0)) {
+            printf("Error: Out of memory.\n");
+            return 1;
+        }
+        job.workers[i].domain = &domain;
+        job.workers[i].reader_slot = snapshot_reader_register(&domain);
+        // Warm the cache so invalidation has something to choose from
+        for (uint32_t k = 0; k < hot_pairs; k++) {
+            uint32_t hop_count;
+            uint64_t cost;
+            query_worker_route(&job.workers[i], pairs[2 * k], pairs[2 * k + 1], &hop_count, &cost);
+        }
+    }
+    atomic_init(&job.next_worker, 0);
+    atomic_init(&job.stop, false);
+    atomic_init(&job.queries, 0);
+
+    printf("--- Live Update Benchmark: %u routers, %d reader threads, %d link flaps ---\n", num_routers, readers,
+           num_flaps);
+    pthread_t *threads = malloc((size_t)readers * sizeof(pthread_t));
+    int started = 0;
+    while (threads && started < readers && pthread_create(&threads[started], NULL, update_bench_reader, &job) == 0) {
+        started++;
+    }
+    if (started < readers) {
+        printf("Error: Could not start reader threads.\n");
+        return 1;
+    }
+
+    double start = now_seconds();
+    int applied = 0;
+    for (int f = 0; f < num_flaps; f++) {
+        // Pick a random link of the current topology
+        const struct NetworkSnapshot *cur = atomic_load(&domain.current);
+        uint32_t a;
+        do {
+            a = (uint32_t)(bench_rand() % num_routers);
+        } while (cur->graph->offsets[a + 1] == cur->graph->offsets[a]);
+        uint32_t b = cur->graph->neighbors[cur->graph->offsets[a] + bench_rand() % (cur->graph->offsets[a + 1] - cur->graph->offsets[a])];
+        struct NetworkChange down = { .kind = CHANGE_LINK_DOWN, .a = a + 1, .b = b + 1 };
+        struct NetworkChange up = { .kind = CHANGE_LINK_UP, .a = a + 1, .b = b + 1, .cost = 1 };
+        const char *error;
+        for (int step = 0; step < 2; step++) {
+            double t0 = now_seconds();
+            if (network_apply_change(&domain, step == 0 ? &down : &up, &error)) applied++;
+            samples[2 * f + step] = (now_seconds() - t0) * 1e6;
+            usleep(2000); // Let the readers pick up the change
+        }
+    }
+    atomic_store(&job.stop, true);
+    for (int i = 0; i < started; i++) pthread_join(threads[i], NULL);
+    double elapsed = now_seconds() - start;
+
+    uint64_t invalidated = 0, flush_equivalent = 0;
+    for (int i = 0; i < readers; i++) {
+        invalidated += job.workers[i].invalidated;
+        flush_equivalent += job.workers[i].flush_equivalent;
+    }
+    printf("%d changes applied in %.2f s; readers answered %.0f queries/s meanwhile\n", applied, elapsed,
+           (double)atomic_load(&job.queries) / elapsed);
+    print_latency_summary("Update (build + publish + grace period)", samples, 2 * num_flaps);
+    printf("Cached routes invalidated: %llu of %llu a full flush would drop (%.2f%%)\n",
+           (unsigned long long)invalidated, (unsigned long long)flush_equivalent,
+           flush_equivalent ? 100.0 * invalidated / flush_equivalent : 0.0);
+
+    // Batch replay: queries with link flaps in between must get the same
+    // answers on several threads as on one
+    enum { replay_queries = 400000, replay_flaps = 20 };
+    size_t len = 0, capacity = (size_t)replay_queries * 40 + replay_flaps * 2 * 48;
+    char *text = malloc(capacity);
+    char *answers[2] = { NULL, NULL };
+    size_t answer_len[2] = { 0, 0 };
+    int replay_threads[2] = { 1, readers > 4 ? readers : 4 };
+    bool ok = text != NULL;
+    uint32_t a = 0, b = 0;
+    for (int q = 0; ok && q < replay_queries; q++) {
+        if (q % (replay_queries / (2 * replay_flaps)) == 0) {
+            // Down at even steps, back up at odd ones
+            if (q % (replay_queries / replay_flaps) == 0) {
+                a = (uint32_t)(bench_rand() % num_routers);
+                b = g.neighbors[g.offsets[a] + bench_rand() % (g.offsets[a + 1] - g.offsets[a])];
+                len += (size_t)sprintf(text + len, "link down %u %u\n", a + 1, b + 1);
+            } else {
+                len += (size_t)sprintf(text + len, "link up %u %u\n", a + 1, b + 1);
+            }
+        }
+        uint32_t k = (uint32_t)(bench_rand() % hot_pairs);
+        format_ipv4(pairs[2 * k], text + len);
+        len += strlen(text + len);
+        text[len++] = ' ';
+        format_ipv4(pairs[2 * k + 1], text + len);
+        len += strlen(text + len);
+        text[len++] = '\n';
+    }
+    for (int run = 0; ok && run < 2; run++) {
+        struct BatchStats stats;
+        FILE *out = open_memstream(&answers[run], &answer_len[run]);
+        ok = out != NULL && batch_run(&net, text, len, NULL, out, replay_threads[run], 0, &stats, NULL, NULL, NULL);
+        if (out) fclose(out);
+    }
+    if (!ok) {
+        printf("Error: Out of memory.\n");
+        return 1;
+    }
+    // Answers must agree on the pair and the cost (or "none"). The hops may
+    // differ: a thread keeps a cached route that a change left as short as
+    // any, where another thread computes an equal-cost one afresh.
+    uint64_t differing = 0, equal_cost = 0;
+    const char *x = answers[0], *x_end = answers[0] + answer_len[0];
+    const char *y = answers[1], *y_end = answers[1] + answer_len[1];
+    while (x < x_end || y < y_end) {
+        const char *xl = x < x_end ? batch_line_after(x, x_end) : x;
+        const char *yl = y < y_end ? batch_line_after(y, y_end) : y;
+        if ((size_t)(xl - x) != (size_t)(yl - y) || memcmp(x, y, (size_t)(xl - x)) != 0) {
+            // Compare "src dst " and the last field
+            const char *xs = x, *ys = y, *xc = xl - 1, *yc = yl - 1;
+            for (int f = 0; f < 2; f++) {
+                while (xs < xl && *xs != ' ') xs++;
+                while (ys < yl && *ys != ' ') ys++;
+                xs += xs < xl;
+                ys += ys < yl;
+            }
+            while (xc > x && xc[-1] != ' ') xc--;
+            while (yc > y && yc[-1] != ' ') yc--;
+            bool same = xs - x == ys - y && memcmp(x, y, (size_t)(xs - x)) == 0 && xl - xc == yl - yc &&
+                        memcmp(xc, yc, (size_t)(xl - xc)) == 0;
+            if (same) equal_cost++;
+            else differing++;
+        }
+        x = xl;
+        y = yl;
+    }
+    printf("Batch replay with %d link flaps: %llu of %d answers differ between 1 and %d threads (%llu more take "
+           "another route of the same cost)\n",
+           replay_flaps, (unsigned long long)differing, replay_queries, replay_threads[1],
+           (unsigned long long)equal_cost);
+    free(text);
+    free(answers[0]);
+    free(answers[1]);
+
+    for (int i = 0; i < readers; i++) query_worker_free(&job.workers[i]);
+    snapshot_domain_destroy(&domain);
+    free(threads);
+    free(job.workers);
+    free(pairs);
+    free(samples);
+    fib_free(&fib);
+    graph_free(&g);
+    return differing == 0 ? 0 : 1;
+}
+
+/**
+ * @brief Compares incremental next-hop repair against a full rebuild for
+ * link failures, restorations and new links, and checks the repaired table
+ * against exact distances from sampled sources.
+ */
+int run_repair_benchmark(uint32_t num_routers) {
+    enum { num_changes = 10 };
+    const int num_checked_sources = 50;
+    int threads = num_worker_threads > 0 ? num_worker_threads : default_thread_count();
+
+    for (int weighted = 0; weighted <= 1; weighted++) {
+        // Weighted tables are built with one Dijkstra per source: use a smaller graph
+        uint32_t n = weighted ? (num_routers / 5 > 2 ? num_routers / 5 : 2) : num_routers;
+        struct Graph g;
+        struct NextHopTable table;
+        struct SearchWorkspace ws;
+        uint64_t *dist = malloc((size_t)n * sizeof(uint64_t));
+        double *samples = malloc(3 * num_changes * sizeof(double));
+        if (dist == NULL || samples == NULL || !bench_make_graph(&g, n, 6, weighted) ||
+            !search_workspace_init(&ws, n)) {
+            printf("Error: Out of memory.\n");
+            return 1;
+        }
+        double start = now_seconds();
+        if (!next_hop_table_build(&table, &g, threads)) {
+            printf("Error: Out of memory.\n");
+            return 1;
+        }
+        double full = now_seconds() - start;
+        printf("--- Next-Hop Repair Benchmark: %u routers, %s, %d threads ---\n", n,
+               weighted ? "weighted (Dijkstra)" : "unit cost (BFS)", threads);
+        printf("Full rebuild: %.1f ms\n", full * 1e3);
+
+        uint64_t mismatches = 0;
+        int count = 0;
+        uint32_t failed[3 * num_changes][3];
+        for (int c = 0; c < 3 * num_changes; c++) {
+            // Rounds: fail links, restore them, then add brand-new links
+            int kind = c / num_changes;
+            uint32_t a, b, cost;
+            if (kind == 1) {
+                a = failed[c - num_changes][0];
+                b = failed[c - num_changes][1];
+                cost = failed[c - num_changes][2];
+            } else {
+                uint64_t degree;
+                do {
+                    a = (uint32_t)(bench_rand() % n);
+                    degree = g.offsets[a + 1] - g.offsets[a];
+                    b = kind == 0 && degree ? g.neighbors[g.offsets[a] + bench_rand() % degree]
+                                            : (uint32_t)(bench_rand() % n);
+                } while (degree < 2 || a == b);
+                cost = kind == 0 ? (uint32_t)graph_link_cost(&g, a + 1, b + 1)
+                                 : (weighted ? 1 + (uint32_t)(bench_rand() % 100) : 1);
+                failed[c][0] = a;
+                failed[c][1] = b;
+                failed[c][2] = cost;
+            }
+
+            struct Graph next;
+            if (!graph_with_link(&g, a + 1, b + 1, cost, kind != 0, &next)) {
+                printf("Error: Out of memory.\n");
+                return 1;
+            }
+            start = now_seconds();
+            bool repaired = next_hop_table_update(&table, &g, &next, a + 1, b + 1, threads);
+            samples[count++] = (now_seconds() - start) * 1e6;
+            graph_free(&g);
+            g = next;
+            if (!repaired) {
+                next_hop_table_free(&table);
+                if (!next_hop_table_build(&table, &g, threads)) {
+                    printf("Error: Out of memory.\n");
+                    return 1;
+                }
+            }
+
+            // Exact check: every destination of a few sources
+            for (int k = 0; k < num_checked_sources; k++) {
+                uint32_t src = (uint32_t)(bench_rand() % n);
+                graph_distances(&g, &ws, src + 1, dist);
+                for (uint32_t d = 0; d < n; d++) mismatches += next_hop_distance(&table, &g, src, d) != dist[d];
+            }
+        }
+        print_latency_summary("Incremental repair", samples, count);
+        qsort(samples, count, sizeof(double), compare_doubles);
+        printf("Speedup over full rebuild (median): %.0fx; %llu mismatches over %d x %d x %u checked routes\n\n",
+               full * 1e6 / samples[count / 2], (unsigned long long)mismatches, count, num_checked_sources, n);
+
+        graph_free(&g);
+        next_hop_table_free(&table);
+        search_workspace_free(&ws);
+        free(dist);
+        free(samples);
+        if (mismatches) return 1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Spreads many flows between a few router pairs over equal-cost paths
+ * and compares the resulting link load with single-path routing. Also checks
+ * that every ECMP path is a shortest one, that the search-based and
+ * table-based variants agree, and that a flow always gets the same path.
+ */
+int run_ecmp_benchmark(uint32_t num_routers) {
+    enum { num_pairs = 64, flows_per_pair = 4096, num_checked = 16 };
+    const int num_hashes = 10000000;
+    int threads = num_worker_threads > 0 ? num_worker_threads : default_thread_count();
+    struct Graph g;
+    struct NextHopTable table;
+    struct SearchWorkspace ws;
+    struct PathBuilder path, check;
+    struct PathPool pool;
+    struct LinkLoad single, ecmp, pair_load;
+
+    path_builder_init(&path);
+    path_builder_init(&check);
+    if (!bench_make_graph(&g, num_routers, 6, false) || !search_workspace_init(&ws, num_routers) ||
+        !next_hop_table_build(&table, &g, threads) || !path_pool_init(&pool) || !link_load_init(&single) ||
+        !link_load_init(&ecmp)) {
+        printf("Error: Out of memory.\n");
+        return 1;
+    }
+    printf("--- ECMP Benchmark: %u routers, %d router pairs x %d flows ---\n", num_routers, num_pairs, flows_per_pair);
+
+    uint64_t cost_mismatches = 0, variant_mismatches = 0, pin_mismatches = 0, distinct = 0, routed_pairs = 0;
+    double single_time = 0, ecmp_time = 0, bottleneck_share = 0;
+    for (int p = 0; p < num_pairs; p++) {
+        uint32_t src = 1 + (uint32_t)(bench_rand() % num_routers), dst = 1 + (uint32_t)(bench_rand() % num_routers);
+        uint64_t single_cost;
+        path.length = 0;
+        double start = now_seconds();
+        if (!next_hop_path(&table, &g, src, dst, &path)) continue;
+        single_time += now_seconds() - start;
+        single_cost = graph_path_cost(&g, path.hops, path.length);
+        for (uint32_t i = 1; i < path.length; i++) link_load_add(&single, path.hops[i - 1], path.hops[i], flows_per_pair);
+
+        uint32_t first_id = pool.count;
+        if (!link_load_init(&pair_load)) {
+            printf("Error: Out of memory.\n");
+            return 1;
+        }
+        for (int f = 0; f < flows_per_pair; f++) {
+            uint32_t flow = flow_hash((uint32_t)bench_rand(), (uint32_t)bench_rand());
+            uint64_t cost;
+            path.length = 0;
+            start = now_seconds();
+            if (!next_hop_ecmp_path(&table, &g, &ws, src, dst, flow, &path, &cost)) {
+                printf("Error: Out of memory.\n");
+                return 1;
+            }
+            ecmp_time += now_seconds() - start;
+            cost_mismatches += cost != single_cost || graph_path_cost(&g, path.hops, path.length) != cost;
+            link_load_add_path(&ecmp, path.hops, path.length);
+            link_load_add_path(&pair_load, path.hops, path.length);
+            path_pool_intern(&pool, path.hops, path.length);
+
+            if (f < num_checked) {
+                // Same flow again, and through the search-based variant
+                check.length = 0;
+                next_hop_ecmp_path(&table, &g, &ws, src, dst, flow, &check, NULL);
+                pin_mismatches += check.length != path.length ||
+                                  memcmp(check.hops, path.hops, path.length * sizeof(uint32_t)) != 0;
+                check.length = 0;
+                graph_ecmp_path(&g, &ws, src, dst, flow, &check, NULL);
+                variant_mismatches += check.length != path.length ||
+                                      memcmp(check.hops, path.hops, path.length * sizeof(uint32_t)) != 0;
+            }
+        }
+        distinct += pool.count - first_id;
+
+        // Share of the pair's flows on its busiest link (always 100% with a single path)
+        uint64_t busiest = 0;
+        for (uint64_t i = 0; i <= pair_load.mask; i++) {
+            if (pair_load.keys[i] != ROUTE_CACHE_EMPTY && pair_load.flows[i] > busiest) busiest = pair_load.flows[i];
+        }
+        if (path.length > 1) {
+            bottleneck_share += (double)busiest / flows_per_pair;
+            routed_pairs++;
+        }
+        link_load_free(&pair_load);
+    }
+
+    printf("Single path: %8.1f ns/route; ECMP: %8.1f ns/route; %.1f distinct equal-cost paths per pair\n",
+           single_time * 1e9 / num_pairs, ecmp_time * 1e9 / ((double)num_pairs * flows_per_pair),
+           (double)distinct / num_pairs);
+    link_load_print(&single, "Link load (single path)", stdout);
+    link_load_print(&ecmp, "Link load (ECMP)       ", stdout);
+    printf("Busiest link of a pair carries %.1f%% of its flows with ECMP (100%% with a single path)\n",
+           routed_pairs ? 100.0 * bottleneck_share / routed_pairs : 100.0);
+
+    uint32_t checksum = 0;
+    double start = now_seconds();
+    for (int i = 0; i < num_hashes; i++) checksum += flow_hash((uint32_t)i, (uint32_t)i * 0x9E3779B1u);
+    double hash_time = now_seconds() - start;
+#ifdef __SSE4_2__
+    const char *hash_kind = "CRC32C (SSE4.2)";
+#else
+    const char *hash_kind = "multiply-shift";
+#endif
+    printf("Flow hash, %s: %.2f ns/flow (checksum %u)\n", hash_kind, hash_time * 1e9 / num_hashes, checksum);
+    printf("%llu non-shortest paths, %llu search/table disagreements, %llu unpinned flows (%d checked per pair)\n",
+           (unsigned long long)cost_mismatches, (unsigned long long)variant_mismatches,
+           (unsigned long long)pin_mismatches, num_checked);
+
+    graph_free(&g);
+    next_hop_table_free(&table);
+    search_workspace_free(&ws);
+    path_builder_free(&path);
+    path_builder_free(&check);
+    path_pool_free(&pool);
+    link_load_free(&single);
+    link_load_free(&ecmp);
+    return cost_mismatches || variant_mismatches || pin_mismatches ? 1 : 0;
+}
+
+/**
+ * @brief Measures all-pairs next-hop table build time, memory and lookup speed.
+ * @param sizes Router counts to test.
+ */
+int run_apsp_benchmark(const uint32_t *sizes, int num_sizes) {
+    const int num_queries = 1000000;
+    const int num_checks = 200;
+    int threads = num_worker_threads > 0 ? num_worker_threads : default_thread_count();
+
+    printf("--- All-Pairs Next-Hop Benchmark (%d threads) ---\n", threads);
+    for (int si = 0; si < num_sizes; si++) {
+        uint32_t n = sizes[si];
+        // Per-source Dijkstra is O(n m log n): only run the weighted build on smaller graphs
+        for (int weighted = 0; weighted <= (n <= 10000); weighted++) {
+            struct Graph g;
+            struct NextHopTable table;
+            struct SearchWorkspace ws;
+            if (!bench_make_graph(&g, n, 6, weighted) || !search_workspace_init(&ws, n)) {
+                printf("Error: Out of memory.\n");
+                return 1;
+            }
+
+            double start = now_seconds();
+            if (!next_hop_table_build(&table, &g, threads)) {
+                printf("%u routers: out of memory for the %.1f GB table\n", n, (double)n * n / 1e9);
+                graph_free(&g);
+                search_workspace_free(&ws);
+                continue;
+            }
+            double build_time = now_seconds() - start;
+
+            uint64_t total_hops = 0;
+            start = now_seconds();
+            for (int q = 0; q < num_queries; q++) {
+                struct PathBuilder path;
+                path_builder_init(&path);
+                next_hop_path(&table, &g, 1 + (uint32_t)(bench_rand() % n), 1 + (uint32_t)(bench_rand() % n), &path);
+                total_hops += path.length - 1;
+                path_builder_free(&path);
+            }
+            double query_time = now_seconds() - start;
+
+            // Every table path must be as short as the on-demand search says
+            int mismatches = 0;
+            for (int c = 0; c < num_checks; c++) {
+                uint32_t src = 1 + (uint32_t)(bench_rand() % n), dst = 1 + (uint32_t)(bench_rand() % n);
+                struct PathBuilder a, b;
+                uint64_t expected = 0, cost = 0;
+                path_builder_init(&a);
+                path_builder_init(&b);
+                bool found = graph_shortest_path(&g, &ws, src, dst, &a, &expected);
+                bool table_found = next_hop_path(&table, &g, src, dst, &b);
+                // Sum the cost of the exact links the table chose (parallel links may differ)
+                for (uint32_t u = src - 1; table_found && u != dst - 1;) {
+                    uint64_t k = g.offsets[u] + next_hop_get(&table, u, dst - 1);
+                    cost += g.weights ? g.weights[k] : 1;
+                    u = g.neighbors[k];
+                }
+                if (found != table_found || cost != expected) mismatches++;
+                path_builder_free(&a);
+                path_builder_free(&b);
+            }
+
+            printf("%6u routers (%s): build %8.3f s, table %8.1f MB, path query %6.1f ns (%.2f hops avg), %d/%d mismatches\n",
+                   n, weighted ? "weighted, Dijkstra" : "unit-cost, bit-parallel BFS", build_time,
+                   table.row_stride * n * table.entry_bytes / 1e6, query_time * 1e9 / num_queries,
+                   (double)total_hops / num_queries, mismatches, num_checks);
+
+            next_hop_table_free(&table);
+            search_workspace_free(&ws);
+            graph_free(&g);
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief Legacy path encoding: concatenates two integers as decimal text (1, 2 -> 12).
+ * Kept as the path benchmark baseline; overflows after ~18 digits.
+ */
+long long concat_router_ids(long long current_val, int new_id) {
+    char s1[32], s2[32];
+    sprintf(s1, "%lld", current_val);
+    sprintf(s2, "%d", new_id);
+    strcat(s1, s2);
+    return atoll(s1);
+}
+
+/**
+ * @brief Measures path building and interning against the legacy concat_router_ids.
+ * @param num_paths Number of paths to build; most repeat one of a few hot paths.
+ */
+int run_path_benchmark(int num_paths) {
+    const int distinct = 1000;
+    const uint32_t num_routers = 100000;
+
+    printf("--- Path Benchmark: %d paths ---\n", num_paths);
+
+    // Distinct hop sequences of 2-32 routers; each built path repeats one of them
+    uint32_t (*templates)[32] = malloc(distinct * sizeof(*templates));
+    uint32_t *lengths = malloc(distinct * sizeof(uint32_t));
+    uint32_t *ids = malloc(num_paths * sizeof(uint32_t));
+    if (templates == NULL || lengths == NULL || ids == NULL) {
+        printf("Error: Out of memory.\n");
+        return 1;
+    }
+    for (int t = 0; t < distinct; t++) {
+        lengths[t] = 2 + (uint32_t)(bench_rand() % 31);
+        for (uint32_t h = 0; h < lengths[t]; h++) templates[t][h] = 1 + (uint32_t)(bench_rand() % num_routers);
+    }
+
+    struct PathPool pool;
+    if (!path_pool_init(&pool)) {
+        printf("Error: Out of memory.\n");
+        return 1;
+    }
+    uint64_t total_hops = 0;
+    double start = now_seconds();
+    for (int i = 0; i < num_paths; i++) {
+        int t = (int)(bench_rand() % distinct);
+        struct PathBuilder pb;
+        path_builder_init(&pb);
+        for (uint32_t h = 0; h < lengths[t]; h++) path_builder_push(&pb, templates[t][h]);
+        ids[i] = path_pool_intern(&pool, pb.hops, pb.length);
+        total_hops += pb.length;
+        path_builder_free(&pb);
+    }
+    double pool_time = now_seconds() - start;
+    printf("Builder + intern: %6.1f ns/hop, %6.1f ns/path\n", pool_time * 1e9 / total_hops, pool_time * 1e9 / num_paths);
+    printf("Stored: %u unique paths, %llu hops, %.1f KB (vs %.1f MB without dedup)\n", pool.count - 1,
+           (unsigned long long)pool.hops_used,
+           (pool.hops_used * sizeof(uint32_t) + pool.count * sizeof(struct PathRecord)) / 1e3,
+           total_hops * sizeof(uint32_t) / 1e6);
+
+    // Legacy: only paths of single-digit routers and at most 18 hops survive concat_router_ids
+    long long checksum = 0;
+    uint64_t legacy_hops = 0;
+    start = now_seconds();
+    for (int i = 0; i < num_paths; i++) {
+        int t = (int)(bench_rand() % distinct);
+        uint32_t len = lengths[t] < 18 ? lengths[t] : 18;
+        long long path = 0;
+        for (uint32_t h = 0; h < len; h++) path = concat_router_ids(path, 1 + templates[t][h] % 9);
+        checksum ^= path;
+        legacy_hops += len;
+    }
+    double legacy_time = now_seconds() - start;
+    printf("concat_router_ids: %6.1f ns/hop (single-digit IDs, <= 18 hops; checksum %lld)\n",
+           legacy_time * 1e9 / legacy_hops, checksum);
+    printf("Speedup: %.1fx per hop\n", (legacy_time / legacy_hops) / (pool_time / total_hops));
+
+    path_pool_free(&pool);
+    free(templates);
+    free(lengths);
+    free(ids);
+    return 0;
+}
+
+/**
+ * @brief Measures route cache lookups against the legacy "src*dst" string scan.
+ * @param num_flows Number of distinct (source, destination) flows to cache.
+ */
+int run_cache_benchmark(int num_flows) {
+    const int num_queries = 10000000;
+    const int legacy_sizes[] = { 20, 1000, 10000 }; // 20 = the original history size
+
+    printf("--- Route Cache Benchmark: %d flows ---\n", num_flows);
+
+    uint32_t *srcs = malloc(num_flows * sizeof(uint32_t));
+    uint32_t *dsts = malloc(num_flows * sizeof(uint32_t));
+    if (srcs == NULL || dsts == NULL) {
+        printf("Error: Out of memory.\n");
+        return 1;
+    }
+
+    struct RouteCache cache;
+    if (!route_cache_init(&cache, 0)) {
+        printf("Error: Out of memory.\n");
+        return 1;
+    }
+    double start = now_seconds();
+    for (int i = 0; i < num_flows; i++) {
+        srcs[i] = (uint32_t)bench_rand();
+        dsts[i] = (uint32_t)bench_rand();
+        if (!route_cache_insert(&cache, srcs[i], dsts[i], (uint32_t)i + 1, 0)) {
+            printf("Error: Out of memory.\n");
+            return 1;
+        }
+    }
+    double insert_time = now_seconds() - start;
+    printf("Insert: %.1f ns/flow, %zu entries, %.1f MB\n", insert_time * 1e9 / num_flows, cache.count,
+           (cache.mask + 1) * (sizeof(uint64_t) + sizeof(struct RouteCacheValue)) / 1e6);
 
-                // Check for direct connection from current router to the next intermediate router
-                if (connection_matrix[current_router - 1][next_router - 1] == 1) {
-                    // Valid connection: update path and current router
-                    intermediate_routers[router_index++] = next_router;
-                    route_path = concat_router_ids(route_path, next_router);
-                    current_router = next_router;
-                    
-                    // Optimization: check if the new intermediate router can connect to the destination
-                    if (connection_matrix[current_router - 1][dest_router - 1] == 1) {
-                        printf("R%d is now directly connected to Destination R%d. Type 0 to finalize or enter another intermediate router.\n", current_router, dest_router);
-                    }
-                } else {
-                    printf("Invalid path: Router R%d has no direct link to Router R%d.\n", current_router, next_router);
+    long long checksum = 0;
+    start = now_seconds();
+    for (int q = 0; q < num_queries; q++) {
+        int i = (int)(bench_rand() % num_flows);
+        checksum += route_cache_find(&cache, srcs[i], dsts[i], NULL);
+    }
+    double hit_time = now_seconds() - start;
+    printf("Hash hit:  %7.1f ns/lookup (checksum %lld)\n", hit_time * 1e9 / num_queries, checksum);
+
+    int misses = 0;
+    start = now_seconds();
+    for (int q = 0; q < num_queries; q++) {
+        misses += route_cache_find(&cache, (uint32_t)bench_rand(), (uint32_t)bench_rand(), NULL) == 0;
+    }
+    double miss_time = now_seconds() - start;
+    printf("Hash miss: %7.1f ns/lookup (%d misses)\n", miss_time * 1e9 / num_queries, misses);
+    route_cache_free(&cache);
+
+    // Bounded cache holding a quarter of the flows under skewed traffic:
+    // look up, and on a miss insert, like the routing loop does
+    if (!route_cache_init(&cache, num_flows / 4 + 1)) {
+        printf("Error: Out of memory.\n");
+        return 1;
+    }
+    start = now_seconds();
+    for (int q = 0; q < num_queries; q++) {
+        uint64_t r = bench_rand() % num_flows;
+        int i = (int)(r * (bench_rand() % num_flows) / num_flows); // Skewed towards low indices
+        if (route_cache_find(&cache, srcs[i], dsts[i], NULL) == 0) {
+            route_cache_insert(&cache, srcs[i], dsts[i], (uint32_t)i + 1, 0);
+        }
+    }
+    double clock_time = now_seconds() - start;
+    printf("CLOCK cache: %7.1f ns/query; ", clock_time * 1e9 / num_queries);
+    route_cache_print_stats(&cache, stdout);
+
+    // Legacy: sprintf the "src*dst" key, then strcmp it against every stored key
+    for (size_t s = 0; s < sizeof(legacy_sizes) / sizeof(legacy_sizes[0]); s++) {
+        int entries = legacy_sizes[s] < num_flows ? legacy_sizes[s] : num_flows;
+        int queries = 2000000 / entries;
+        char (*history)[MAX_IP_LEN * 2 + 1] = malloc((size_t)entries * (MAX_IP_LEN * 2 + 1));
+        if (history == NULL) break;
+        for (int i = 0; i < entries; i++) {
+            char a[MAX_IP_LEN], b[MAX_IP_LEN];
+            format_ipv4(srcs[i], a);
+            format_ipv4(dsts[i], b);
+            sprintf(history[i], "%s*%s", a, b);
+        }
+
+        checksum = 0;
+        start = now_seconds();
+        for (int q = 0; q < queries; q++) {
+            int i = (int)(bench_rand() % entries);
+            char a[MAX_IP_LEN], b[MAX_IP_LEN], key[MAX_IP_LEN * 2 + 1];
+            format_ipv4(srcs[i], a);
+            format_ipv4(dsts[i], b);
+            sprintf(key, "%s*%s", a, b);
+            for (int l2 = 0; l2 < entries; l2++) {
+                if (strcmp(history[l2], key) == 0) {
+                    checksum += l2;
+                    break;
                 }
+            }
+        }
+        double legacy_time = now_seconds() - start;
+        printf("Legacy scan (%6d entries): %10.1f ns/lookup (checksum %lld)\n", entries,
+               legacy_time * 1e9 / queries, checksum);
+        free(history);
+    }
 
-            } while (current_router != dest_router);
+    route_cache_free(&cache);
+    free(srcs);
+    free(dsts);
+    return 0;
+}
 
+/**
+ * @brief Compares the trie forwarding table against the legacy strcmp scan.
+ * @param num_prefixes Number of random prefixes to load into the table.
+ */
+int run_fib_benchmark(int num_prefixes) {
+    const int num_routers = 64;
+    const int num_queries = 10000000;
+    const int num_linear_queries = 200;
 
-            route_complete:; // Label for jump from direct path logic
+    printf("--- FIB Benchmark: %d prefixes ---\n", num_prefixes);
 
-            // 3. Save History and Display Result
-            if (history_count < MAX_ROUTE_HISTORY) {
-                strcpy(route_history[history_count], current_route_key);
-                intermediate_history[history_count] = route_path; // Includes Source and Destination
-                
-                printf("\n--- NEW ROUTE LOGGED ---\n");
-                printf("Source IP: %s\n", source_ip);
-                printf("Intermediate Routers Path (IDs): ");
-                long long path_temp = route_path;
-                
-                // A very crude way to display the concatenated path:
-                printf("%lld\n", path_temp); 
-                
-                printf("\nPath established: R%d ", source_router);
-                for(int i=0; i<router_index; ++i) {
-                     printf("--> R%d ", intermediate_routers[i]);
+    uint32_t *prefixes = malloc(num_prefixes * sizeof(uint32_t));
+    char (*ip_strings)[MAX_IP_LEN] = malloc((size_t)num_prefixes * MAX_IP_LEN);
+    uint32_t *queries = malloc(num_queries * sizeof(uint32_t));
+    if (prefixes == NULL || ip_strings == NULL || queries == NULL) {
+        printf("Error: Out of memory.\n");
+        return 1;
+    }
+
+    struct Fib fib;
+    fib_init(&fib);
+    double start = now_seconds();
+    for (int i = 0; i < num_prefixes; i++) {
+        uint8_t len = bench_prefix_len();
+        prefixes[i] = (uint32_t)bench_rand() & prefix_mask(len);
+        if (!fib_insert(&fib, prefixes[i], len, 1 + i % num_routers)) {
+            printf("Error: Out of memory.\n");
+            return 1;
+        }
+    }
+    if (!fib_build_index(&fib)) {
+        printf("Error: Out of memory.\n");
+        return 1;
+    }
+    double build_time = now_seconds() - start;
+    printf("Build: %.3f s, %u prefixes, %u nodes, %.1f MB\n", build_time, fib.num_prefixes, fib.count,
+           (fib.count * sizeof(struct FibNode) + (sizeof(struct FibDirectEntry) << FIB_DIRECT_BITS)) / 1e6);
+
+    // Queries land inside configured prefixes, so every lookup walks to a real match
+    for (int i = 0; i < num_queries; i++) {
+        queries[i] = prefixes[bench_rand() % num_prefixes] | ((uint32_t)bench_rand() & 0xFF);
+    }
+
+    long long checksum = 0;
+    start = now_seconds();
+    for (int i = 0; i < num_queries; i++) {
+        checksum += fib_lookup(&fib, queries[i]);
+    }
+    double trie_time = now_seconds() - start;
+    printf("Trie LPM:    %8.1f ns/lookup, %7.2f M lookups/s (checksum %lld)\n",
+           trie_time * 1e9 / num_queries, num_queries / trie_time / 1e6, checksum);
+
+    // Legacy baseline: the exact-match strcmp scan over every configured string
+    for (int i = 0; i < num_prefixes; i++) {
+        sprintf(ip_strings[i], "%u.%u.%u.%u", prefixes[i] >> 24, (prefixes[i] >> 16) & 0xFF,
+                (prefixes[i] >> 8) & 0xFF, prefixes[i] & 0xFF);
+    }
+    checksum = 0;
+    start = now_seconds();
+    for (int q = 0; q < num_linear_queries; q++) {
+        const char *needle = ip_strings[bench_rand() % num_prefixes];
+        for (int i = 0; i < num_prefixes; i++) {
+            if (strcmp(ip_strings[i], needle) == 0) {
+                checksum += 1 + i % num_routers;
+                break;
+            }
+        }
+    }
+    double linear_time = now_seconds() - start;
+    printf("strcmp scan: %8.1f ns/lookup, %7.4f M lookups/s (checksum %lld)\n",
+           linear_time * 1e9 / num_linear_queries, num_linear_queries / linear_time / 1e6, checksum);
+    printf("Speedup: %.0fx\n", (linear_time / num_linear_queries) / (trie_time / num_queries));
+
+    fib_free(&fib);
+    free(prefixes);
+    free(ip_strings);
+    free(queries);
+    return 0;
+}
+
+/**
+ * @brief Measures batched, prefetching trie lookups (fib_lookup_batch) for
+ * batches of 1 to FIB_BATCH_MAX addresses against one-at-a-time lookups.
+ * @param num_prefixes Number of random prefixes to load into the table.
+ */
+int run_fib_batch_benchmark(int num_prefixes) {
+    const int num_queries = 8000000;
+    const int batch_sizes[] = { 4, 16, 32, 64 };
+
+    printf("--- Batched FIB Benchmark: %d prefixes, %d lookups ---\n", num_prefixes, num_queries);
+
+    uint32_t *prefixes = malloc((num_prefixes ? num_prefixes : 1) * sizeof(uint32_t));
+    uint32_t *queries = malloc(num_queries * sizeof(uint32_t));
+    int *single = malloc(num_queries * sizeof(int));
+    int *batched = malloc(num_queries * sizeof(int));
+    if (prefixes == NULL || queries == NULL || single == NULL || batched == NULL) {
+        printf("Error: Out of memory.\n");
+        return 1;
+    }
+
+    struct Fib fib;
+    fib_init(&fib);
+    for (int i = 0; i < num_prefixes; i++) {
+        uint8_t len = bench_prefix_len();
+        prefixes[i] = (uint32_t)bench_rand() & prefix_mask(len);
+        if (!fib_insert(&fib, prefixes[i], len, 1 + i % 64)) {
+            printf("Error: Out of memory.\n");
+            return 1;
+        }
+    }
+    if (!fib_build_index(&fib)) {
+        printf("Error: Out of memory.\n");
+        return 1;
+    }
+    printf("Table: %u nodes, %.1f MB\n", fib.count,
+           (fib.count * sizeof(struct FibNode) + (sizeof(struct FibDirectEntry) << FIB_DIRECT_BITS)) / 1e6);
+    for (int i = 0; i < num_queries; i++) {
+        queries[i] = num_prefixes ? prefixes[bench_rand() % num_prefixes] | ((uint32_t)bench_rand() & 0xFF)
+                                  : (uint32_t)bench_rand();
+    }
+
+    long long checksum = 0;
+    double start = now_seconds();
+    for (int i = 0; i < num_queries; i++) single[i] = fib_lookup(&fib, queries[i]);
+    double single_time = now_seconds() - start;
+    for (int i = 0; i < num_queries; i++) checksum += single[i];
+    printf("One at a time: %6.1f ns/lookup (checksum %lld)\n", single_time * 1e9 / num_queries, checksum);
+
+    for (size_t s = 0; s < sizeof(batch_sizes) / sizeof(batch_sizes[0]); s++) {
+        int size = batch_sizes[s];
+        start = now_seconds();
+        for (int i = 0; i < num_queries; i += size) {
+            fib_lookup_batch(&fib, queries + i, batched + i, (size_t)(num_queries - i < size ? num_queries - i : size));
+        }
+        double batch_time = now_seconds() - start;
+        int mismatches = 0;
+        for (int i = 0; i < num_queries; i++) mismatches += batched[i] != single[i];
+        printf("Batches of %2d: %6.1f ns/lookup, %.2fx (%d mismatches)\n", size, batch_time * 1e9 / num_queries,
+               single_time / batch_time, mismatches);
+    }
+
+    fib_free(&fib);
+    free(prefixes);
+    free(queries);
+    free(single);
+    free(batched);
+    return 0;
+}
+
+/**
+ * @brief Measures the DIR-24-8 table against the trie: build time, memory,
+ * lookup latency with 4 KB and huge pages, and incremental deletes and
+ * re-inserts, checked against the trie afterwards.
+ * @param num_prefixes Number of random prefixes to load into the table.
+ */
+int run_dir24_benchmark(int num_prefixes) {
+    const int num_queries = 8000000;
+    const int num_changes = 20000;
+    const char *pages[] = { "4 KB pages", "transparent huge pages", "huge pages" };
+
+    printf("--- DIR-24-8 Benchmark: %d prefixes, %d lookups ---\n", num_prefixes, num_queries);
+
+    uint32_t *prefixes = malloc((num_prefixes ? num_prefixes : 1) * sizeof(uint32_t));
+    uint8_t *lens = malloc(num_prefixes ? num_prefixes : 1);
+    uint32_t *queries = malloc(num_queries * sizeof(uint32_t));
+    if (prefixes == NULL || lens == NULL || queries == NULL) {
+        printf("Error: Out of memory.\n");
+        return 1;
+    }
+
+    struct Fib fib;
+    fib_init(&fib);
+    for (int i = 0; i < num_prefixes; i++) {
+        lens[i] = bench_prefix_len();
+        prefixes[i] = (uint32_t)bench_rand() & prefix_mask(lens[i]);
+        if (!fib_insert(&fib, prefixes[i], lens[i], 1 + i % 64)) {
+            printf("Error: Out of memory.\n");
+            return 1;
+        }
+    }
+    if (!fib_build_index(&fib)) {
+        printf("Error: Out of memory.\n");
+        return 1;
+    }
+    for (int i = 0; i < num_queries; i++) {
+        queries[i] = num_prefixes ? prefixes[bench_rand() % num_prefixes] | ((uint32_t)bench_rand() & 0xFF)
+                                  : (uint32_t)bench_rand();
+    }
+
+    long long checksum = 0;
+    double start = now_seconds();
+    for (int i = 0; i < num_queries; i++) checksum += fib_trie_lookup(&fib, queries[i]);
+    double trie_time = now_seconds() - start;
+    printf("Trie:     %6.1f ns/lookup, %6.1f MB (checksum %lld)\n", trie_time * 1e9 / num_queries,
+           (fib.count * sizeof(struct FibNode) + (sizeof(struct FibDirectEntry) << FIB_DIRECT_BITS)) / 1e6, checksum);
+
+    for (int huge = 0; huge < 2; huge++) {
+        start = now_seconds();
+        if (!fib_enable_dir24(&fib, huge)) {
+            printf("Error: Out of memory.\n");
+            return 1;
+        }
+        double build_time = now_seconds() - start;
+        const struct FibDir24 *d = fib.dir24;
+
+        checksum = 0;
+        start = now_seconds();
+        for (int i = 0; i < num_queries; i++) checksum += fib_dir24_lookup(d, queries[i]);
+        double dir24_time = now_seconds() - start;
+        printf("DIR-24-8: %6.1f ns/lookup, %6.1f MB, %u chunks, built in %.0f ms, %s, %.1fx (checksum %lld)\n",
+               dir24_time * 1e9 / num_queries,
+               (DIR24_TBL24_BYTES + ((size_t)d->num_chunks << 8) * sizeof(uint32_t)) / 1e6, d->num_chunks,
+               build_time * 1e3, pages[d->huge_pages], trie_time / dir24_time, checksum);
+        dir24_free(fib.dir24);
+        fib.dir24 = NULL;
+    }
+
+    // Incremental updates: drop random prefixes, then add them back on other routers
+    if (!fib_enable_dir24(&fib, false)) {
+        printf("Error: Out of memory.\n");
+        return 1;
+    }
+    int changes = num_prefixes < num_changes ? num_prefixes : num_changes;
+    int *picked = malloc((changes ? changes : 1) * sizeof(int));
+    if (picked == NULL) {
+        printf("Error: Out of memory.\n");
+        return 1;
+    }
+    for (int i = 0; i < changes; i++) picked[i] = (int)(bench_rand() % num_prefixes);
+    int removed = 0;
+    start = now_seconds();
+    for (int i = 0; i < changes; i++) removed += fib_remove(&fib, prefixes[picked[i]], lens[picked[i]]);
+    double delete_time = now_seconds() - start;
+    start = now_seconds();
+    for (int i = 0; i < changes; i++) {
+        if (!fib_insert(&fib, prefixes[picked[i]], lens[picked[i]], 65 + i % 64)) {
+            printf("Error: Out of memory.\n");
+            return 1;
+        }
+    }
+    double insert_time = now_seconds() - start;
+    int mismatches = 0;
+    for (int i = 0; i < num_queries; i++) {
+        mismatches += fib_dir24_lookup(fib.dir24, queries[i]) != fib_trie_lookup(&fib, queries[i]);
+    }
+    for (int i = 0; i < num_queries / 4; i++) {
+        uint32_t addr = (uint32_t)bench_rand();
+        mismatches += fib_dir24_lookup(fib.dir24, addr) != fib_trie_lookup(&fib, addr);
+    }
+    printf("Updates:  %d deletes %.2f us each, %d inserts %.2f us each, %u chunks allocated; %d mismatches vs. the trie\n",
+           removed, delete_time * 1e6 / (changes ? changes : 1), changes, insert_time * 1e6 / (changes ? changes : 1),
+           fib.dir24->num_chunks, mismatches);
+
+    fib_free(&fib);
+    free(picked);
+    free(prefixes);
+    free(lens);
+    free(queries);
+    return 0;
+}
+
+/**
+ * @brief Compares the vector scan used for small tables against the trie and
+ * the legacy strcmp scan, for tables of 2 to FIB_SMALL_MAX prefixes.
+ */
+int run_small_fib_benchmark(void) {
+    const int num_queries = 4000000;
+    const int num_legacy_queries = 400000;
+#if defined(__AVX2__)
+    const char *isa = "AVX2, 8 lanes";
+#elif defined(__SSE2__)
+    const char *isa = "SSE2, 4 lanes";
+#else
+    const char *isa = "scalar";
+#endif
+
+    printf("--- Small FIB Benchmark: vector scan (%s) vs. trie, up to %d prefixes ---\n", isa, FIB_SMALL_MAX);
+
+    uint32_t *queries = malloc(num_queries * sizeof(uint32_t));
+    if (queries == NULL) {
+        printf("Error: Out of memory.\n");
+        return 1;
+    }
+
+    for (int size = 2; size <= FIB_SMALL_MAX; size *= 2) {
+        uint32_t prefixes[FIB_SMALL_MAX];
+        char ip_strings[FIB_SMALL_MAX][MAX_IP_LEN];
+        struct Fib fib;
+        fib_init(&fib);
+        for (int i = 0; i < size; i++) {
+            uint8_t len = bench_prefix_len();
+            prefixes[i] = (uint32_t)bench_rand() & prefix_mask(len);
+            sprintf(ip_strings[i], "%u.%u.%u.%u", prefixes[i] >> 24, (prefixes[i] >> 16) & 0xFF,
+                    (prefixes[i] >> 8) & 0xFF, prefixes[i] & 0xFF);
+            if (!fib_insert(&fib, prefixes[i], len, 1 + i)) {
+                printf("Error: Out of memory.\n");
+                return 1;
+            }
+        }
+        if (!fib_build_index(&fib) || fib.small_count == 0) {
+            printf("Error: Small table not built.\n");
+            return 1;
+        }
+
+        // Most queries land inside a configured prefix, one in eight anywhere
+        for (int i = 0; i < num_queries; i++) {
+            queries[i] = i % 8 ? prefixes[bench_rand() % size] | ((uint32_t)bench_rand() & 0xFF) : (uint32_t)bench_rand();
+        }
+
+        long long vector_sum = 0, trie_sum = 0, legacy_sum = 0;
+        int mismatches = 0;
+        double start = now_seconds();
+        for (int i = 0; i < num_queries; i++) vector_sum += fib_small_lookup(&fib, queries[i]);
+        double vector_time = now_seconds() - start;
+
+        start = now_seconds();
+        for (int i = 0; i < num_queries; i++) trie_sum += fib_trie_lookup(&fib, queries[i]);
+        double trie_time = now_seconds() - start;
+
+        for (int i = 0; i < num_queries; i += 97) {
+            mismatches += fib_small_lookup(&fib, queries[i]) != fib_trie_lookup(&fib, queries[i]);
+        }
+
+        // Legacy baseline: the exact-match strcmp scan over the configured strings
+        start = now_seconds();
+        for (int q = 0; q < num_legacy_queries; q++) {
+            const char *needle = ip_strings[bench_rand() % size];
+            for (int i = 0; i < size; i++) {
+                if (strcmp(ip_strings[i], needle) == 0) {
+                    legacy_sum += 1 + i;
+                    break;
                 }
-                printf("--> R%d\n", dest_router);
-                
-                history_count++;
-            } else {
-                printf("\nWarning: Route history full.\n");
             }
+        }
+        double legacy_time = now_seconds() - start;
 
-        } // End of history check (else block)
+        printf("%3d prefixes: vector %5.1f ns, trie %5.1f ns, strcmp scan %6.1f ns/lookup (%d mismatches, "
+               "checksums %lld/%lld/%lld)\n",
+               size, vector_time * 1e9 / num_queries, trie_time * 1e9 / num_queries,
+               legacy_time * 1e9 / num_legacy_queries, mismatches, vector_sum, trie_sum, legacy_sum);
+        fib_free(&fib);
+    }
+    printf("fib_lookup uses the vector scan up to %d prefixes and the trie beyond.\n", FIB_SMALL_MAX);
 
-        // 4. Continue Prompt
-        printf("\nDo you want to continue routing? (0=Yes, 1=No): ");
-        if (scanf("%d", &continue_flag) != 1) {
-             while (getchar() != '\n');
-             continue_flag = 1; // Default to stop on bad input
+    free(queries);
+    return 0;
+}
+
+// Counts entries of a distance-vector block that differ from true shortest
+// distances (unreachable where the distance reaches the metric limit)
+static uint64_t dv_check_block(const struct DvState *s, const struct Graph *g, struct SearchWorkspace *ws,
+                               uint64_t *dist) {
+    uint64_t mismatches = 0;
+    for (uint32_t i = 0; i < s->width; i++) {
+        if (!graph_distances(g, ws, s->base + i + 1, dist)) return UINT64_MAX;
+        for (uint32_t x = 0; x < s->num_routers; x++) {
+            uint64_t expected = dist[x] < s->infinity ? dist[x] : s->infinity;
+            mismatches += s->dist[(size_t)x * 64 + i] != expected;
         }
     }
-    printf("\n--- Simulation Ended ---\n");
+    return mismatches;
+}
+
+/**
+ * @brief Measures distance-vector convergence on a random topology: cold
+ * starts for a sample of destination blocks (checked against BFS), then
+ * reconvergence after a link failure and after a router is cut off, with
+ * and without split horizon.
+ * @param num_routers Number of routers in the generated topology.
+ */
+int run_dv_benchmark(uint32_t num_routers) {
+    enum { num_blocks = 4 };
+    int threads = num_worker_threads > 0 ? num_worker_threads : default_thread_count();
+    struct Graph g;
+    struct SearchWorkspace ws;
+    struct DvState s;
+    uint64_t *dist = malloc((size_t)num_routers * sizeof(uint64_t));
+    if (dist == NULL || !bench_make_graph(&g, num_routers, 6, false) || !search_workspace_init(&ws, num_routers) ||
+        !dv_state_init(&s, &g, dv_metric_infinity(&g), true)) {
+        printf("Error: Out of memory.\n");
+        return 1;
+    }
+    printf("--- Distance-Vector Benchmark: %u routers, %d blocks of 64 destinations, %d threads, infinity %u ---\n",
+           num_routers, num_blocks, threads, s.infinity);
+
+    uint64_t mismatches = 0;
+    double total_time = 0;
+    struct DvStats cold = { 0 };
+    for (int b = 0; b < num_blocks; b++) {
+        struct DvStats block = { 0 };
+        uint32_t base = (uint32_t)(bench_rand() % (num_routers > 64 ? num_routers - 64 : 1));
+        dv_state_reset(&s, base, num_routers - base < 64 ? num_routers - base : 64);
+        double start = now_seconds();
+        if (!dv_converge(&s, threads, &block)) {
+            printf("Error: Out of memory.\n");
+            return 1;
+        }
+        total_time += now_seconds() - start;
+        if (block.rounds > cold.rounds) cold.rounds = block.rounds;
+        cold.route_changes += block.route_changes;
+        cold.entries_sent += block.entries_sent;
+        mismatches += dv_check_block(&s, &g, &ws, dist);
+    }
+    double per_block = total_time / num_blocks;
+    printf("Cold start: %u rounds, %.1f ms per 64 destinations (full table: %.1f s), %.1f route changes and "
+           "%.1f entries sent per router and destination, %llu mismatches vs BFS\n",
+           cold.rounds, per_block * 1e3, per_block * ((num_routers + 63) / 64),
+           (double)cold.route_changes / ((double)num_blocks * 64 * num_routers),
+           (double)cold.entries_sent / ((double)num_blocks * 64 * num_routers), (unsigned long long)mismatches);
+
+    // Failures, with the destination block starting at the affected router
+    uint32_t d = (uint32_t)(bench_rand() % (num_routers - 64));
+    for (int split = 1; split >= 0; split--) {
+        s.split_horizon = split;
+
+        // One link of d fails: routes move to the next best path
+        struct Graph failed;
+        uint32_t peer = g.neighbors[g.offsets[d]];
+        struct DvStats warm = { 0 }, fail = { 0 };
+        dv_set_graph(&s, &g);
+        dv_state_reset(&s, d, 64);
+        bool ok = dv_converge(&s, threads, &warm) && graph_with_link(&g, d + 1, peer + 1, 0, false, &failed);
+        double start = now_seconds();
+        ok = ok && dv_link_changed(&s, &failed, d, peer) && dv_converge(&s, threads, &fail);
+        double link_time = now_seconds() - start;
+        uint64_t link_mismatches = ok ? dv_check_block(&s, &failed, &ws, dist) : 0;
+        graph_free(&failed);
+
+        // Every link of d fails: routes to d count up to infinity
+        struct DvStats cut = { 0 };
+        warm = (struct DvStats){ 0 };
+        ok = ok && dv_set_graph(&s, &g);
+        dv_state_reset(&s, d, 64);
+        ok = ok && dv_converge(&s, threads, &warm);
+        struct Graph isolated = g, next;
+        bool own = false;
+        for (uint64_t k = g.offsets[d]; ok && k < g.offsets[d + 1]; k++) {
+            ok = graph_with_link(&isolated, d + 1, g.neighbors[k] + 1, 0, false, &next);
+            if (own) graph_free(&isolated);
+            isolated = next;
+            own = true;
+            ok = ok && dv_link_changed(&s, &isolated, d, g.neighbors[k]);
+        }
+        start = now_seconds();
+        ok = ok && dv_converge(&s, threads, &cut);
+        double cut_time = now_seconds() - start;
+        uint64_t cut_mismatches = ok ? dv_check_block(&s, &isolated, &ws, dist) : 0;
+        if (own) graph_free(&isolated);
+        if (!ok) {
+            printf("Error: Out of memory.\n");
+            return 1;
+        }
+
+        // A chain of 8 routers loses its last link: without split horizon,
+        // neighbors keep pointing at each other (the classic two-node loop)
+        struct Graph chain, cut_chain;
+        struct DvState c;
+        struct DvStats chain_stats = { 0 };
+        struct Edge edges[2 * 7];
+        for (uint32_t i = 0; i < 7; i++) {
+            edges[2 * i] = (struct Edge){ i, i + 1, 1 };
+            edges[2 * i + 1] = (struct Edge){ i + 1, i, 1 };
+        }
+        ok = graph_build(&chain, 8, edges, 2 * 7, false) && graph_with_link(&chain, 7, 8, 0, false, &cut_chain) &&
+             dv_state_init(&c, &chain, DV_RIP_INFINITY, split);
+        if (ok) {
+            struct DvStats warm_chain = { 0 };
+            dv_state_reset(&c, 0, 8);
+            ok = dv_converge(&c, 1, &warm_chain) && dv_link_changed(&c, &cut_chain, 6, 7) &&
+                 dv_converge(&c, 1, &chain_stats);
+        }
+        uint64_t chain_mismatches = ok ? dv_check_block(&c, &cut_chain, &ws, dist) : 0;
+        dv_state_free(&c);
+        graph_free(&chain);
+        graph_free(&cut_chain);
+        if (!ok) {
+            printf("Error: Out of memory.\n");
+            return 1;
+        }
+
+        printf("%s: link failure %u rounds (%.1f ms, %llu route changes), router cut off %u rounds (%.1f ms, "
+               "%llu route changes), chain cut %u rounds, %llu mismatches\n",
+               split ? "Split horizon + poisoned reverse" : "No split horizon", fail.rounds, link_time * 1e3,
+               (unsigned long long)fail.route_changes, cut.rounds, cut_time * 1e3,
+               (unsigned long long)cut.route_changes, chain_stats.rounds,
+               (unsigned long long)(link_mismatches + cut_mismatches + chain_mismatches));
+        mismatches += link_mismatches + cut_mismatches + chain_mismatches;
+    }
+
+    dv_state_free(&s);
+    search_workspace_free(&ws);
+    graph_free(&g);
+    free(dist);
+    return mismatches == 0 ? 0 : 1;
+}
+
+// Counts distances in a sample of link-state routers' trees that differ from
+// true shortest distances
+static uint64_t ls_check_routers(const struct LinkStateSim *sim, const struct Graph *g, struct SearchWorkspace *ws,
+                                 uint64_t *dist, uint32_t samples) {
+    uint64_t mismatches = 0;
+    uint32_t n = sim->num_routers;
+    for (uint32_t i = 0; i < samples && i < n; i++) {
+        uint32_t r = i == 0 ? 0 : (uint32_t)(bench_rand() % n);
+        if (!graph_distances(g, ws, r + 1, dist)) return UINT64_MAX;
+        for (uint32_t v = 0; v < n; v++) {
+            mismatches += sim->dist[(size_t)r * n + v] != dist[v];
+        }
+    }
+    return mismatches;
+}
+
+static void ls_print_episode(const char *name, const struct LinkStateSim *sim, uint64_t start, double wall) {
+    const struct LsStats *st = &sim->stats;
+    printf("  %-14s converged %8.1f ms (flooding done %6.2f ms), %6llu full SPF %7.1f us, %6llu incremental "
+           "SPF %7.1f us, %9llu LSAs sent, %.2f s\n",
+           name, (double)(st->converged_at - start) / 1e6,
+           st->flooded_at > start ? (double)(st->flooded_at - start) / 1e6 : 0.0, (unsigned long long)st->full_spf,
+           st->full_spf ? st->full_spf_time * 1e6 / (double)st->full_spf : 0.0,
+           (unsigned long long)st->incremental_spf,
+           st->incremental_spf ? st->incremental_spf_time * 1e6 / (double)st->incremental_spf : 0.0,
+           (unsigned long long)st->lsas_flooded, wall);
+}
+
+/**
+ * @brief Measures link-state convergence as the network grows: for each size,
+ * a cold start, single link failures and repairs (handled by incremental
+ * SPF), and a flapping link (where SPF throttling backs off). Sampled
+ * routers' trees are checked against Dijkstra after every episode.
+ * @param sizes Router counts to measure (random weighted graphs of degree 6).
+ */
+int run_ls_benchmark(const uint32_t *sizes, int num_sizes) {
+    enum { num_failures = 4, num_flaps = 6, num_samples = 8 };
+    const uint64_t quiet_ns = 10000000000ull; // Between episodes, longer than the SPF throttle maximum
+    printf("--- Link-State Benchmark: SPF throttle %u/%u/%u ms, %d failures + repairs, %d flaps ---\n",
+           spf_throttle_ms[0], spf_throttle_ms[1], spf_throttle_ms[2], num_failures, num_flaps);
+    uint64_t mismatches = 0;
+
+    for (int i = 0; i < num_sizes; i++) {
+        uint32_t n = sizes[i];
+        struct Graph g, current;
+        struct SearchWorkspace ws;
+        struct LinkStateSim sim;
+        uint64_t *dist = malloc((size_t)n * sizeof(uint64_t));
+        if (dist == NULL || !bench_make_graph(&g, n, 6, true) || !search_workspace_init(&ws, n) || !ls_init(&sim, &g)) {
+            printf("Error: Out of memory.\n");
+            return 1;
+        }
+        printf("%u routers, %llu links:\n", n, (unsigned long long)g.num_links / 2);
+
+        double start = now_seconds();
+        bool ok = ls_start(&sim) && ls_run(&sim);
+        ls_print_episode("Cold start", &sim, 0, now_seconds() - start);
+        uint64_t bad = ok ? ls_check_routers(&sim, &g, &ws, dist, num_samples) : 0;
+
+        // A random link fails, everything reconverges, then it comes back
+        struct LsStats sums[2] = { { 0 } };
+        double walls[2] = { 0 };
+        for (int f = 0; ok && f < num_failures; f++) {
+            uint32_t a = (uint32_t)(bench_rand() % n), b;
+            do {
+                b = g.neighbors[g.offsets[a] + bench_rand() % (g.offsets[a + 1] - g.offsets[a])];
+            } while (b == a);
+            ok = graph_with_link(&g, a + 1, b + 1, 0, false, &current);
+            for (int repair = 0; ok && repair < 2; repair++) {
+                const struct Graph *after = repair ? &g : &current;
+                uint64_t episode = sim.wheel.now + quiet_ns;
+                memset(&sim.stats, 0, sizeof(sim.stats));
+                start = now_seconds();
+                ok = ls_schedule_link_change(&sim, after, a, b, episode) && ls_run(&sim);
+                struct LsStats *sum = &sums[repair];
+                sum->full_spf += sim.stats.full_spf;
+                sum->full_spf_time += sim.stats.full_spf_time;
+                sum->incremental_spf += sim.stats.incremental_spf;
+                sum->incremental_spf_time += sim.stats.incremental_spf_time;
+                sum->lsas_flooded += sim.stats.lsas_flooded;
+                sum->flooded_at += sim.stats.flooded_at - episode;
+                sum->converged_at += sim.stats.converged_at - episode;
+                walls[repair] += now_seconds() - start;
+                bad += ok ? ls_check_routers(&sim, after, &ws, dist, num_samples) : 0;
+            }
+            graph_free(&current);
+        }
+        const char *names[2] = { "Link failure", "Link repair" };
+        for (int s = 0; ok && s < 2; s++) {
+            // Averages per episode, printed as one episode starting at 0
+            sim.stats = sums[s];
+            sim.stats.full_spf /= num_failures;
+            sim.stats.incremental_spf /= num_failures;
+            sim.stats.lsas_flooded /= num_failures;
+            sim.stats.flooded_at /= num_failures;
+            sim.stats.converged_at /= num_failures;
+            sim.stats.full_spf_time /= num_failures;
+            sim.stats.incremental_spf_time /= num_failures;
+            ls_print_episode(names[s], &sim, 0, walls[s] / num_failures);
+        }
+
+        // The ring link 0-1 flaps every 20 ms: routers back off instead of running SPF on every change
+        struct Graph down;
+        uint32_t a = 0, b = 1;
+        uint64_t episode = sim.wheel.now + quiet_ns;
+        memset(&sim.stats, 0, sizeof(sim.stats));
+        ok = ok && graph_with_link(&g, a + 1, b + 1, 0, false, &down);
+        for (int f = 0; ok && f < 2 * num_flaps; f++) {
+            ok = ls_schedule_link_change(&sim, f % 2 == 0 ? &down : &g, a, b, episode + (uint64_t)f * 20000000);
+        }
+        start = now_seconds();
+        ok = ok && ls_run(&sim);
+        if (ok) {
+            ls_print_episode("Flapping link", &sim, episode, now_seconds() - start);
+            bad += ls_check_routers(&sim, &g, &ws, dist, num_samples);
+            graph_free(&down);
+        }
+        if (!ok) {
+            printf("Error: Out of memory.\n");
+            return 1;
+        }
+        printf("  %llu mismatches vs Dijkstra in %d sampled routers per episode\n", (unsigned long long)bad,
+               num_samples);
+        mismatches += bad;
+
+        ls_free(&sim);
+        search_workspace_free(&ws);
+        graph_free(&g);
+        free(dist);
+    }
+    return mismatches == 0 ? 0 : 1;
+}
+
+/**
+ * @brief Measures the packet simulator: first the event queue alone (the
+ * classic "hold" workload: take the earliest event, schedule a new one a
+ * random delay later) against the 4-ary heap used by Dijkstra, checking that
+ * both hand out the same times; then a full simulation of many flows on a
+ * random topology.
+ * @param num_routers Number of routers in the generated topology.
+ */
+int run_sim_benchmark(uint32_t num_routers) {
+    enum { num_pending = 1000000, num_holds = 20000000, num_flows = 4000, packets_per_flow = 5000 };
+    printf("--- Packet Simulation Benchmark: %u routers, %d flows x %d packets ---\n", num_routers, num_flows,
+           packets_per_flow);
+
+    // Hold model: both queues see the same delays, so they must pop the same times
+    struct TimingWheel wheel;
+    struct SearchWorkspace ws;
+    uint64_t *popped = malloc(num_holds * sizeof(uint64_t));
+    wheel_init(&wheel);
+    if (popped == NULL || !search_workspace_init(&ws, 1)) {
+        printf("Error: Out of memory.\n");
+        return 1;
+    }
+    uint64_t seed = bench_rng_state;
+    bool ok = true;
+    for (int i = 0; i < num_pending; i++) {
+        ok &= wheel_schedule(&wheel, (struct SimEvent){ bench_rand() % 1000000, 0, 0, 0, 0 });
+    }
+    double start = now_seconds();
+    for (int i = 0; ok && i < num_holds; i++) {
+        struct SimEvent e;
+        ok = wheel_next(&wheel, &e);
+        popped[i] = e.time;
+        e.time = wheel.now + bench_rand() % 1000000;
+        ok = ok && wheel_schedule(&wheel, e);
+    }
+    if (!ok) {
+        printf("Error: Out of memory.\n");
+        return 1;
+    }
+    double wheel_time = now_seconds() - start;
+
+    bench_rng_state = seed;
+    for (int i = 0; i < num_pending; i++) {
+        if (!heap_push(&ws, bench_rand() % 1000000, 0)) {
+            printf("Error: Out of memory.\n");
+            return 1;
+        }
+    }
+    uint64_t order_mismatches = 0;
+    start = now_seconds();
+    for (int i = 0; i < num_holds; i++) {
+        struct HeapItem item = heap_pop(&ws);
+        order_mismatches += item.dist != popped[i];
+        heap_push(&ws, item.dist + bench_rand() % 1000000, 0);
+    }
+    double heap_time = now_seconds() - start;
+    printf("Event queue (%d pending, %d holds): timing wheel %.1f ns, 4-ary heap %.1f ns per hold (%.2fx), "
+           "%llu order mismatches\n", num_pending, num_holds, wheel_time / num_holds * 1e9,
+           heap_time / num_holds * 1e9, heap_time / wheel_time, (unsigned long long)order_mismatches);
+    wheel_free(&wheel);
+    search_workspace_free(&ws);
+    free(popped);
+
+    // Full simulation: random flows on weighted links (1-10 us of delay each)
+    struct Graph g;
+    struct PacketSim sim;
+    struct PathBuilder path;
+    path_builder_init(&path);
+    if (!bench_make_graph(&g, num_routers, 6, true) || !search_workspace_init(&ws, num_routers) ||
+        !packet_sim_init(&sim, &g, 100000, 256 * 1024)) {
+        printf("Error: Out of memory.\n");
+        return 1;
+    }
+    for (int f = 0; f < num_flows; f++) {
+        uint32_t src = 1 + (uint32_t)(bench_rand() % num_routers), dst = 1 + (uint32_t)(bench_rand() % num_routers);
+        path.length = 0;
+        bool found = graph_shortest_path(&g, &ws, src, dst, &path, NULL);
+        if (!packet_sim_add_flow(&sim, &g, src, dst, path.hops, found ? path.length : 0, packets_per_flow, 1500,
+                                 bench_rand() % 10000, 2000 + bench_rand() % 8000)) {
+            printf("Error: Out of memory.\n");
+            return 1;
+        }
+    }
+    start = now_seconds();
+    if (!packet_sim_run(&sim)) {
+        printf("Error: Out of memory.\n");
+        return 1;
+    }
+    double elapsed = now_seconds() - start;
+
+    uint64_t sent, delivered, dropped, hops = 0;
+    uint32_t unrouted;
+    packet_sim_totals(&sim, &sent, &delivered, &dropped, &unrouted);
+    for (uint32_t i = 0; i < sim.num_flows; i++) {
+        if (sim.flows[i].hops != SIM_NO_ROUTE) hops += sim.flows[i].hops;
+    }
+    printf("Simulated %.1f ms of traffic: %llu packets (%.1f hops on average), %llu delivered, %llu dropped\n",
+           sim.wheel.now / 1e6, (unsigned long long)sent, (double)hops / (num_flows - unrouted),
+           (unsigned long long)delivered, (unsigned long long)dropped);
+    printf("%llu events in %.3f s: %.1f M events/s (%.0f ns per event)\n", (unsigned long long)sim.events, elapsed,
+           sim.events / elapsed / 1e6, elapsed / sim.events * 1e9);
+    printf("End-to-end latency: p50 %.1f us, p99 %.1f us, p99.9 %.1f us\n", packet_sim_percentile(&sim, 0.5) / 1e3,
+           packet_sim_percentile(&sim, 0.99) / 1e3, packet_sim_percentile(&sim, 0.999) / 1e3);
+
+    path_builder_free(&path);
+    packet_sim_free(&sim);
+    search_workspace_free(&ws);
+    graph_free(&g);
+    return order_mismatches == 0 ? 0 : 1;
 }
 
-int main() {
+int main(int argc, char **argv) {
     // Disable synchronization with C stdio for better performance measurement
     // Not strictly necessary for this program, but good practice in competitive programming environments.
     // std::ios_base::sync_with_stdio(false); is C++ specific.
-    
+
+    ipv4_parser_init();
+
+    // Options for the interactive simulation
+    for (int i = 1; i + 1 < argc; i++) {
+        if (strcmp(argv[i], "--cache-size") == 0) {
+            route_cache_capacity = (size_t)strtoull(argv[i + 1], NULL, 10);
+        }
+        if (strcmp(argv[i], "--threads") == 0) {
+            num_worker_threads = atoi(argv[i + 1]);
+        }
+        if (strcmp(argv[i], "--topology") == 0) topology_path = argv[i + 1];
+        if (strcmp(argv[i], "--networks") == 0) networks_path = argv[i + 1];
+        if (strcmp(argv[i], "--batch") == 0) batch_path = argv[i + 1];
+        if (strcmp(argv[i], "--compile") == 0) compile_path = argv[i + 1];
+        if (strcmp(argv[i], "--image") == 0) image_path = argv[i + 1];
+        if (strcmp(argv[i], "--route-cache") == 0) route_cache_path = argv[i + 1];
+        if (strcmp(argv[i], "--cache-save-interval") == 0) cache_save_interval = atof(argv[i + 1]);
+        if (strcmp(argv[i], "--simulate") == 0) simulate_path = argv[i + 1];
+        if (strcmp(argv[i], "--link-bandwidth") == 0) sim_link_mbps = (uint32_t)strtoul(argv[i + 1], NULL, 10);
+        if (strcmp(argv[i], "--queue-bytes") == 0) sim_queue_bytes = strtoull(argv[i + 1], NULL, 10);
+        if (strcmp(argv[i], "--dv-infinity") == 0) dv_infinity = (uint32_t)strtoul(argv[i + 1], NULL, 10);
+        if (strcmp(argv[i], "--spf-throttle") == 0 &&
+            sscanf(argv[i + 1], "%u,%u,%u", &spf_throttle_ms[0], &spf_throttle_ms[1], &spf_throttle_ms[2]) != 3) {
+            printf("Error: --spf-throttle expects START,HOLD,MAX in milliseconds.\n");
+            return 1;
+        }
+        if (strcmp(argv[i], "--fib") == 0) {
+            if (strcmp(argv[i + 1], "dir24") == 0) fib_dir24_mode = true;
+            else if (strcmp(argv[i + 1], "trie") != 0) {
+                printf("Error: Unknown --fib '%s' (expected trie or dir24).\n", argv[i + 1]);
+                return 1;
+            }
+        }
+    }
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--auto") == 0) auto_route_mode = true;
+        if (strcmp(argv[i], "--precompute") == 0) auto_route_mode = precompute_mode = true;
+        if (strcmp(argv[i], "--distance-vector") == 0) auto_route_mode = precompute_mode = distance_vector_mode = true;
+        if (strcmp(argv[i], "--no-split-horizon") == 0) dv_split_horizon = false;
+        if (strcmp(argv[i], "--link-state") == 0) auto_route_mode = precompute_mode = link_state_mode = true;
+        if (strcmp(argv[i], "--ecmp") == 0) ecmp_mode = route_cache_per_flow = true;
+        if (strcmp(argv[i], "--huge-pages") == 0) huge_pages_mode = true;
+    }
+
+    if (argc > 1 && strcmp(argv[1], "--bench-fib") == 0) {
+        return run_fib_benchmark(argc > 2 ? atoi(argv[2]) : 1000000);
+    }
+    if (argc > 1 && strcmp(argv[1], "--bench-fib-batch") == 0) {
+        return run_fib_batch_benchmark(argc > 2 ? atoi(argv[2]) : 1000000);
+    }
+    if (argc > 1 && strcmp(argv[1], "--bench-dir24") == 0) {
+        return run_dir24_benchmark(argc > 2 ? atoi(argv[2]) : 1000000);
+    }
+    if (argc > 1 && strcmp(argv[1], "--bench-small-fib") == 0) {
+        return run_small_fib_benchmark();
+    }
+    if (argc > 1 && strcmp(argv[1], "--bench-parse") == 0) {
+        return run_parse_benchmark(argc > 2 ? atoi(argv[2]) : 5000000);
+    }
+    if (argc > 1 && strcmp(argv[1], "--bench-cache") == 0) {
+        return run_cache_benchmark(argc > 2 ? atoi(argv[2]) : 4000000);
+    }
+    if (argc > 1 && strcmp(argv[1], "--bench-route") == 0) {
+        return run_route_benchmark(argc > 2 ? (uint32_t)atoi(argv[2]) : 100000);
+    }
+    if (argc > 1 && strcmp(argv[1], "--bench-graph") == 0) {
+        return run_graph_benchmark(argc > 2 ? (uint32_t)atoi(argv[2]) : 1000000);
+    }
+    if (argc > 1 && strcmp(argv[1], "--bench-config") == 0) {
+        return run_config_benchmark(argc > 2 ? (uint32_t)atoi(argv[2]) : 200000);
+    }
+    if (argc > 1 && strcmp(argv[1], "--bench-query") == 0) {
+        return run_query_benchmark(argc > 2 ? (uint32_t)atoi(argv[2]) : 10000);
+    }
+    if (argc > 1 && strcmp(argv[1], "--bench-update") == 0) {
+        return run_update_benchmark(argc > 2 ? (uint32_t)atoi(argv[2]) : 20000);
+    }
+    if (argc > 1 && strcmp(argv[1], "--bench-repair") == 0) {
+        return run_repair_benchmark(argc > 2 ? (uint32_t)atoi(argv[2]) : 10000);
+    }
+    if (argc > 1 && strcmp(argv[1], "--bench-ecmp") == 0) {
+        return run_ecmp_benchmark(argc > 2 ? (uint32_t)atoi(argv[2]) : 10000);
+    }
+    if (argc > 1 && strcmp(argv[1], "--bench-apsp") == 0) {
+        uint32_t sizes[16] = { 1000, 10000, 50000 };
+        int num_sizes = 3;
+        if (argc > 2) {
+            for (num_sizes = 0; num_sizes < 16 && num_sizes + 2 < argc && isdigit((unsigned char)argv[num_sizes + 2][0]); num_sizes++) {
+                sizes[num_sizes] = (uint32_t)atoi(argv[num_sizes + 2]);
+            }
+        }
+        return run_apsp_benchmark(sizes, num_sizes);
+    }
+    if (argc > 1 && strcmp(argv[1], "--bench-dv") == 0) {
+        return run_dv_benchmark(argc > 2 ? (uint32_t)atoi(argv[2]) : 100000);
+    }
+    if (argc > 1 && strcmp(argv[1], "--bench-ls") == 0) {
+        uint32_t sizes[16] = { 1000, 2000, 4000 };
+        int num_sizes = 3;
+        if (argc > 2) {
+            for (num_sizes = 0; num_sizes < 16 && num_sizes + 2 < argc && isdigit((unsigned char)argv[num_sizes + 2][0]); num_sizes++) {
+                sizes[num_sizes] = (uint32_t)atoi(argv[num_sizes + 2]);
+            }
+        }
+        return run_ls_benchmark(sizes, num_sizes);
+    }
+    if (argc > 1 && strcmp(argv[1], "--bench-sim") == 0) {
+        return run_sim_benchmark(argc > 2 ? (uint32_t)atoi(argv[2]) : 10000);
+    }
+    if (argc > 1 && strcmp(argv[1], "--bench-path") == 0) {
+        return run_path_benchmark(argc > 2 ? atoi(argv[2]) : 2000000);
+    }
+
+    if (compile_path != NULL) return compile_network_image(compile_path);
+    if (simulate_path != NULL) return run_packet_simulation(simulate_path);
+    if (batch_path != NULL) {
+        auto_route_mode = true;
+        return run_batch_queries(batch_path);
+    }
+
     run_routing_simulation();
     
     return 0;